@@ -0,0 +1,32 @@
+#ifndef ADDRSPACE_H
+#define ADDRSPACE_H
+
+#include <stdint.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+
+// counters for the calls that change the tracee's address space, see
+// --trace-mmap. The byte counts are requested sizes.
+typedef struct AddrSpaceStats {
+    uint64_t mmap_count;
+    uint64_t mmap_bytes;
+    uint64_t munmap_count;
+    uint64_t munmap_bytes;
+    uint64_t mremap_count;
+    uint64_t mremap_grown_bytes;
+    uint64_t mremap_shrunk_bytes;
+    uint64_t sbrk_count;
+    uint64_t sbrk_grown_bytes;
+    uint64_t sbrk_trimmed_bytes; // by negative increments, e.g. from malloc_trim
+} AddrSpaceStats;
+
+extern int OPT_TRACE_MMAP;
+
+void pre_mmap(HeaptraceContext *ctx, uint64_t len);
+void pre_munmap(HeaptraceContext *ctx, uint64_t len);
+void pre_mremap(HeaptraceContext *ctx, uint64_t old_len, uint64_t new_len);
+void pre_sbrk(HeaptraceContext *ctx, uint64_t increment);
+void show_addrspace_stats(HeaptraceContext *ctx);
+void show_addrspace_stats_jsonl(HeaptraceContext *ctx);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+// how much memory a chunk really takes for a requested size. Only used for
+// the unfreed bytes and --callsites totals.
+typedef enum ChunkModel {
+    CHUNK_MODEL_GLIBC, // request2size: a size header, rounded up to 16 bytes
+    CHUNK_MODEL_CLASSES, // jemalloc's size classes, 4 per power of two
+    CHUNK_MODEL_EXACT // exactly what was requested, e.g. pool allocators
+} ChunkModel;
+
+// binds an extra symbol to one of heaptrace's heap functions (see
+// breakpoint_defs), e.g. `pool_alloc = malloc(pool, size)`
+typedef struct AllocatorEntry {
+    char *symbol;
+    char *func;
+    int args[3]; // register (0=rdi ... 5=r9) holding each of func's arguments
+} AllocatorEntry;
+
+typedef struct AllocatorProfile {
+    char *name;
+
+    // part of the path of the library that defines the allocator. If it is
+    // mapped, every heap function it exports takes priority over libc's,
+    // like it does for the dynamic linker. 0 means glibc.
+    char *library;
+    ChunkModel chunks;
+    int outside_heap; // chunks may be carved out of static memory (e.g. a pool in .bss)
+
+    AllocatorEntry *entries;
+    size_t entries_sz;
+
+    struct AllocatorProfile *_next;
+} AllocatorProfile;
+
+extern char *OPT_ALLOCATOR;
+extern char *OPT_ALLOCATOR_FILE;
+extern AllocatorProfile *ALLOCATOR; // the selected profile, see select_allocator
+extern ChunkModel ALLOCATOR_CHUNKS;
+
+void select_allocator();
+int allocator_func_nargs(const char *func);
+
+
+static inline uint64_t allocator_chunk_size(uint64_t req) {
+    if (ALLOCATOR_CHUNKS == CHUNK_MODEL_GLIBC) return CHUNK_SIZE(req);
+    if (ALLOCATOR_CHUNKS == CHUNK_MODEL_EXACT) return req;
+
+    if (req <= 8) return 8;
+    if (req <= 128) return (req + 15) & ~(uint64_t)15;
+    uint64_t spacing = (uint64_t)1 << (63 - __builtin_clzll(req - 1) - 2);
+    return (req + spacing - 1) & ~(spacing - 1);
+}
+
+#endif
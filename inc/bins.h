@@ -0,0 +1,85 @@
+#ifndef BINS_H
+#define BINS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+typedef struct Chunk Chunk;
+
+#define TCACHE_MAX_BINS 64
+#define TCACHE_FILL_COUNT 7
+#define NFASTBINS 10
+#define NSMALLBINS 64
+
+// BinNode.bin
+#define BIN_TCACHE 0
+#define BIN_FAST 1
+#define BIN_UNSORTED 2
+#define BIN_SMALL 3
+#define BIN_LARGE 4
+#define BIN_MMAPPED 5 // not in a list, only remembered until it is freed
+
+// a free chunk (or an mmapped one) in the model
+typedef struct BinNode {
+    uint64_t chunk; // address of the chunk header, ptr - 0x10
+    uint64_t size;
+    int bin; // BIN_*
+    struct BinNode *prev; // towards the head of its list
+    struct BinNode *next;
+    struct BinNode *hnext[2]; // chains of BinModel.by_start and by_end
+} BinNode;
+
+typedef struct BinList {
+    BinNode *head; // where glibc inserts
+    BinNode *tail;
+    uint64_t count;
+} BinList;
+
+// a hash table of nodes by chunk address or by chunk end address
+typedef struct BinMap {
+    BinNode **buckets;
+    size_t cap;
+    size_t sz;
+} BinMap;
+
+/*
+ * glibc's bins as predicted from the heap operations alone, see bins.c. All
+ * sizes are chunk sizes.
+ */
+typedef struct BinModel {
+    int initialized;
+    int has_tcache; // glibc 2.26+
+    int tcache_double_free_check; // glibc 2.29+
+
+    BinList tcache[TCACHE_MAX_BINS];
+    BinList fast[NFASTBINS];
+    BinList unsorted;
+    BinList small[NSMALLBINS];
+    BinList large; // not sorted; the model never predicts from it
+    uint64_t fast_count; // chunks in all fastbins
+
+    BinMap by_start; // every node
+    BinMap by_end; // nodes in unsorted, small and large bins, for merging
+
+    uint64_t top; // start of the top chunk, 0 if unknown
+    uint64_t last_remainder;
+    uint64_t mmap_threshold;
+    uint64_t realloc_size; // chunk size of the chunk being realloc'd
+
+    uint64_t predictions;
+    uint64_t divergences;
+} BinModel;
+
+extern int OPT_BINS;
+
+void bins_malloc(HeaptraceContext *ctx, Chunk *chunk, uint64_t req, int from_calloc);
+void bins_free(HeaptraceContext *ctx, Chunk *chunk);
+void bins_pre_realloc(HeaptraceContext *ctx, Chunk *orig);
+void bins_realloc(HeaptraceContext *ctx, Chunk *orig, Chunk *chunk, uint64_t req);
+void bins_aligned(HeaptraceContext *ctx, Chunk *chunk, uint64_t req);
+void show_bins_stats(HeaptraceContext *ctx);
+void show_bins_stats_jsonl(HeaptraceContext *ctx);
+void free_bins(HeaptraceContext *ctx);
+
+#endif
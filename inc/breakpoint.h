@@ -14,7 +14,7 @@
 
 #include "util.h"
 
-#define BREAKPOINTS_COUNT 32
+#define BREAKPOINTS_COUNT 64
 #include "context.h"
 
 #ifndef BREAKPOINT_H
@@ -38,9 +38,23 @@ typedef struct Breakpoint {
     uint arg_options[3];
     uint ret_options;
 
+    // register (0=rdi ... 5=r9) each pre_handler argument is read from, see 
+    // AllocatorEntry
+    int args[3];
+
+    // bookkeeping breakpoints (e.g. --trace-mmap): the pre_handler runs even 
+    // inside of another heap function, and nothing is logged
+    int nested;
+
+    // operator new/delete: the allocator functions they call are disarmed 
+    // until they return
+    int wrapper;
+
     // internal use only
     int _is_inside;
     void *_bp;
+    uint64_t _ret_slot; // return catchers: where the return address was stored
+    int _inner; // called by a wrapper before
 } Breakpoint;
 
 void install_breakpoint(HeaptraceContext *ctx, Breakpoint *bp);
@@ -0,0 +1,17 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct HeaptraceFile HeaptraceFile;
+
+// bump whenever symbol resolution or funcid can produce different results
+#define CACHE_FORMAT_VERSION 2
+
+extern int OPT_NO_CACHE;
+
+int cache_load(HeaptraceFile *hf, char *names[], char **version);
+void cache_store(HeaptraceFile *hf, const char *version);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CALLSITE_H
+#define CALLSITE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+typedef struct Chunk Chunk;
+
+#define CALLSITE_DEFAULT_TOP 10
+
+// per-caller allocation counters, keyed by the heap function's return address
+typedef struct CallSite {
+    uint64_t addr; // 0 means the slot is empty
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t live_count;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} CallSite;
+
+extern int OPT_CALLSITES; // number of call sites to show per list, 0 = disabled
+
+void callsite_alloc(HeaptraceContext *ctx, Chunk *chunk);
+void callsite_free(HeaptraceContext *ctx, Chunk *chunk);
+void callsite_resize(HeaptraceContext *ctx, Chunk *chunk, uint64_t old_bytes);
+void show_callsite_stats(HeaptraceContext *ctx);
+void free_callsites(HeaptraceContext *ctx);
+
+#endif
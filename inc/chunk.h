@@ -11,14 +11,34 @@ typedef struct Chunk {
     uint64_t ptr;
     uint64_t size;
     uint64_t ops[4]; // for tracking where ops happened: [placeholder for STATE_UNUSED, STATE_MALLOC oid, STATE_FREE oid, STATE_REALLOC oid]
+    int api; // ALLOC_API_*
+    uint64_t site; // --callsites: return address of the live allocation, 0 if not live
+    uint64_t real_size; // --real-sizes: the size field of its malloc header, 0 if not read yet
+    int size_pending; // --real-sizes: queued in ctx->size_batch
+    int uaf_state; // --check-uaf: UAF_*
+    uint64_t uaf_hash; // --check-uaf: hash of the uaf_len bytes after the freelist pointers
+    uint64_t uaf_len;
+    uint64_t uaf_words[2]; // --check-uaf: a small chunk's first 2 words after fd and bk, which aren't hashed
+    uint64_t redzone; // --redzone: size of the canary after the chunk, 0 if it has none
+    uint64_t overflow; // --redzone: bytes past the end found overwritten at exit
+    uint64_t caller; // --leak-check: return address of the call that allocated it
+    uint64_t bin_size; // --bins: its chunk size in the bin model, 0 if not known
 
     struct Chunk *left;
     struct Chunk *right;
 } Chunk;
 
 
+#define SIZE_BATCH_SZ 128 // chunk headers read per process_vm_readv
+
+extern int OPT_REAL_SIZES;
+
 Chunk *alloc_chunk(HeaptraceContext *ctx, uint64_t ptr);
 Chunk *find_chunk(HeaptraceContext *ctx, uint64_t ptr); // TODO: deprecate this function
 uint64_t count_unfreed_bytes(Chunk *chunk);
+uint64_t chunk_bytes(Chunk *chunk);
+void queue_chunk_size(HeaptraceContext *ctx, Chunk *chunk);
+void sync_chunk_size(HeaptraceContext *ctx, Chunk *chunk);
+void flush_chunk_sizes(HeaptraceContext *ctx);
 
 #endif
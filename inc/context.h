@@ -10,6 +10,14 @@
 #include "breakpoint.h"
 #include "user-breakpoint.h"
 #include "logging.h"
+#include "callsite.h"
+#include "addrspace.h"
+#include "uaf.h"
+#include "redzone.h"
+#include "leak.h"
+#include "heapcheck.h"
+#include "bins.h"
+#include "elf-image.h"
 
 typedef struct HeaptraceFile HeaptraceFile;
 
@@ -17,6 +25,8 @@ typedef struct HeaptraceFile HeaptraceFile;
 
 typedef struct Chunk Chunk;
 typedef struct SymbolEntry SymbolEntry;
+typedef struct SymbolRange SymbolRange;
+typedef struct SourceCacheEntry SourceCacheEntry;
 
 typedef enum ProcessState {
     PROCESS_STATE_RUNNING,
@@ -33,6 +43,8 @@ typedef struct HeaptraceContext {
     // pre-analysis settings
     HeaptraceFile *target;
     HeaptraceFile *libc;
+    HeaptraceFile *libstdcxx; // only analyzed if the tracee maps libstdc++
+    HeaptraceFile *allocator; // the library of a non-glibc allocator profile, see allocator.h
 
     Breakpoint **pre_analysis_bps;
     Breakpoint *bp_entry;
@@ -54,6 +66,11 @@ typedef struct HeaptraceContext {
 
     size_t h_size;
     uint64_t h_ptr;
+    uint64_t h_alignment; // memalign family and aligned operator new only
+    int h_api; // operator new only, ALLOC_API_*
+    uint64_t h_redzone; // --redzone: canary size for the chunk being allocated
+    uint64_t h_new_args[3]; // passed instead of argument i for each bit i in h_set_args
+    int h_set_args; // set by pre handlers, see _check_breakpoints
     uint64_t h_oid;
     Chunk *h_orig_chunk;
 
@@ -62,12 +79,17 @@ typedef struct HeaptraceContext {
     uint64_t free_count;
     uint64_t realloc_count;
     uint64_t reallocarray_count;
+    uint64_t memalign_count; // posix_memalign, aligned_alloc, memalign, valloc and pvalloc
+    uint64_t malloc_usable_size_count;
+    uint64_t new_count; // all operator new and new[] variants
+    uint64_t delete_count; // all operator delete and delete[] variants
+    AddrSpaceStats addrspace; // --trace-mmap
 
     // mid-analysis settings
     uint64_t target_at_entry; // auxiliary vector AT_ENTRY
 
     // post-analysis settings
-    ProcMapsEntry *pme_head;
+    ProcMaps *proc_maps;
     char *libc_version;
 
     // chunk storage globals
@@ -75,10 +97,29 @@ typedef struct HeaptraceContext {
     void *chunk_arr;
     size_t chunk_arr_i;
 
+    // --callsites hash table (open addressing, see callsite.c)
+    CallSite *callsites;
+    size_t callsites_cap;
+    size_t callsites_count;
+
+    // --real-sizes chunks whose headers are not read yet, see flush_chunk_sizes
+    Chunk **size_batch;
+    size_t size_batch_sz;
+
+    uint64_t uaf_modified_count; // --check-uaf
+    uint64_t overflow_count; // --redzone
+    LeakStats leaks; // --leak-check
+    HeapCheck heapcheck; // --check-heap
+    BinModel bins; // --bins
+
     // breakpoints storage globals
     Breakpoint *breakpoints[BREAKPOINTS_COUNT];
+    int breakpoints_sz; // slots in use are all below this, see install_breakpoint
 
     HandlerLogMessage hlm;
+
+    // caches the "called by" descriptions, see get_source_function
+    SourceCacheEntry *source_cache;
 } HeaptraceContext;
 
 
@@ -87,12 +128,20 @@ typedef struct HeaptraceFile {
     char *path;
     uint is_dynamic;
     uint is_stripped;
+    uint from_cache; // se_head came from the analysis cache, see cache.c
+    uint analyzed; // se_head came from lookup_symbols/lookup_libc_symbols
     SymbolEntry *se_head;
-    SymbolEntry *all_static_se_head; // all static symbols
+    SymbolEntry *static_ses; // all static symbols, names point into `elf`
+    size_t static_ses_sz;
+    SymbolRange *sym_index; // static_ses sorted by address
+    size_t sym_index_sz;
+    ElfImage *elf; // shared mapping of `path`, see get_file_image
     ProcMapsEntry *pme;
 } HeaptraceFile;
 
+HeaptraceFile *alloc_file(HeaptraceContext *ctx);
 void *free_ctx(HeaptraceContext *ctx);
+ElfImage *get_file_image(HeaptraceFile *hf);
 HeaptraceContext *alloc_ctx();
 
 #endif
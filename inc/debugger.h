@@ -27,6 +27,7 @@ extern int OPT_FOLLOW_FORK;
 void _check_breakpoints(HeaptraceContext *ctx);
 
 static uint calculate_bp_addrs(HeaptraceContext *ctx, Breakpoint **bps);
-uint evaluate_funcid(HeaptraceFile *hf);
+char *get_libc_version(ElfImage *img);
+uint evaluate_funcid(HeaptraceFile *hf, HeaptraceFile *provider);
 void end_debugger(HeaptraceContext *ctx, int should_detach);
 void start_debugger(HeaptraceContext *ctx);
@@ -0,0 +1,42 @@
+#ifndef ELF_IMAGE_H
+#define ELF_IMAGE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <elf.h>
+#include <sys/types.h>
+
+/*
+ * A read-only view of a file, mapped once and shared by every analysis 
+ * phase (symbol lookup, funcid, glibc version detection, the cache key). 
+ * If the file is an ELF64 the header tables are validated and exposed; 
+ * otherwise ehdr is 0 and only the raw bytes are available.
+ */
+typedef struct ElfImage {
+    char *path;
+    uint8_t *bytes;
+    size_t size;
+
+    // identity of the mapped file, for the analysis cache
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+
+    Elf64_Ehdr *ehdr;
+    Elf64_Phdr *phdrs; // 0 if missing or out of bounds
+    uint16_t phnum;
+    Elf64_Shdr *shdrs; // 0 if missing or out of bounds (e.g. sstrip'd)
+    uint16_t shnum;
+    const char *shstrtab;
+    size_t shstrtab_sz;
+} ElfImage;
+
+ElfImage *elf_image_open(const char *path);
+void elf_image_close(ElfImage *img);
+
+int elf_image_range_ok(ElfImage *img, uint64_t offset, uint64_t len);
+Elf64_Shdr *elf_image_section(ElfImage *img, const char *name);
+Elf64_Phdr *elf_image_segment(ElfImage *img, uint32_t type);
+void *elf_image_section_data(ElfImage *img, Elf64_Shdr *shdr);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef FUNCID_DB_H
+#define FUNCID_DB_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define FUNCSIG_SZ 33
+
+/*
+ * funcid signature database. The on-disk layout is the in-memory index 
+ * (FuncidPattern array plus the bucket tables), so a database is used 
+ * straight out of mmap() with no parsing. See funcid-db.c for the format.
+ */
+
+#define FUNCID_DB_MAGIC "HTFIDB\0\0"
+#define FUNCID_DB_VERSION 1
+
+// one signature, prepared for matching: data is pre-masked so a byte 
+// matches when (byte & mask) == data
+typedef struct FuncidPattern {
+    uint8_t data[FUNCSIG_SZ];
+    uint8_t mask[FUNCSIG_SZ];
+    uint8_t _pad[2];
+    uint16_t func; // index into FuncidIndex.func_names
+    uint16_t rank; // position in the function's signature list; lower wins
+    uint32_t source; // index into FuncidIndex.sources
+} FuncidPattern;
+
+/*
+ * All signatures, bucketed by their first two bytes (CSR layout: bucket k 
+ * is entries [bucket_start[k], bucket_start[k + 1])). Signatures whose 
+ * first two bytes aren't both defined go in the `anywhere` list, which is 
+ * tried at every offset.
+ */
+typedef struct FuncidIndex {
+    FuncidPattern *patterns;
+    size_t patterns_sz;
+    uint32_t *bucket_start; // 0x10000 + 1 entries
+    uint32_t *bucket_entries;
+    uint32_t *anywhere;
+    size_t anywhere_sz;
+
+    char **func_names;
+    size_t funcs_sz;
+    char **sources; // where each signature came from, e.g. a libc file name
+    size_t sources_sz;
+
+    void *map; // set if the index points into an mmap'd database
+    size_t map_sz;
+} FuncidIndex;
+
+extern char *OPT_FUNCID_DB;
+extern char *OPT_FUNCID_BUILD_DB;
+
+void funcid_index_build_buckets(FuncidIndex *index);
+void free_funcid_index(FuncidIndex *index);
+
+int funcid_db_load(FuncidIndex *index, const char *path);
+char *funcid_db_default_path();
+uint64_t funcid_db_stamp();
+// returns a process exit status
+int funcid_build_db(const char *out_path, char **elf_paths, int elf_paths_sz);
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef FUNCSIG_H
 #define FUNCSIG_H
 
-#define FUNCSIG_SZ 33
+#include "funcid-db.h"
+#include "elf-image.h"
+
+#define FUNCID_FUNCS 11 // functions funcid has built-in signatures for
 
 typedef struct funcsig {
     uint8_t data[FUNCSIG_SZ];
@@ -13,7 +16,9 @@ typedef struct FunctionSignature {
     uint64_t offset;
 } FunctionSignature;
 
-FunctionSignature *find_function_signatures(FILE *f);
+int find_function_signatures(ElfImage *img, FunctionSignature *sigs, int sigs_sz);
+int is_funcid_function(const char *name);
+void build_builtin_funcid_index(FuncidIndex *index);
 
 static const funcsig FUNCSIGS_MALLOC[] = {
     
@@ -8395,4 +8400,258 @@ static const funcsig FUNCSIGS_REALLOCARRAY[] = {
 
 static const uint FUNCSIGS_REALLOCARRAY_COUNT = 84;
 
+static const funcsig FUNCSIGS_POSIX_MEMALIGN[] = {
+
+    // libc6_2.36-9+deb12u13_amd64.so
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x140211], 0x0,
+            0x41, 0x54, // push r12,
+            0x49, 0x89, 0xd4, // mov r12, rdx,
+            0x55, // push rbp,
+            0x48, 0x89, 0xfd, // mov rbp, rdi,
+            0x53, // push rbx,
+            0x48, 0x89, 0xf3, // mov rbx, rsi,
+            0x74, 0x00, // je 0x9a2e0,
+            0x48, 0x89, 0xda, // mov rdx, rbx,
+            0x48, 0xc1, 0xea, 0x03, // shr rdx, 0x3,
+            0x48, 0x8d, 0x42, 0xff, // lea rax, [rdx-0x1]
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00, 0x00,
+            0x00, 0x00, 0x00,
+            0x00,
+            0x00, 0x00, 0x00,
+            0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00 // len=33
+        }
+    },
+
+};
+
+
+static const uint FUNCSIGS_POSIX_MEMALIGN_COUNT = 1;
+
+static const funcsig FUNCSIGS_ALIGNED_ALLOC[] = {
+
+    // libc6_2.36-9+deb12u13_amd64.so
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x140e81], 0x0,
+            0x74, 0x00, // je 0x99610,
+            0xe9, 0x00, 0x00, 0x00, 0x00, // jmp 0x98c40,
+            0x66, 0x90, // xchg ax, ax,
+            0x48, 0x83, 0xec, 0x18, // sub rsp, 0x18,
+            0x48, 0x89, 0x74, 0x24, 0x08, // mov QWORD PTR [rsp+0x8], rsi,
+            0x48, 0x89, 0x3c, 0x24, // mov QWORD PTR [rsp], rdi,
+            0xe8, 0x00, 0x00, 0x00, // call 0x952f0
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00, 0xff,
+            0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0xff, 0xff, 0xff // len=33
+        }
+    },
+
+};
+
+
+static const uint FUNCSIGS_ALIGNED_ALLOC_COUNT = 1;
+
+static const funcsig FUNCSIGS_MEMALIGN[] = {
+
+    // libc6_2.36-9+deb12u13_amd64.so
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x140e81], 0x0,
+            0x74, 0x00, // je 0x99610,
+            0xe9, 0x00, 0x00, 0x00, 0x00, // jmp 0x98c40,
+            0x66, 0x90, // xchg ax, ax,
+            0x48, 0x83, 0xec, 0x18, // sub rsp, 0x18,
+            0x48, 0x89, 0x74, 0x24, 0x08, // mov QWORD PTR [rsp+0x8], rsi,
+            0x48, 0x89, 0x3c, 0x24, // mov QWORD PTR [rsp], rdi,
+            0xe8, 0x00, 0x00, 0x00, // call 0x952f0
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00, 0xff,
+            0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0xff, 0xff, 0xff // len=33
+        }
+    },
+
+};
+
+
+static const uint FUNCSIGS_MEMALIGN_COUNT = 1;
+
+static const funcsig FUNCSIGS_VALLOC[] = {
+
+    // libc6_2.36-9+deb12u13_amd64.so
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x140e41], 0x0,
+            0x53, // push rbx,
+            0x48, 0x89, 0xfb, // mov rbx, rdi,
+            0x74, 0x00, // je 0x99668,
+            0x48, 0x8b, 0x05, 0x00, 0x00, 0x00, 0x00, // mov rax, QWORD PTR [rip+0x139844],
+            0x48, 0x89, 0xde, // mov rsi, rbx,
+            0x5b, // pop rbx,
+            0x48, 0x8b, 0x78, 0x18, // mov rdi, QWORD PTR [rax+0x18],
+            0xe9, 0x00, 0x00, 0x00, 0x00, // jmp 0x98c40
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00, 0x00,
+            0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0xff, 0xff, 0xff, 0xff // len=33
+        }
+    },
+
+    // test-static3
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x8e149], 0x0,
+            0x53, // push rbx,
+            0x48, 0x89, 0xfb, // mov rbx, rdi,
+            0x74, 0x00, // je 0x41d0b0,
+            0x48, 0x8b, 0x3d, 0x00, 0x00, 0x00, 0x00, // mov rdi, QWORD PTR [rip+0x88094],
+            0x48, 0x89, 0xde, // mov rsi, rbx,
+            0x5b, // pop rbx,
+            0xe9, 0x00, 0x00, 0x00, 0x00, // jmp 0x41c6e0,
+            0x0f, 0x1f, 0x00, // nop DWORD PTR [rax],
+            0xe8, // call 0x418d30
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00, 0x00,
+            0x00,
+            0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00, 0x00,
+            0x00 // len=33
+        }
+    },
+
+};
+
+
+static const uint FUNCSIGS_VALLOC_COUNT = 2;
+
+static const funcsig FUNCSIGS_PVALLOC[] = {
+
+    // libc6_2.36-9+deb12u13_amd64.so
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x140e11], 0x0,
+            0x53, // push rbx,
+            0x48, 0x89, 0xfb, // mov rbx, rdi,
+            0x74, 0x00, // je 0x996a8,
+            0x48, 0x8b, 0x05, 0x00, 0x00, 0x00, 0x00, // mov rax, QWORD PTR [rip+0x139814],
+            0x48, 0x8b, 0x78, 0x18, // mov rdi, QWORD PTR [rax+0x18],
+            0x48, 0x8d, 0x47, 0xff, // lea rax, [rdi-0x1],
+            0x48, 0x01, 0xd8, // add rax, rbx,
+            0x72, 0x00, // jb 0x996af
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff // len=33
+        }
+    },
+
+    // test-static3
+    {
+        .data = {
+            0x80, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, // cmp BYTE PTR [rip+0x8e109], 0x0,
+            0x53, // push rbx,
+            0x48, 0x89, 0xfb, // mov rbx, rdi,
+            0x74, 0x00, // je 0x41d100,
+            0x48, 0x8b, 0x3d, 0x00, 0x00, 0x00, 0x00, // mov rdi, QWORD PTR [rip+0x88054],
+            0x48, 0x8d, 0x47, 0xff, // lea rax, [rdi-0x1],
+            0x48, 0x01, 0xd8, // add rax, rbx,
+            0x72, 0x00, // jb 0x41d107,
+            0xbe, 0x01, 0x00, 0x00, // mov esi, 0x1
+        }, 
+        .undef = {
+            0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x00,
+            0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0x00 // len=33
+        }
+    },
+
+};
+
+
+static const uint FUNCSIGS_PVALLOC_COUNT = 2;
+
+static const funcsig FUNCSIGS_MALLOC_USABLE_SIZE[] = {
+
+    // libc6_2.36-9+deb12u13_amd64.so
+    {
+        .data = {
+            0x48, 0x85, 0xff, // test rdi, rdi,
+            0x74, 0x00, // je 0x99d60,
+            0x48, 0x8b, 0x4f, 0xf8, // mov rcx, QWORD PTR [rdi-0x8],
+            0x48, 0x89, 0xca, // mov rdx, rcx,
+            0x48, 0x83, 0xe2, 0xf8, // and rdx, 0xfffffffffffffff8,
+            0x83, 0xe1, 0x02, // and ecx, 0x2,
+            0x48, 0x8d, 0x42, 0xf0, // lea rax, [rdx-0x10],
+            0x75, 0x00, // jne 0x99d62,
+            0x48, 0x8b, 0x44, 0x07, 0x08, // mov rax, QWORD PTR [rdi+rax*1+0x8],
+            0x48, 0x83, 0xea, // sub rdx, 0x8
+        }, 
+        .undef = {
+            0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            0x00, 0xff,
+            0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00 // len=33
+        }
+    },
+
+};
+
+
+static const uint FUNCSIGS_MALLOC_USABLE_SIZE_COUNT = 1;
+
 #endif
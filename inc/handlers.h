@@ -25,4 +25,24 @@ void pre_realloc(HeaptraceContext *ctx, uint64_t iptr, uint64_t isize);
 void post_realloc(HeaptraceContext *ctx, uint64_t new_ptr);
 void pre_reallocarray(HeaptraceContext *ctx, uint64_t iptr, uint64_t nmemb, uint64_t isize);
 void post_reallocarray(HeaptraceContext *ctx, uint64_t new_ptr);
-
+void pre_posix_memalign(HeaptraceContext *ctx, uint64_t memptr, uint64_t alignment, uint64_t isize);
+void post_posix_memalign(HeaptraceContext *ctx, uint64_t retval);
+void pre_aligned_alloc(HeaptraceContext *ctx, uint64_t alignment, uint64_t isize);
+void post_aligned_alloc(HeaptraceContext *ctx, uint64_t ptr);
+void pre_memalign(HeaptraceContext *ctx, uint64_t alignment, uint64_t isize);
+void post_memalign(HeaptraceContext *ctx, uint64_t ptr);
+void pre_valloc(HeaptraceContext *ctx, uint64_t isize);
+void post_valloc(HeaptraceContext *ctx, uint64_t ptr);
+void pre_pvalloc(HeaptraceContext *ctx, uint64_t isize);
+void post_pvalloc(HeaptraceContext *ctx, uint64_t ptr);
+void pre_malloc_usable_size(HeaptraceContext *ctx, uint64_t iptr);
+void post_malloc_usable_size(HeaptraceContext *ctx, uint64_t retval);
+void pre_operator_new(HeaptraceContext *ctx, uint64_t isize);
+void pre_operator_new_aligned(HeaptraceContext *ctx, uint64_t isize, uint64_t alignment);
+void pre_operator_new_array(HeaptraceContext *ctx, uint64_t isize);
+void pre_operator_new_array_aligned(HeaptraceContext *ctx, uint64_t isize, uint64_t alignment);
+void post_operator_new(HeaptraceContext *ctx, uint64_t ptr);
+void pre_operator_delete(HeaptraceContext *ctx, uint64_t iptr);
+void pre_operator_delete_sized(HeaptraceContext *ctx, uint64_t iptr, uint64_t isize);
+void pre_operator_delete_array(HeaptraceContext *ctx, uint64_t iptr);
+void pre_operator_delete_array_sized(HeaptraceContext *ctx, uint64_t iptr, uint64_t isize);
@@ -20,6 +20,12 @@
 #define STATE_FREE 2
 #define STATE_REALLOC 3
 
+// the family of functions that allocated a chunk, which is the only one that 
+// may release it again (see Chunk.api)
+#define ALLOC_API_MALLOC 0 // malloc, calloc, realloc, memalign etc; free
+#define ALLOC_API_NEW 1 // operator new; operator delete
+#define ALLOC_API_NEW_ARRAY 2 // operator new[]; operator delete[]
+
 #define SIZE_SZ 8 // XXX
 #define MALLOC_ALIGN_MASK (2*SIZE_SZ-1)
 #define MIN_CHUNK_SIZE (SIZE_SZ*4) // this is not always true
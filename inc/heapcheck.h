@@ -0,0 +1,63 @@
+#ifndef HEAPCHECK_H
+#define HEAPCHECK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+
+#define HEAPCHECK_DEFAULT_OPS 1
+#define HEAPCHECK_READ_IOVS 1024 // dirty page runs per process_vm_readv (IOV_MAX)
+
+// state of the --check-heap walker, see heapcheck.c
+typedef struct HeapCheck {
+    // a copy of the main heap, updated from the pages dirtied since the last 
+    // walk. scratch is as big, dirty and pagemap have an entry per page.
+    uint64_t base;
+    size_t size;
+    size_t cap;
+    uint8_t *mirror;
+    uint8_t *scratch;
+    uint8_t *dirty;
+    uint64_t *pagemap;
+    int pagemap_fd; // 0 until opened, -1 if that failed
+    int clear_refs_fd;
+
+    // offsets of the chunks found by the last walk, and the ones being found
+    uint64_t *bounds;
+    uint64_t *next_bounds;
+    size_t bounds_sz;
+    size_t bounds_cap;
+
+    // live chunks in the heap, by offset, rebuilt by each walk
+    uint64_t *live;
+    size_t live_sz;
+    size_t live_cap;
+
+    uint64_t arena_top; // address of main_arena.top, 0 if not found yet
+    uint64_t tcache; // offset of tcache_perthread_struct, 0 if there is none
+    size_t tcache_counts_sz; // sizeof(counts[0]): 1 before glibc 2.30, 2 after
+
+    uint64_t ops; // operations since the last walk
+    struct timespec last_walk;
+    uint64_t walks;
+    uint64_t pages_read;
+
+    uint64_t good_oid; // the last operation after which the heap was consistent
+    uint64_t bad_oid; // the first one after which it was not, 0 if it still is
+    char reason[256];
+} HeapCheck;
+
+extern uint64_t OPT_CHECK_HEAP; // walk every n operations, 0 = disabled
+extern uint64_t OPT_CHECK_HEAP_MS; // or every n milliseconds
+extern int OPT_SOFT_DIRTY; // read only the pages dirtied since the last walk
+
+int parse_check_heap(const char *arg);
+void heapcheck_after_op(HeaptraceContext *ctx);
+void heapcheck_at_exit(HeaptraceContext *ctx);
+void show_heapcheck_stats(HeaptraceContext *ctx);
+void show_heapcheck_stats_jsonl(HeaptraceContext *ctx);
+void free_heapcheck(HeaptraceContext *ctx);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * A tiny allocation-free JSON Lines serializer. Every record is built into a
+ * static buffer and written with a single fwrite() by jsonl_end(). Nesting is
+ * tracked only to place commas, so callers are responsible for emitting keys
+ * inside objects and bare values inside arrays.
+ */
+
+#define JSONL_BUF_SIZE 32768
+#define JSONL_MAX_DEPTH 8
+
+void jsonl_begin();
+void jsonl_end(FILE *f);
+
+void jsonl_key(const char *key);
+void jsonl_begin_object();
+void jsonl_end_object();
+void jsonl_begin_array();
+void jsonl_end_array();
+
+void jsonl_str(const char *s);
+void jsonl_strn(const char *s, size_t n);
+void jsonl_u64(uint64_t val);
+void jsonl_hex(uint64_t val);
+void jsonl_null();
+void jsonl_bool(int val);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef LEAK_H
+#define LEAK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+
+#define LEAK_READ_BLOCK (8 << 20) // bytes per process_vm_readv
+#define LEAK_READ_IOVS 1024 // chunks per process_vm_readv (IOV_MAX)
+
+// totals of the reachability scan, see leak_scan
+typedef struct LeakStats {
+    int scanned;
+    uint64_t direct_count;
+    uint64_t direct_bytes;
+    uint64_t indirect_count; // only referenced by other leaked chunks
+    uint64_t indirect_bytes;
+    uint64_t reachable_count;
+    uint64_t reachable_bytes;
+
+    struct LeakSite *sites; // direct leaks grouped by caller, largest first
+    size_t sites_sz;
+} LeakStats;
+
+// the direct leaks allocated from one caller
+typedef struct LeakSite {
+    uint64_t addr;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t oids[4]; // the first few leaked chunks, by allocation oid
+} LeakSite;
+
+extern int OPT_LEAK_CHECK;
+
+void leak_scan(HeaptraceContext *ctx);
+void show_leak_stats(HeaptraceContext *ctx);
+void show_leak_stats_jsonl(HeaptraceContext *ctx);
+void free_leak_stats(HeaptraceContext *ctx);
+
+#endif
@@ -14,6 +14,10 @@
 extern int OPT_DEBUG; // print lots of debug info?
 extern int OPT_VERBOSE;
 extern int OPT_NO_COLOR;
+extern int OPT_FORMAT;
+
+#define OUTPUT_FORMAT_TEXT 0
+#define OUTPUT_FORMAT_JSONL 1
 
 #define COLOR_LOG "\e[0;36m"
 #define COLOR_LOG_BOLD "\e[1;36m"
@@ -29,7 +33,8 @@ extern int OPT_NO_COLOR;
 #define COLOR_RESET_ITALIC "\e[3m"
 #define COLOR_RESET_BOLD "\e[1m"
 
-extern FILE *output_fd;
+extern __thread FILE *output_fd; // per thread, so the startup workers can hold back what they print
+extern FILE *event_fd; // --format=jsonl records
 
 #define color_log(...) { if (!OPT_NO_COLOR) { fprintf(output_fd, ##__VA_ARGS__); } }
 #define color_verbose(...) { if (!OPT_NO_COLOR && OPT_VERBOSE) { fprintf(output_fd, ##__VA_ARGS__); } }
@@ -63,8 +68,8 @@ extern FILE *output_fd;
 #define verbose_heap(fmt, ...) { if (OPT_VERBOSE) { color_log(COLOR_LOG); log("\t^-- "); color_log(COLOR_LOG_ITALIC); fprintf(output_fd, (fmt "\n"), ##__VA_ARGS__);  color_log(COLOR_RESET); } }
 #define fatal_heap(msg, ...) { color_log(COLOR_ERROR_BOLD); log("\nheaptrace error: "); color_log(COLOR_ERROR); log(msg "\n", ##__VA_ARGS__); color_log(COLOR_RESET); }
 //#define warn2(msg) log("%sheaptrace warning: %s%s%s\n", COLOR_ERROR, COLOR_ERROR, (msg), COLOR_RESET) 
-#define warn_heap(msg, ...) { color_log(COLOR_WARN); ctx->hlm.cur_width = 0; log("\n    |-- warning: "); color_log(COLOR_WARN_BOLD); log(msg "\n", ##__VA_ARGS__); color_log(COLOR_RESET); }
-#define warn_heap2(msg, ...) { color_log(COLOR_WARN); log("    |   * " msg "\n",  ##__VA_ARGS__); color_log(COLOR_RESET); }
+#define warn_heap(msg, ...) { if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) { hlm_add_warning(ctx, 0, msg, ##__VA_ARGS__); } else { color_log(COLOR_WARN); ctx->hlm.cur_width = 0; log("\n    |-- warning: "); color_log(COLOR_WARN_BOLD); log(msg "\n", ##__VA_ARGS__); color_log(COLOR_RESET); } }
+#define warn_heap2(msg, ...) { if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) { hlm_add_warning(ctx, 1, msg, ##__VA_ARGS__); } else { color_log(COLOR_WARN); log("    |   * " msg "\n",  ##__VA_ARGS__); color_log(COLOR_RESET); } }
 
 void describe_symbol(void *ptr);
 
@@ -92,15 +97,18 @@ typedef struct HandlerLogMessage {
 
     char *func_name;
     char *warnings; // malloced and zero'd every operation
+    size_t warnings_sz;
 
     uint arg_options[3];
     uint64_t arg_ptr[3];
+    uint64_t arg_oid[3]; // --format=jsonl only: oid of the chunk an HLM_OPTION_SYMBOL arg pointed to
 
     uint ret_options;
     uint64_t ret_ptr;
 
     // msgs
     HandlerLogMessageNote *notes_head;
+    char bin[64]; // --bins: where the chunk went or came from, also a note
 
     // debugger variables
 
@@ -110,6 +118,8 @@ typedef struct HandlerLogMessage {
 void reset_handler_log_message(HeaptraceContext *ctx);
 void print_handler_log_message_1(HeaptraceContext *ctx);
 void print_handler_log_message_2(HeaptraceContext *ctx);
+void print_handler_log_message_pending(HeaptraceContext *ctx);
+void hlm_add_warning(HeaptraceContext *ctx, int is_detail, const char *fmt, ...);
 
 HandlerLogMessageNote *insert_note(HeaptraceContext *ctx);
 void concat_note(HandlerLogMessageNote *note, const char *fmt, ...);
@@ -17,14 +17,50 @@ typedef struct ProcMapsEntry {
     uint64_t base;
     uint64_t end;
 
-    struct ProcMapsEntry *_next;
+    struct ProcMapsEntry *_next; // only used for retired entries
 } ProcMapsEntry;
 
+// one writable line of /proc/pid/maps, see ProcMaps.writable
+typedef struct ProcMapsRange {
+    ProcELFType pet;
+    uint64_t base;
+    uint64_t end;
+} ProcMapsRange;
+
+// an index of /proc/pid/maps. Consecutive lines with the same name are merged 
+// into one entry, so entries never overlap and are kept sorted by base.
+typedef struct ProcMaps {
+    int pid;
+    char *exe_path;
+    ProcMapsEntry **entries;
+    size_t entries_sz;
+    size_t entries_cap;
+    ProcMapsEntry *last_hit;
+    int maybe_stale; // the tracee ran since the last parse, see pme_invalidate
+    int changed; // the tracee (re)mapped memory, see pme_mark_changed
+
+    // entries that disappeared from the maps, but that HeaptraceFile.pme or 
+    // HeaptraceFile.path may still point to
+    ProcMapsEntry *retired;
+
+    // every writable line, unmerged and in order (data, bss, stacks, heaps)
+    ProcMapsRange *writable;
+    size_t writable_sz;
+    size_t writable_cap;
+
+    char *buf; // raw maps text, reused between refreshes
+    size_t buf_cap;
+} ProcMaps;
+
 char *get_path_by_pid(int pid);
-ProcMapsEntry *build_pme_list(int pid);
-ProcMapsEntry *pme_walk(ProcMapsEntry *pme_head, ProcELFType pet);
-ProcMapsEntry *pme_find_addr(ProcMapsEntry *pme_head, uint64_t addr);
-void free_pme_list(ProcMapsEntry *first_pme);
+ProcMaps *build_proc_maps(int pid);
+int refresh_proc_maps(ProcMaps *maps);
+void pme_invalidate(ProcMaps *maps);
+void pme_mark_changed(ProcMaps *maps);
+ProcMapsEntry *pme_walk(ProcMaps *maps, ProcELFType pet);
+ProcMapsEntry *pme_find_name(ProcMaps *maps, const char *needle);
+ProcMapsEntry *pme_find_addr(ProcMaps *maps, uint64_t addr);
+void free_proc_maps(ProcMaps *maps);
 
 uint64_t get_auxv_entry(int pid);
 
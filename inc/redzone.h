@@ -0,0 +1,23 @@
+#ifndef REDZONE_H
+#define REDZONE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+typedef struct Chunk Chunk;
+
+#define REDZONE_DEFAULT_SZ 16
+#define REDZONE_MAX_SZ 4096 // the canary is built and read in a stack buffer this big
+#define REDZONE_BATCH_SZ 64 // live chunks checked per process_vm_readv at exit
+
+extern uint64_t OPT_REDZONE; // bytes added after each chunk, 0 = disabled
+
+void redzone_grow(HeaptraceContext *ctx, int size_arg, uint64_t size);
+void redzone_arm(HeaptraceContext *ctx, Chunk *chunk);
+void redzone_check(HeaptraceContext *ctx, Chunk *chunk);
+void redzone_check_all(HeaptraceContext *ctx);
+void show_redzone_stats(HeaptraceContext *ctx);
+void show_redzone_stats_jsonl(HeaptraceContext *ctx);
+
+#endif
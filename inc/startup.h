@@ -0,0 +1,38 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <pthread.h>
+
+#include "context.h"
+
+/*
+ * Startup analysis workers. While the tracee is being started (or attached 
+ * to), the target ELF and the libc it is expected to load are analyzed on 
+ * their own threads. The main thread adopts a worker's result only if the 
+ * worker analyzed the file that actually ended up mapped, otherwise it 
+ * falls back to analyzing the real file itself. Workers never print or 
+ * exit: their output is held back until the main thread adopts the result, 
+ * and a failed assertion only fails the worker.
+ */
+typedef struct StartupWorker {
+    pthread_t thread;
+    int running;
+    int is_libc;
+    HeaptraceFile *hf;
+    char **names;
+    char *version; // libc only, malloc'd
+    char *log; // what the worker printed, shown only if its analysis is adopted
+    size_t log_sz;
+    int failed; // an assertion failed, so the analysis is unusable
+    double ms;
+} StartupWorker;
+
+char *resolve_target_path(const char *path);
+char *resolve_libc_path(const char *target_path);
+
+void start_startup_workers(HeaptraceContext *ctx, const char *target_path, const char *libc_path);
+int join_target_worker(HeaptraceContext *ctx);
+int join_libc_worker(HeaptraceContext *ctx, const char *libc_path);
+void cancel_startup_workers();
+
+#endif
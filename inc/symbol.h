@@ -34,16 +34,38 @@ typedef struct SymbolEntry {
     struct SymbolEntry *_next;
 } SymbolEntry;
 
+// sorted (by start) array built from static_ses for address lookups
+typedef struct SymbolRange {
+    uint64_t start;
+    uint64_t end;
+    uint64_t max_end; // largest `end` of this entry and all entries before it
+    SymbolEntry *se;
+} SymbolRange;
+
+#define SOURCE_CACHE_SZ 256 // must be a power of 2
+
+typedef struct SourceCacheEntry {
+    uint64_t addr;
+    int pet;
+    char *desc;
+} SourceCacheEntry;
+
 void lookup_symbols(HeaptraceFile *hf, char *names[]);
+void lookup_libc_symbols(HeaptraceFile *hf, char *names[]);
 SymbolEntry *any_se_type(SymbolEntry *se_head, int type);
 int all_se_type(SymbolEntry *se_head, int type);
 SymbolEntry *find_se_name(SymbolEntry *se_head, char *name);
 void free_se_list(SymbolEntry *se_head);
+void free_static_symbols(HeaptraceFile *hf);
+void build_symbol_index(HeaptraceFile *hf);
+void free_symbol_index(HeaptraceFile *hf);
+void free_source_cache(HeaptraceContext *ctx);
 
 SymbolEntry *find_symbol_by_address(HeaptraceFile *hf, uint64_t addr);
 HeaptraceFile *find_heaptrace_file_by_address(HeaptraceContext *ctx, uint64_t addr);
 char *find_symbol_name_by_address(HeaptraceContext *ctx, uint64_t addr);
 
-char *get_source_function(HeaptraceContext *ctx);
+const char *get_source_function(HeaptraceContext *ctx);
+const char *describe_address(HeaptraceContext *ctx, uint64_t addr);
 
 #endif
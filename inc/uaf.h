@@ -0,0 +1,27 @@
+#ifndef UAF_H
+#define UAF_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct HeaptraceContext HeaptraceContext;
+typedef struct Chunk Chunk;
+
+#define UAF_DEFAULT_CAP 256 // bytes hashed per freed chunk
+#define UAF_MAX_CAP 131072 // glibc's default mmap threshold; bigger chunks are unmapped when freed
+#define UAF_BATCH_SZ 64 // freed chunks checked per process_vm_readv at exit
+
+// Chunk.uaf_state
+#define UAF_NONE 0
+#define UAF_HASHED 1
+#define UAF_MODIFIED 2 // found modified by uaf_check_all
+
+extern uint64_t OPT_CHECK_UAF; // max bytes hashed per freed chunk, 0 = disabled
+
+void uaf_freed(HeaptraceContext *ctx, Chunk *chunk);
+void uaf_allocated(HeaptraceContext *ctx, Chunk *chunk, uint64_t ptr, uint64_t size, int verify);
+void uaf_check_all(HeaptraceContext *ctx);
+void show_uaf_stats(HeaptraceContext *ctx);
+void show_uaf_stats_jsonl(HeaptraceContext *ctx);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <time.h>
+#include <setjmp.h>
+
 #include "ctype.h"
 #include "logging.h"
 
@@ -10,9 +13,14 @@
 #define ABORT() abort()
 #endif
 
+// a thread that sets this is sent back to it by a failed ASSERT instead of 
+// aborting the process (see startup.c)
+extern __thread jmp_buf *assert_jmp;
+
 #define ASSERT_NICE(q, msg, ...) if (!(q)) { fatal_heap("assertion (%s) failed in %s:%d: " msg, #q, __FILE__, __LINE__, ##__VA_ARGS__); }
 #define ASSERT(q, msg, ...) if (!(q)) { \
         ASSERT_NICE(q, msg, ##__VA_ARGS__) \
+        if (assert_jmp) longjmp(*assert_jmp, 1); \
         ABORT();  \
     }
 
@@ -21,5 +29,6 @@
 uint is_uint(char *str);
 uint is_uint_hex(char *str);
 uint64_t str_to_uint64(char *buf);
+double ms_since(const struct timespec *start);
 
 #endif
@@ -0,0 +1,85 @@
+#include "addrspace.h"
+#include "context.h"
+#include "logging.h"
+#include "proc.h"
+#include "jsonl.h"
+
+int OPT_TRACE_MMAP = 0;
+
+/*
+ * These handlers are attached to libc's mmap/munmap/mremap/sbrk wrappers as
+ * nested breakpoints (see _check_breakpoints): they run even while the tracee
+ * is inside malloc, which is where almost all of these calls come from, and
+ * they never log a heap operation. They only run on entry, so the maps are
+ * marked as changed and re-read by the next lookup, after the call is done. 
+ * For the same reason the byte counts are the sizes that were asked for; a 
+ * call that fails is still counted.
+ */
+
+
+void pre_mmap(HeaptraceContext *ctx, uint64_t len) {
+    ctx->addrspace.mmap_count++;
+    ctx->addrspace.mmap_bytes += len;
+    pme_mark_changed(ctx->proc_maps);
+}
+
+
+void pre_munmap(HeaptraceContext *ctx, uint64_t len) {
+    ctx->addrspace.munmap_count++;
+    ctx->addrspace.munmap_bytes += len;
+    pme_mark_changed(ctx->proc_maps);
+}
+
+
+void pre_mremap(HeaptraceContext *ctx, uint64_t old_len, uint64_t new_len) {
+    ctx->addrspace.mremap_count++;
+    if (new_len > old_len) ctx->addrspace.mremap_grown_bytes += new_len - old_len;
+    else ctx->addrspace.mremap_shrunk_bytes += old_len - new_len;
+    pme_mark_changed(ctx->proc_maps);
+}
+
+
+void pre_sbrk(HeaptraceContext *ctx, uint64_t increment) {
+    if (!increment) return; // sbrk(0) only queries the break
+    ctx->addrspace.sbrk_count++;
+    if ((int64_t)increment > 0) ctx->addrspace.sbrk_grown_bytes += increment;
+    else ctx->addrspace.sbrk_trimmed_bytes += -increment;
+    pme_mark_changed(ctx->proc_maps);
+}
+
+
+void show_addrspace_stats(HeaptraceContext *ctx) {
+    if (!OPT_TRACE_MMAP) return;
+    AddrSpaceStats *st = &ctx->addrspace;
+    if (st->mmap_count) log("... mmaps count: " CNT " (" SZ " bytes)\n", st->mmap_count, SZ_ARG(st->mmap_bytes));
+    if (st->munmap_count) log("... munmaps count: " CNT " (" SZ " bytes)\n", st->munmap_count, SZ_ARG(st->munmap_bytes));
+    if (st->mremap_count) log("... mremaps count: " CNT " (+" SZ "/-" SZ " bytes)\n", st->mremap_count, SZ_ARG(st->mremap_grown_bytes), SZ_ARG(st->mremap_shrunk_bytes));
+    if (st->sbrk_count) log("... sbrks count: " CNT " (+" SZ "/-" SZ " bytes)\n", st->sbrk_count, SZ_ARG(st->sbrk_grown_bytes), SZ_ARG(st->sbrk_trimmed_bytes));
+}
+
+
+// adds the counters to the stats record that is being built
+void show_addrspace_stats_jsonl(HeaptraceContext *ctx) {
+    if (!OPT_TRACE_MMAP) return;
+    AddrSpaceStats *st = &ctx->addrspace;
+    jsonl_key("mmaps");
+    jsonl_u64(st->mmap_count);
+    jsonl_key("mmap_bytes");
+    jsonl_u64(st->mmap_bytes);
+    jsonl_key("munmaps");
+    jsonl_u64(st->munmap_count);
+    jsonl_key("munmap_bytes");
+    jsonl_u64(st->munmap_bytes);
+    jsonl_key("mremaps");
+    jsonl_u64(st->mremap_count);
+    jsonl_key("mremap_grown_bytes");
+    jsonl_u64(st->mremap_grown_bytes);
+    jsonl_key("mremap_shrunk_bytes");
+    jsonl_u64(st->mremap_shrunk_bytes);
+    jsonl_key("sbrks");
+    jsonl_u64(st->sbrk_count);
+    jsonl_key("sbrk_grown_bytes");
+    jsonl_u64(st->sbrk_grown_bytes);
+    jsonl_key("sbrk_trimmed_bytes");
+    jsonl_u64(st->sbrk_trimmed_bytes);
+}
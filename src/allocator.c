@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "allocator.h"
+#include "logging.h"
+
+char *OPT_ALLOCATOR = 0;
+char *OPT_ALLOCATOR_FILE = 0;
+AllocatorProfile *ALLOCATOR = 0;
+ChunkModel ALLOCATOR_CHUNKS = CHUNK_MODEL_GLIBC;
+
+static AllocatorProfile *profiles_head = 0;
+
+/*
+ * Profiles are written like this, in --allocator-file and below:
+ *
+ *   [name]
+ *   library = libjemalloc     (optional, see AllocatorProfile.library)
+ *   chunks = classes          (glibc, classes or exact)
+ *   outside_heap = yes        (don't warn about chunks outside of the heap)
+ *   pool_alloc = malloc(pool, size)
+ *   pool_free = free(pool, ptr)
+ *
+ * Every other key is an extra symbol to hook as one of heaptrace's heap
+ * functions. Its parameters name the register the function's arguments are
+ * in; the ones that aren't the function's (like `pool`) are skipped. Without
+ * parentheses, the arguments are in the usual order.
+ */
+static const char BUILTIN_PROFILES[] =
+    "[glibc]\n"
+    "\n"
+    "[jemalloc]\n"
+    "library = libjemalloc\n"
+    "chunks = classes\n"
+    "\n"
+    "[tcmalloc]\n"
+    "library = libtcmalloc\n"
+    "chunks = classes\n"
+    "\n"
+    // built with MI_OVERRIDE, mimalloc exports malloc etc as aliases of the
+    // mi_ functions. The argument order of mi_malloc_aligned is swapped.
+    "[mimalloc]\n"
+    "library = libmimalloc\n"
+    "chunks = classes\n"
+    "mi_malloc_aligned = memalign(size, alignment)\n";
+
+// the arguments of each function a profile can bind to, in order
+static const struct { const char *func; const char *args[3]; } FUNC_ARGS[] = {
+    {"malloc", {"size"}},
+    {"calloc", {"nmemb", "size"}},
+    {"free", {"ptr"}},
+    {"realloc", {"ptr", "size"}},
+    {"reallocarray", {"ptr", "nmemb", "size"}},
+    {"posix_memalign", {"memptr", "alignment", "size"}},
+    {"memalign", {"alignment", "size"}},
+    {"aligned_alloc", {"alignment", "size"}},
+    {"valloc", {"size"}},
+    {"pvalloc", {"size"}},
+    {"malloc_usable_size", {"ptr"}}
+};
+
+#define FUNC_ARGS_C (sizeof(FUNC_ARGS) / sizeof(FUNC_ARGS[0]))
+#define MAX_ARG_REGS 6 // rdi, rsi, rdx, rcx, r8, r9
+
+
+static int _find_func(const char *func) {
+    for (int i = 0; i < FUNC_ARGS_C; i++) {
+        if (!strcmp(FUNC_ARGS[i].func, func)) return i;
+    }
+    return -1;
+}
+
+
+// returns the number of arguments of one of the heap functions, or -1
+int allocator_func_nargs(const char *func) {
+    int i = _find_func(func);
+    if (i < 0) return -1;
+    int nargs = 0;
+    while (nargs < 3 && FUNC_ARGS[i].args[nargs]) nargs++;
+    return nargs;
+}
+
+
+static char *_strip(char *str) {
+    while (*str == ' ' || *str == '\t') str++;
+    char *end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) *--end = '\x00';
+    return str;
+}
+
+
+// parses `func(arg, arg, ...)` into entry. Returns an error message or 0.
+static const char *_parse_entry(AllocatorEntry *entry, char *symbol, char *value) {
+    char *params = strchr(value, '(');
+    if (params) {
+        char *close = strchr(params, ')');
+        if (!close || *_strip(close + 1)) return "expected `func(arg, ...)`";
+        *params++ = '\x00';
+        *close = '\x00';
+    }
+
+    int fi = _find_func(_strip(value));
+    if (fi < 0) return "unknown heap function";
+    int nargs = allocator_func_nargs(FUNC_ARGS[fi].func);
+
+    for (int i = 0; i < 3; i++) entry->args[i] = params ? -1 : i;
+    for (int reg = 0; params && *_strip(params); reg++) {
+        char *comma = strchr(params, ',');
+        if (comma) *comma = '\x00';
+        char *param = _strip(params);
+        if (reg >= MAX_ARG_REGS) return "only the first 6 arguments are passed in registers";
+        for (int i = 0; i < nargs; i++) {
+            if (!strcmp(FUNC_ARGS[fi].args[i], param)) entry->args[i] = reg;
+        }
+        if (!comma) break;
+        params = comma + 1;
+    }
+    for (int i = 0; i < nargs; i++) {
+        if (entry->args[i] < 0) return "missing one of the function's arguments";
+    }
+
+    entry->symbol = strdup(symbol);
+    entry->func = (char *)FUNC_ARGS[fi].func;
+    return 0;
+}
+
+
+// parses profiles out of `text`, adding them to profiles_head in order.
+// `source` is only used for error messages.
+static int _parse_profiles(char *text, const char *source) {
+    AllocatorProfile **tail = &profiles_head;
+    while (*tail) tail = &(*tail)->_next;
+
+    AllocatorProfile *cur = 0;
+    int lineno = 0;
+    char *next = text;
+    for (char *line; (line = strsep(&next, "\n")); ) { // unlike strtok, keeps empty lines for lineno
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\x00';
+        line = _strip(line);
+        if (!*line) continue;
+
+        const char *err = 0;
+        if (*line == '[') {
+            char *close = strchr(line, ']');
+            if (!close) {
+                err = "expected `[name]`";
+            } else {
+                *close = '\x00';
+                cur = (AllocatorProfile *)calloc(1, sizeof(AllocatorProfile));
+                cur->name = strdup(_strip(line + 1));
+                *tail = cur;
+                tail = &cur->_next;
+            }
+        } else {
+            char *eq = strchr(line, '=');
+            if (!cur) err = "expected a `[name]` line first";
+            else if (!eq) err = "expected `key = value`";
+            else {
+                *eq = '\x00';
+                char *key = _strip(line);
+                char *value = _strip(eq + 1);
+                if (!strcmp(key, "library")) {
+                    cur->library = strdup(value);
+                } else if (!strcmp(key, "chunks")) {
+                    if (!strcmp(value, "glibc")) cur->chunks = CHUNK_MODEL_GLIBC;
+                    else if (!strcmp(value, "classes")) cur->chunks = CHUNK_MODEL_CLASSES;
+                    else if (!strcmp(value, "exact")) cur->chunks = CHUNK_MODEL_EXACT;
+                    else err = "chunks must be `glibc`, `classes` or `exact`";
+                } else if (!strcmp(key, "outside_heap")) {
+                    cur->outside_heap = !strcmp(value, "yes") || !strcmp(value, "1");
+                } else {
+                    cur->entries = realloc(cur->entries, (cur->entries_sz + 1) * sizeof(AllocatorEntry));
+                    err = _parse_entry(&cur->entries[cur->entries_sz], key, value);
+                    if (!err) cur->entries_sz++;
+                }
+            }
+        }
+
+        if (err) {
+            fatal("%s:%d: %s\n", source, lineno, err);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static AllocatorProfile *_find_profile(const char *name) {
+    for (AllocatorProfile *p = profiles_head; p; p = p->_next) {
+        if (!strcmp(p->name, name)) return p;
+    }
+    return 0;
+}
+
+
+// --allocator=ALLOC:FREE[:REALLOC] hooks an in-house allocator that takes
+// the same arguments as malloc, free and realloc
+static AllocatorProfile *_custom_profile(char *spec) {
+    static const char *funcs[] = {"malloc", "free", "realloc"};
+    size_t len = 2 * strlen(spec) + 256; // once in the header, once split into the symbol lines
+    char *text = malloc(len);
+    int n = snprintf(text, len, "[%s]\nchunks = exact\noutside_heap = yes\n", spec);
+    char *saveptr = 0;
+    int i = 0;
+    for (char *sym = strtok_r(spec, ":", &saveptr); sym && n > 0 && n < len; sym = strtok_r(0, ":", &saveptr), i++) {
+        if (i >= 3) {
+            fatal("--allocator accepts up to 3 symbols (ALLOC:FREE:REALLOC).\n");
+            exit(1);
+        }
+        n += snprintf(text + n, len - n, "%s = %s\n", sym, funcs[i]);
+    }
+
+    AllocatorProfile **tail = &profiles_head;
+    while (*tail) tail = &(*tail)->_next;
+    if (!_parse_profiles(text, "--allocator")) exit(1);
+    free(text);
+    return *tail;
+}
+
+
+static char *_read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char *text = 0;
+    size_t sz = 0;
+    size_t cap = 0;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if (sz + n + 1 > cap) {
+            cap = (sz + n + 1) * 2;
+            text = realloc(text, cap);
+        }
+        memcpy(text + sz, buf, n);
+        sz += n;
+    }
+    fclose(f);
+    if (!text) text = calloc(1, 1);
+    text[sz] = '\x00';
+    return text;
+}
+
+
+// sets ALLOCATOR from --allocator and --allocator-file. Exits on errors.
+void select_allocator() {
+    char *builtin = strdup(BUILTIN_PROFILES);
+    ASSERT(_parse_profiles(builtin, "<built-in>"), "failed to parse the built-in allocator profiles. Please report this!");
+    free(builtin);
+    AllocatorProfile *first_file_profile = 0;
+
+    if (OPT_ALLOCATOR_FILE) {
+        char *text = _read_file(OPT_ALLOCATOR_FILE);
+        if (!text) {
+            fatal("failed to read allocator profiles from \"%s\": %s\n", OPT_ALLOCATOR_FILE, strerror(errno));
+            exit(1);
+        }
+
+        AllocatorProfile *last = profiles_head;
+        while (last->_next) last = last->_next;
+        if (!_parse_profiles(text, OPT_ALLOCATOR_FILE)) exit(1);
+        free(text);
+        first_file_profile = last->_next;
+    }
+
+    if (OPT_ALLOCATOR && strchr(OPT_ALLOCATOR, ':')) {
+        ALLOCATOR = _custom_profile(strdup(OPT_ALLOCATOR));
+    } else if (OPT_ALLOCATOR) {
+        ALLOCATOR = _find_profile(OPT_ALLOCATOR);
+        if (!ALLOCATOR) {
+            fatal("unknown allocator profile \"%s\".\n", OPT_ALLOCATOR);
+            log(COLOR_WARN "hint: the built-in profiles are glibc, jemalloc, tcmalloc and mimalloc. Use ALLOC:FREE for a custom allocator.\n" COLOR_RESET);
+            exit(1);
+        }
+    } else {
+        ALLOCATOR = first_file_profile ? first_file_profile : profiles_head;
+    }
+
+    ALLOCATOR_CHUNKS = ALLOCATOR->chunks;
+    debug("using allocator profile \"%s\" (library %s, %lu extra symbols)\n", ALLOCATOR->name, ALLOCATOR->library ? ALLOCATOR->library : "libc", ALLOCATOR->entries_sz);
+}
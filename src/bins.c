@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "bins.h"
+#include "context.h"
+#include "heap.h"
+#include "logging.h"
+#include "jsonl.h"
+
+int OPT_BINS = 0;
+
+/*
+ * --bins keeps a model of glibc's bins that is driven by the heap operations
+ * alone, without reading the tracee's memory: what free does with a chunk of
+ * a given size (tcache, fastbin, or merged with its free neighbours into the
+ * unsorted bin or the top chunk), and where malloc will take one from. Each
+ * operation is annotated with the bin its chunk went to or came from, and a
+ * malloc that returns something other than what the model predicted is
+ * flagged, which is what tcache and fastbin poisoning look like.
+ *
+ * Every list is a doubly linked list of nodes, and nodes are found by chunk
+ * address (and, for merging, by end address) in hash tables, so an operation
+ * costs O(1). Moving the unsorted bin into the small and large bins and
+ * malloc_consolidate touch each chunk once per free, which is O(1) amortized.
+ *
+ * The model follows malloc.c for the defaults (7 tcache entries per bin,
+ * global_max_fast 0x80, a 128KB mmap threshold that grows as mmapped chunks
+ * are freed) and only knows the main arena. Best fits from the small and
+ * large bins, and memalign's splitting, are not predicted, but the model
+ * still learns where those chunks came from.
+ */
+
+#define MINSIZE_CHUNK 0x20
+#define MAX_FAST_SIZE 0x80 // global_max_fast
+#define MIN_LARGE_SIZE 0x400
+#define TCACHE_MAX_SIZE (MINSIZE_CHUNK + (TCACHE_MAX_BINS - 1) * 0x10)
+#define FASTBIN_CONSOLIDATION_THRESHOLD 0x10000
+#define DEFAULT_MMAP_THRESHOLD 0x20000
+#define DEFAULT_MMAP_THRESHOLD_MAX 0x2000000
+#define PAGE_SZ 0x1000
+
+#define MAP_START 0
+#define MAP_END 1
+
+static const char *BIN_NAMES[] = {"tcache", "fastbin", "unsorted bin", "smallbin", "largebin", "mmap"};
+
+
+static uint64_t _node_key(BinNode *node, int which) {
+    return which == MAP_START ? node->chunk : node->chunk + node->size;
+}
+
+
+static size_t _hash(uint64_t key, size_t cap) {
+    return (size_t)((key >> 4) * 0x9e3779b97f4a7c15LLU >> 20) & (cap - 1);
+}
+
+
+static void _map_put(BinMap *map, BinNode *node, int which) {
+    if (map->sz >= map->cap) {
+        size_t cap = map->cap ? map->cap * 2 : 1024;
+        BinNode **buckets = (BinNode **)calloc(cap, sizeof(BinNode *));
+        ASSERT(buckets, "_map_put: calloc out of memory");
+        for (size_t i = 0; i < map->cap; i++) {
+            BinNode *cur = map->buckets[i];
+            while (cur) {
+                BinNode *next = cur->hnext[which];
+                size_t h = _hash(_node_key(cur, which), cap);
+                cur->hnext[which] = buckets[h];
+                buckets[h] = cur;
+                cur = next;
+            }
+        }
+        free(map->buckets);
+        map->buckets = buckets;
+        map->cap = cap;
+    }
+    size_t h = _hash(_node_key(node, which), map->cap);
+    node->hnext[which] = map->buckets[h];
+    map->buckets[h] = node;
+    map->sz++;
+}
+
+
+static BinNode *_map_get(BinMap *map, uint64_t key, int which) {
+    if (!map->cap) return 0;
+    for (BinNode *cur = map->buckets[_hash(key, map->cap)]; cur; cur = cur->hnext[which]) {
+        if (_node_key(cur, which) == key) return cur;
+    }
+    return 0;
+}
+
+
+static void _map_del(BinMap *map, BinNode *node, int which) {
+    BinNode **link = &map->buckets[_hash(_node_key(node, which), map->cap)];
+    while (*link && *link != node) link = &(*link)->hnext[which];
+    if (!*link) return;
+    *link = node->hnext[which];
+    map->sz--;
+}
+
+
+static BinList *_list(BinModel *m, int bin, uint64_t size) {
+    switch (bin) {
+        case BIN_TCACHE: return &m->tcache[(size - MINSIZE_CHUNK) / 0x10];
+        case BIN_FAST: return &m->fast[(size >> 4) - 2];
+        case BIN_UNSORTED: return &m->unsorted;
+        case BIN_SMALL: return &m->small[size >> 4];
+        case BIN_LARGE: return &m->large;
+    }
+    return 0;
+}
+
+
+static int _is_free_bin(int bin) {
+    return bin == BIN_UNSORTED || bin == BIN_SMALL || bin == BIN_LARGE;
+}
+
+
+// adds a chunk at the head of a bin, like glibc does for all of them
+static BinNode *_push(BinModel *m, int bin, uint64_t chunk, uint64_t size) {
+    BinNode *node = (BinNode *)calloc(1, sizeof(BinNode));
+    ASSERT(node, "_push: calloc out of memory");
+    node->chunk = chunk;
+    node->size = size;
+    node->bin = bin;
+    _map_put(&m->by_start, node, MAP_START);
+    if (_is_free_bin(bin)) _map_put(&m->by_end, node, MAP_END);
+
+    BinList *list = _list(m, bin, size);
+    if (list) {
+        node->next = list->head;
+        if (list->head) list->head->prev = node;
+        else list->tail = node;
+        list->head = node;
+        list->count++;
+    }
+    if (bin == BIN_FAST) m->fast_count++;
+    return node;
+}
+
+
+static void _remove(BinModel *m, BinNode *node) {
+    _map_del(&m->by_start, node, MAP_START);
+    if (_is_free_bin(node->bin)) _map_del(&m->by_end, node, MAP_END);
+
+    BinList *list = _list(m, node->bin, node->size);
+    if (list) {
+        if (node->prev) node->prev->next = node->next;
+        else list->head = node->next;
+        if (node->next) node->next->prev = node->prev;
+        else list->tail = node->prev;
+        list->count--;
+    }
+    if (node->bin == BIN_FAST) m->fast_count--;
+    if (m->last_remainder == node->chunk) m->last_remainder = 0;
+    free(node);
+}
+
+
+// removes the chunk at the head (or tail) of a list and returns its address
+static uint64_t _pop(BinModel *m, BinList *list, int from_tail) {
+    BinNode *node = from_tail ? list->tail : list->head;
+    uint64_t chunk = node->chunk;
+    _remove(m, node);
+    return chunk;
+}
+
+
+static void _clear(BinModel *m, BinList *list) {
+    while (list->head) _remove(m, list->head);
+}
+
+
+static int _tcache_idx(uint64_t size) {
+    return (size - MINSIZE_CHUNK) / 0x10;
+}
+
+
+static int _fits_tcache(BinModel *m, uint64_t size) {
+    return m->has_tcache && size <= TCACHE_MAX_SIZE;
+}
+
+
+static void _init(HeaptraceContext *ctx, BinModel *m) {
+    if (m->initialized) return;
+    m->initialized = 1;
+    m->mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+
+    // a static binary's libc version is unknown; assume a recent one
+    int major = 2;
+    int minor = 99;
+    if (ctx->libc_version) sscanf(ctx->libc_version, "%d.%d", &major, &minor);
+    m->has_tcache = major > 2 || minor >= 26;
+    m->tcache_double_free_check = major > 2 || minor >= 29;
+    debug("bins: modeling glibc %d.%d (tcache: %s)\n", major, minor, m->has_tcache ? "yes" : "no");
+}
+
+
+static void _note(HeaptraceContext *ctx, const char *fmt, ...) {
+    HandlerLogMessage *hlm = &ctx->hlm;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(hlm->bin, sizeof(hlm->bin), fmt, args);
+    va_end(args);
+
+    if (OPT_FORMAT == OUTPUT_FORMAT_TEXT) {
+        HandlerLogMessageNote *note = insert_note(ctx);
+        concat_note(note, "%s", hlm->bin);
+    }
+}
+
+
+// `count` is what is left in the bin, -1 to leave it out
+static void _note_bin(HeaptraceContext *ctx, const char *verb, int bin, uint64_t size, int64_t count) {
+    if ((bin == BIN_TCACHE || bin == BIN_FAST || bin == BIN_SMALL) && count < 0) {
+        _note(ctx, "%s %s[0x%lx]", verb, BIN_NAMES[bin], size);
+    } else if (bin == BIN_TCACHE || bin == BIN_FAST || bin == BIN_SMALL) {
+        _note(ctx, "%s %s[0x%lx] (count %lu)", verb, BIN_NAMES[bin], size, count);
+    } else {
+        _note(ctx, "%s the %s", verb, BIN_NAMES[bin]);
+    }
+}
+
+
+/*
+ * puts a chunk that is really free (not in the tcache or a fastbin) in the
+ * unsorted bin, merged with the free chunks next to it, or into the top
+ * chunk. Returns 1 if it was merged into the top chunk.
+ */
+static int _release(BinModel *m, uint64_t chunk, uint64_t size) {
+    BinNode *prev = _map_get(&m->by_end, chunk, MAP_END);
+    if (prev) {
+        chunk = prev->chunk;
+        size += prev->size;
+        _remove(m, prev);
+    }
+    if (m->top && chunk + size == m->top) {
+        m->top = chunk;
+        return 1;
+    }
+    BinNode *next = _map_get(&m->by_start, chunk + size, MAP_START);
+    if (next && _is_free_bin(next->bin)) {
+        size += next->size;
+        _remove(m, next);
+    }
+    _push(m, BIN_UNSORTED, chunk, size);
+    return 0;
+}
+
+
+// moves every fastbin chunk into the unsorted bin (or the top chunk)
+static void _consolidate(BinModel *m) {
+    for (int i = 0; i < NFASTBINS && m->fast_count; i++) {
+        while (m->fast[i].head) {
+            BinNode *node = m->fast[i].head;
+            uint64_t chunk = node->chunk;
+            uint64_t size = node->size;
+            _remove(m, node);
+            _release(m, chunk, size);
+        }
+    }
+}
+
+
+/*
+ * glibc's free, minus the checks that abort. `note` annotates the operation;
+ * realloc frees its old chunk (or the part it trimmed off) without it.
+ */
+static void _free(HeaptraceContext *ctx, BinModel *m, uint64_t chunk, uint64_t size, int note) {
+    if (_fits_tcache(m, size)) {
+        BinList *list = &m->tcache[_tcache_idx(size)];
+        if (m->tcache_double_free_check) {
+            BinNode *dup = _map_get(&m->by_start, chunk, MAP_START);
+            if (dup && dup->bin == BIN_TCACHE) {
+                if (note) _note(ctx, "already in tcache[0x%lx]", size);
+                return; // "free(): double free detected in tcache 2"
+            }
+        }
+        if (list->count < TCACHE_FILL_COUNT) {
+            _push(m, BIN_TCACHE, chunk, size);
+            if (note) _note_bin(ctx, "went to", BIN_TCACHE, size, list->count);
+            return;
+        }
+    }
+
+    if (size <= MAX_FAST_SIZE) {
+        BinList *list = &m->fast[(size >> 4) - 2];
+        if (list->head && list->head->chunk == chunk) {
+            if (note) _note(ctx, "already at the top of fastbin[0x%lx]", size);
+            return; // "double free or corruption (fasttop)"
+        }
+        _push(m, BIN_FAST, chunk, size);
+        if (note) _note_bin(ctx, "went to", BIN_FAST, size, list->count);
+        return;
+    }
+
+    int into_top = _release(m, chunk, size);
+    if (note) {
+        if (into_top) _note(ctx, "merged into the top chunk");
+        else _note_bin(ctx, "went to", BIN_UNSORTED, size, m->unsorted.count);
+    }
+    // glibc also consolidates when the top chunk grows past the threshold.
+    // Its size isn't known here, but it rarely stays smaller for long.
+    if ((into_top || m->unsorted.head->size >= FASTBIN_CONSOLIDATION_THRESHOLD) && m->fast_count) _consolidate(m);
+}
+
+
+// a chunk taken out of the tcache goes back to it as long as there is room
+static void _stash(BinModel *m, BinList *from, uint64_t size, int from_tail) {
+    if (!_fits_tcache(m, size)) return;
+    BinList *tc = &m->tcache[_tcache_idx(size)];
+    while (tc->count < TCACHE_FILL_COUNT && from->count) {
+        uint64_t chunk = _pop(m, from, from_tail);
+        _push(m, BIN_TCACHE, chunk, size);
+    }
+}
+
+
+/*
+ * glibc's _int_malloc, as far as it can be predicted: the fastbin and
+ * smallbin for the exact size, then the unsorted bin, whose chunks are
+ * sorted into the small and large bins on the way. Sets *bin to where the
+ * predicted chunk comes from and returns it, or 0 for no prediction.
+ */
+static uint64_t _int_malloc(BinModel *m, uint64_t nb, int *bin) {
+    if (nb <= MAX_FAST_SIZE && m->fast[(nb >> 4) - 2].count) {
+        BinList *list = &m->fast[(nb >> 4) - 2];
+        uint64_t chunk = _pop(m, list, 0);
+        _stash(m, list, nb, 0);
+        *bin = BIN_FAST;
+        return chunk;
+    }
+    if (nb < MIN_LARGE_SIZE && m->small[nb >> 4].count) {
+        BinList *list = &m->small[nb >> 4];
+        uint64_t chunk = _pop(m, list, 1);
+        _stash(m, list, nb, 1);
+        *bin = BIN_SMALL;
+        return chunk;
+    }
+    if (nb >= MIN_LARGE_SIZE && m->fast_count) _consolidate(m);
+
+    // glibc splits the last remainder for small requests when it is alone
+    if (nb < MIN_LARGE_SIZE && m->unsorted.count == 1 && m->unsorted.tail->chunk == m->last_remainder && m->unsorted.tail->size > nb + MINSIZE_CHUNK) {
+        BinNode *node = m->unsorted.tail;
+        uint64_t chunk = node->chunk;
+        uint64_t rest = node->size - nb;
+        _remove(m, node);
+        m->last_remainder = _push(m, BIN_UNSORTED, chunk + nb, rest)->chunk;
+        *bin = BIN_UNSORTED;
+        return chunk;
+    }
+
+    int stashed = 0;
+    while (m->unsorted.count) {
+        BinNode *node = m->unsorted.tail;
+        uint64_t chunk = node->chunk;
+        uint64_t size = node->size;
+        _remove(m, node);
+        if (size == nb) {
+            if (_fits_tcache(m, nb) && m->tcache[_tcache_idx(nb)].count < TCACHE_FILL_COUNT) {
+                _push(m, BIN_TCACHE, chunk, size);
+                stashed = 1;
+                continue;
+            }
+            *bin = BIN_UNSORTED;
+            return chunk;
+        }
+        _push(m, size < MIN_LARGE_SIZE ? BIN_SMALL : BIN_LARGE, chunk, size);
+    }
+    if (stashed) {
+        *bin = BIN_UNSORTED;
+        return _pop(m, &m->tcache[_tcache_idx(nb)], 0);
+    }
+    return 0;
+}
+
+
+static int _looks_mmapped(BinModel *m, uint64_t chunk, uint64_t nb) {
+    return nb >= m->mmap_threshold && (chunk & (PAGE_SZ - 1)) == 0;
+}
+
+
+/*
+ * compares what glibc returned with the prediction, and learns where the
+ * chunk really came from when there was none (or a wrong one). Returns the
+ * size of the chunk, which is bigger than nb if a bin chunk was too small to
+ * split.
+ */
+static uint64_t _returned(HeaptraceContext *ctx, BinModel *m, uint64_t chunk, uint64_t nb, uint64_t predicted, int bin) {
+    if (predicted) m->predictions++;
+    if (predicted == chunk) {
+        BinList *list = bin == BIN_TCACHE || bin == BIN_FAST || bin == BIN_SMALL ? _list(m, bin, nb) : 0;
+        _note_bin(ctx, "from", bin, nb, list ? list->count : 0);
+        return nb;
+    }
+
+    if (predicted) {
+        m->divergences++;
+        warn_heap("%s returned " PTR_ERR ", but the bin model expected " PTR_ERR " from %s[0x%lx]", ctx->hlm.func_name, PTR_ARG(chunk + 0x10), PTR_ARG(predicted + 0x10), BIN_NAMES[bin], nb);
+        warn_heap2("this indicates that a free chunk was corrupted, e.g. by tcache or fastbin poisoning");
+        // the rest of that bin can't be trusted anymore
+        if (bin == BIN_TCACHE || bin == BIN_FAST || bin == BIN_SMALL) _clear(m, _list(m, bin, nb));
+    }
+
+    uint64_t size = nb;
+    BinNode *node = _map_get(&m->by_start, chunk, MAP_START);
+    if (node) {
+        int from = node->bin;
+        size = node->size;
+        _remove(m, node);
+        if (_is_free_bin(from) && size >= nb + MINSIZE_CHUNK) {
+            // the rest of a best fit goes to the unsorted bin
+            uint64_t rest = _push(m, BIN_UNSORTED, chunk + nb, size - nb)->chunk;
+            if (nb < MIN_LARGE_SIZE) m->last_remainder = rest;
+            if (!predicted) _note_bin(ctx, "from", from, size, -1);
+            size = nb;
+        } else if (!predicted) {
+            _note_bin(ctx, "from", from, size, -1);
+        }
+    } else if (m->top && chunk == m->top) {
+        m->top += nb;
+        if (!predicted) _note(ctx, "from the top chunk");
+    } else if (_looks_mmapped(m, chunk, nb)) {
+        size = (nb + 0x8 + PAGE_SZ - 1) & ~(uint64_t)(PAGE_SZ - 1);
+        _push(m, BIN_MMAPPED, chunk, size);
+        if (!predicted) _note(ctx, "mmapped");
+        return size;
+    }
+    if (chunk + size > m->top) m->top = chunk + size;
+    return size;
+}
+
+
+static uint64_t _malloc(HeaptraceContext *ctx, BinModel *m, uint64_t ptr, uint64_t nb, int use_tcache) {
+    int bin = BIN_TCACHE;
+    uint64_t predicted = 0;
+    if (use_tcache && _fits_tcache(m, nb) && m->tcache[_tcache_idx(nb)].count) {
+        predicted = _pop(m, &m->tcache[_tcache_idx(nb)], 0);
+    } else {
+        predicted = _int_malloc(m, nb, &bin);
+    }
+    return _returned(ctx, m, ptr - 0x10, nb, predicted, bin);
+}
+
+
+// malloc, calloc and operator new, for `req` bytes. calloc never takes from
+// the tcache.
+void bins_malloc(HeaptraceContext *ctx, Chunk *chunk, uint64_t req, int from_calloc) {
+    if (!OPT_BINS || !chunk->ptr) return;
+    BinModel *m = &ctx->bins;
+    _init(ctx, m);
+    chunk->bin_size = _malloc(ctx, m, chunk->ptr, CHUNK_SIZE(req), !from_calloc);
+}
+
+
+// the size of a live chunk, as malloc saw it
+static uint64_t _chunk_size(Chunk *chunk) {
+    if (chunk->bin_size) return chunk->bin_size;
+    if (chunk->real_size) return chunk->real_size;
+    return CHUNK_SIZE(chunk->size + chunk->redzone);
+}
+
+
+// free and operator delete, including double frees, which glibc only
+// catches in some cases
+void bins_free(HeaptraceContext *ctx, Chunk *chunk) {
+    if (!OPT_BINS || !chunk) return;
+    BinModel *m = &ctx->bins;
+    _init(ctx, m);
+
+    uint64_t addr = chunk->ptr - 0x10;
+    BinNode *node = _map_get(&m->by_start, addr, MAP_START);
+    if (node && node->bin == BIN_MMAPPED) {
+        // glibc raises the threshold so that chunks like this one come
+        // from the heap from now on
+        if (node->size > m->mmap_threshold && node->size <= DEFAULT_MMAP_THRESHOLD_MAX) m->mmap_threshold = node->size;
+        _remove(m, node);
+        _note(ctx, "munmapped");
+        return;
+    }
+    _free(ctx, m, addr, _chunk_size(chunk), 1);
+}
+
+
+// remembers the size of the chunk being realloc'd before its redzone is
+// checked (and forgotten)
+void bins_pre_realloc(HeaptraceContext *ctx, Chunk *orig) {
+    if (!OPT_BINS) return;
+    ctx->bins.realloc_size = orig && orig->state == STATE_MALLOC ? _chunk_size(orig) : 0;
+}
+
+
+// where realloc put `chunk` (0 if it returned NULL), which was `orig`
+static uint64_t _realloc(HeaptraceContext *ctx, BinModel *m, Chunk *orig, Chunk *chunk, uint64_t nb) {
+    uint64_t old_size = m->realloc_size;
+    uint64_t addr = orig->ptr - 0x10;
+    BinNode *mmapped = _map_get(&m->by_start, addr, MAP_START);
+    if (mmapped && mmapped->bin == BIN_MMAPPED) {
+        // mremap, which the model doesn't follow
+        _remove(m, mmapped);
+        return chunk ? _returned(ctx, m, chunk->ptr - 0x10, nb, 0, BIN_TCACHE) : 0;
+    }
+    if (!chunk) {
+        if (orig->state == STATE_FREE) _free(ctx, m, addr, old_size, 1); // realloc(ptr, 0)
+        return 0;
+    }
+
+    if (chunk != orig) {
+        int bin = BIN_TCACHE;
+        uint64_t predicted = _int_malloc(m, nb, &bin);
+        uint64_t size = _returned(ctx, m, chunk->ptr - 0x10, nb, predicted, bin);
+        _free(ctx, m, addr, old_size, 0);
+        return size;
+    }
+
+    uint64_t size = old_size;
+    if (nb > old_size) {
+        uint64_t next = addr + old_size;
+        BinNode *node = _map_get(&m->by_start, next, MAP_START);
+        if (m->top && next == m->top) {
+            m->top = addr + nb;
+            size = nb;
+        } else if (node && _is_free_bin(node->bin)) {
+            size += node->size;
+            _remove(m, node);
+        }
+        _note(ctx, "grew in place");
+    } else if (nb < old_size) {
+        _note(ctx, "shrank in place");
+    }
+    if (size >= nb + MINSIZE_CHUNK) {
+        _free(ctx, m, addr + nb, size - nb, 0);
+        size = nb;
+    }
+    return size;
+}
+
+
+/*
+ * realloc: without a pointer it is malloc, with a size of 0 it is free. A
+ * chunk that stays in place gives back what it no longer needs, or takes what
+ * it needs from the chunk after it. One that moves is allocated without the
+ * tcache and the old one is freed.
+ */
+void bins_realloc(HeaptraceContext *ctx, Chunk *orig, Chunk *chunk, uint64_t req) {
+    if (!OPT_BINS) return;
+    BinModel *m = &ctx->bins;
+    _init(ctx, m);
+
+    uint64_t size = 0;
+    if (!orig || !m->realloc_size) {
+        if (chunk) size = _malloc(ctx, m, chunk->ptr, CHUNK_SIZE(req), 1);
+    } else {
+        size = _realloc(ctx, m, orig, chunk, CHUNK_SIZE(req));
+    }
+    if (chunk) chunk->bin_size = size;
+}
+
+
+// memalign and friends split their chunk out of a bigger one, which is not
+// modeled. The chunk is only forgotten if the model had it.
+void bins_aligned(HeaptraceContext *ctx, Chunk *chunk, uint64_t req) {
+    if (!OPT_BINS || !chunk->ptr) return;
+    BinModel *m = &ctx->bins;
+    _init(ctx, m);
+    chunk->bin_size = _returned(ctx, m, chunk->ptr - 0x10, CHUNK_SIZE(req), 0, BIN_TCACHE);
+}
+
+
+static void _show_list(BinList *list, const char *name, uint64_t size) {
+    if (!list->count) return;
+    color_log(COLOR_LOG);
+    if (size) log("... %s[0x%lx]: " CNT " chunks:", name, size, list->count);
+    else log("... %s: " CNT " chunks:", name, list->count);
+    int i = 0;
+    for (BinNode *node = list->head; node && i < 4; node = node->next, i++) log(" " PTR, PTR_ARG(node->chunk + 0x10));
+    log("%s\n", list->count > 4 ? " ..." : "");
+}
+
+
+void show_bins_stats(HeaptraceContext *ctx) {
+    BinModel *m = &ctx->bins;
+    if (!OPT_BINS || !m->initialized) return;
+    color_log(COLOR_LOG);
+    log("Bins (as modeled, head first):\n");
+    for (int i = 0; i < TCACHE_MAX_BINS; i++) _show_list(&m->tcache[i], "tcache", MINSIZE_CHUNK + i * 0x10);
+    for (int i = 0; i < NFASTBINS; i++) _show_list(&m->fast[i], "fastbin", (i + 2) * 0x10);
+    _show_list(&m->unsorted, "unsorted bin", 0);
+    for (int i = 0; i < NSMALLBINS; i++) _show_list(&m->small[i], "smallbin", i * 0x10);
+    _show_list(&m->large, "largebins", 0);
+    if (m->top) log("... top chunk: " PTR "\n", PTR_ARG(m->top));
+    if (m->divergences) {
+        color_log(COLOR_ERROR);
+        log("... bin model divergences: " COLOR_ERROR_BOLD "%lu" COLOR_ERROR " of %lu predictions\n", m->divergences, m->predictions);
+    }
+    color_log(COLOR_RESET);
+}
+
+
+// adds the model's totals to the stats record that is being built
+void show_bins_stats_jsonl(HeaptraceContext *ctx) {
+    if (!OPT_BINS) return;
+    BinModel *m = &ctx->bins;
+    jsonl_key("bin_predictions");
+    jsonl_u64(m->predictions);
+    jsonl_key("bin_divergences");
+    jsonl_u64(m->divergences);
+}
+
+
+void free_bins(HeaptraceContext *ctx) {
+    BinModel *m = &ctx->bins;
+    BinMap *map = &m->by_start;
+    for (size_t i = 0; i < map->cap; i++) {
+        BinNode *cur = map->buckets[i];
+        while (cur) {
+            BinNode *next = cur->hnext[MAP_START];
+            free(cur);
+            cur = next;
+        }
+    }
+    free(m->by_start.buckets);
+    free(m->by_end.buckets);
+}
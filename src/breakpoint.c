@@ -25,6 +25,7 @@ void install_breakpoint(HeaptraceContext *ctx, Breakpoint *bp) {
             }
         } else {
             ctx->breakpoints[i] = bp;
+            if (i >= ctx->breakpoints_sz) ctx->breakpoints_sz = i + 1;
             errno = 0;
             PTRACE(PTRACE_POKEDATA, ctx->pid, vaddr, (orig_data & ~((uint64_t)0xff)) | ((uint64_t)'\xcc' & (uint64_t)0xff));
             if (errno) {
@@ -41,7 +42,7 @@ void install_breakpoint(HeaptraceContext *ctx, Breakpoint *bp) {
 // TODO: convert into linked list
 void _remove_breakpoint(HeaptraceContext *ctx, Breakpoint *bp, int opts) {
     if (opts & BREAKPOINT_OPT_UNREGISTER) {
-        for (int i = 0; i < BREAKPOINTS_COUNT; i++) {
+        for (int i = 0; i < ctx->breakpoints_sz; i++) {
             if (ctx->breakpoints[i] == bp) {
                 ctx->breakpoints[i] = 0;
             }
@@ -61,7 +62,7 @@ void _remove_breakpoint(HeaptraceContext *ctx, Breakpoint *bp, int opts) {
 // TODO: convert into linked list
 void _remove_breakpoints(HeaptraceContext *ctx, int opts) {
     debug("removing all breakpoints...\n");
-    for (int i = 0; i < BREAKPOINTS_COUNT; i++) {
+    for (int i = 0; i < ctx->breakpoints_sz; i++) {
         if (ctx->breakpoints[i]) {
             _remove_breakpoint(ctx, ctx->breakpoints[i], opts);
         }
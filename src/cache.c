@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "context.h"
+#include "symbol.h"
+#include "logging.h"
+#include "funcid-db.h"
+
+/*
+ * Persistent analysis cache. Each ELF gets one small text file under 
+ * $XDG_CACHE_HOME/heaptrace (or ~/.cache/heaptrace) holding the resolved 
+ * symbol entries (including funcid results) and, for libc, the version 
+ * string. Files are keyed by GNU build-id, or by device/inode/size/mtime if 
+ * the ELF has no build-id, so a warm start never has to scan the ELF. The 
+ * key also names the funcid database in use, so symbols it couldn't find 
+ * are looked for again once a database is installed or rebuilt.
+ */
+
+int OPT_NO_CACHE = 0;
+
+#define CACHE_KEY_SZ 160
+#define CACHE_LINE_SZ 512
+
+
+static int _cache_dir(char *out, size_t out_sz) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+    if (xdg && *xdg) n = snprintf(out, out_sz, "%s/heaptrace", xdg);
+    else if (home && *home) n = snprintf(out, out_sz, "%s/.cache/heaptrace", home);
+    else return 0;
+    return n > 0 && (size_t)n < out_sz;
+}
+
+
+// creates every missing directory in path
+static int _mkdirs(char *path) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\x00';
+        int ret = mkdir(path, 0700);
+        *p = '/';
+        if (ret && errno != EEXIST) return 0;
+    }
+    return !mkdir(path, 0700) || errno == EEXIST;
+}
+
+
+// reads the NT_GNU_BUILD_ID note through the program headers, so only the 
+// first few pages of the file are touched
+static int _read_build_id(ElfImage *img, char *out, size_t out_sz) {
+    for (uint16_t i = 0; i < img->phnum; i++) {
+        Elf64_Phdr *phdr = &img->phdrs[i];
+        if (phdr->p_type != PT_NOTE || !elf_image_range_ok(img, phdr->p_offset, phdr->p_filesz)) continue;
+
+        char *bytes = (char *)img->bytes;
+        size_t pos = phdr->p_offset;
+        size_t end = pos + phdr->p_filesz;
+        while (pos + sizeof(Elf64_Nhdr) <= end) {
+            Elf64_Nhdr *nhdr = (Elf64_Nhdr *)(bytes + pos);
+            size_t name_off = pos + sizeof(Elf64_Nhdr);
+            size_t desc_off = name_off + ((nhdr->n_namesz + 3) & ~3);
+            size_t next = desc_off + ((nhdr->n_descsz + 3) & ~3);
+            if (next > end || next <= pos) break;
+
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && !memcmp(bytes + name_off, "GNU", 4)
+                    && nhdr->n_descsz && nhdr->n_descsz * 2 < out_sz) {
+                for (size_t j = 0; j < nhdr->n_descsz; j++) {
+                    snprintf(out + j * 2, 3, "%02x", (uint8_t)bytes[desc_off + j]);
+                }
+                return 1;
+            }
+            pos = next;
+        }
+    }
+    return 0;
+}
+
+
+// computes the cache file path for hf, returns 0 if caching isn't possible
+static int _cache_path(HeaptraceFile *hf, char *out, size_t out_sz, int create_dir) {
+    if (OPT_NO_CACHE || !hf->path) return 0;
+
+    char dir[4096];
+    if (!_cache_dir(dir, sizeof(dir))) return 0;
+
+    ElfImage *img = get_file_image(hf);
+    if (!img) return 0;
+
+    // the size is part of the key because strip(1) keeps the build-id
+    char key[CACHE_KEY_SZ];
+    char build_id[CACHE_KEY_SZ - 64];
+    if (_read_build_id(img, build_id, sizeof(build_id))) {
+        snprintf(key, sizeof(key), "%s-%lx-%lx", build_id, (uint64_t)img->size, funcid_db_stamp());
+    } else {
+        snprintf(key, sizeof(key), "f-%lx-%lx-%lx-%lx-%lx", (uint64_t)img->dev, (uint64_t)img->ino, (uint64_t)img->size, (uint64_t)img->mtime, funcid_db_stamp());
+    }
+
+    if (create_dir && !_mkdirs(dir)) return 0;
+    int n = snprintf(out, out_sz, "%s/%s", dir, key);
+    return n > 0 && (size_t)n < out_sz;
+}
+
+
+// loads the cached analysis for hf. Returns 1 (and replaces hf->se_head) 
+// only if every name in `names` is in the cache. If version is non-null it 
+// receives a malloc'd copy of the cached libc version, if there is one.
+int cache_load(HeaptraceFile *hf, char *names[], char **version) {
+    if (version) *version = 0;
+
+    char path[4096 + CACHE_KEY_SZ];
+    if (!_cache_path(hf, path, sizeof(path), 0)) return 0;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        debug("no cache entry for %s\n", hf->path);
+        return 0;
+    }
+
+    char line[CACHE_LINE_SZ];
+    int format = 0;
+    if (!fgets(line, sizeof(line), f) || sscanf(line, "heaptrace-cache %d", &format) != 1 || format != CACHE_FORMAT_VERSION) {
+        debug("ignoring stale cache entry %s\n", path);
+        fclose(f);
+        return 0;
+    }
+
+    SymbolEntry *se_head = 0;
+    SymbolEntry *cur_se = 0;
+    uint is_dynamic = 0;
+    uint is_stripped = 1;
+    while (fgets(line, sizeof(line), f)) {
+        char name[CACHE_LINE_SZ];
+        uint64_t offset, size;
+        int type, section;
+        uint flag;
+
+        if (!strncmp(line, "version ", 8)) {
+            line[strcspn(line, "\n")] = '\x00';
+            if (version && !*version) *version = strdup(line + 8);
+        } else if (sscanf(line, "dynamic %u", &flag) == 1) {
+            is_dynamic = flag;
+        } else if (sscanf(line, "stripped %u", &flag) == 1) {
+            is_stripped = flag;
+        } else if (sscanf(line, "sym %511s %d %lx %lx %d", name, &type, &offset, &size, &section) == 5) {
+            SymbolEntry *se = (SymbolEntry *)calloc(1, sizeof(SymbolEntry));
+            se->name = strdup(name);
+            se->type = type;
+            se->offset = offset;
+            se->size = size;
+            se->section = section;
+            if (!se_head) se_head = se;
+            else cur_se->_next = se;
+            cur_se = se;
+        }
+    }
+    fclose(f);
+
+    for (int i = 0; names[i]; i++) {
+        if (!find_se_name(se_head, names[i])) {
+            debug("cache entry for %s is missing symbol \"%s\"\n", hf->path, names[i]);
+            free_se_list(se_head);
+            return 0;
+        }
+    }
+
+    debug("using cached analysis for %s (%s)\n", hf->path, path);
+    free_se_list(hf->se_head);
+    hf->se_head = se_head;
+    hf->is_dynamic = is_dynamic;
+    hf->is_stripped = is_stripped;
+    hf->from_cache = 1;
+    return 1;
+}
+
+
+// writes hf's resolved symbols (and the libc version, if any) to the cache
+void cache_store(HeaptraceFile *hf, const char *version) {
+    char path[4096 + CACHE_KEY_SZ];
+    if (!_cache_path(hf, path, sizeof(path), 1)) return;
+
+    // write to a temporary file and rename it so concurrent runs never see a 
+    // partial entry
+    char tmp_path[sizeof(path) + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid());
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        debug("failed to write cache entry %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "heaptrace-cache %d\n", CACHE_FORMAT_VERSION);
+    fprintf(f, "dynamic %u\n", hf->is_dynamic);
+    fprintf(f, "stripped %u\n", hf->is_stripped);
+    if (version) fprintf(f, "version %s\n", version);
+    for (SymbolEntry *se = hf->se_head; se; se = se->_next) {
+        if (strpbrk(se->name, " \t\n")) continue;
+        fprintf(f, "sym %s %d %lx %lx %d\n", se->name, se->type, se->offset, se->size, se->section);
+    }
+
+    if (fclose(f) || rename(tmp_path, path)) {
+        debug("failed to write cache entry %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return;
+    }
+    debug("stored analysis for %s in %s\n", hf->path, path);
+}
@@ -0,0 +1,213 @@
+#include "callsite.h"
+#include "context.h"
+#include "heap.h"
+#include "logging.h"
+#include "symbol.h"
+#include "jsonl.h"
+
+int OPT_CALLSITES = 0;
+
+static const size_t CALLSITES_INITIAL_CAP = 256; // must be a power of 2
+
+
+static inline size_t _hash_addr(uint64_t addr, size_t cap) {
+    return (size_t)((addr * 0x9E3779B97F4A7C15LLU) >> 17) & (cap - 1);
+}
+
+
+static CallSite *_find_slot(CallSite *arr, size_t cap, uint64_t addr) {
+    size_t i = _hash_addr(addr, cap);
+    while (arr[i].addr && arr[i].addr != addr) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &arr[i];
+}
+
+
+static void _grow_callsites(HeaptraceContext *ctx) {
+    size_t new_cap = ctx->callsites_cap ? ctx->callsites_cap * 2 : CALLSITES_INITIAL_CAP;
+    CallSite *new_arr = (CallSite *)calloc(new_cap, sizeof(CallSite));
+    ASSERT(new_arr, "_grow_callsites: calloc out of memory");
+
+    for (size_t i = 0; i < ctx->callsites_cap; i++) {
+        if (ctx->callsites[i].addr) {
+            *_find_slot(new_arr, new_cap, ctx->callsites[i].addr) = ctx->callsites[i];
+        }
+    }
+
+    free(ctx->callsites);
+    ctx->callsites = new_arr;
+    ctx->callsites_cap = new_cap;
+}
+
+
+static CallSite *_get_callsite(HeaptraceContext *ctx, uint64_t addr, int create) {
+    if (!ctx->callsites) {
+        if (!create) return 0;
+        _grow_callsites(ctx);
+    }
+
+    CallSite *site = _find_slot(ctx->callsites, ctx->callsites_cap, addr);
+    if (site->addr || !create) return site->addr ? site : 0;
+
+    // keep the load factor under 1/2 so probes stay short
+    if ((ctx->callsites_count + 1) * 2 > ctx->callsites_cap) {
+        _grow_callsites(ctx);
+        site = _find_slot(ctx->callsites, ctx->callsites_cap, addr);
+    }
+    site->addr = addr;
+    ctx->callsites_count++;
+    return site;
+}
+
+
+// attributes a chunk that was just allocated to the current caller. If the 
+// chunk was still live, callsite_free must be called before its size changes
+void callsite_alloc(HeaptraceContext *ctx, Chunk *chunk) {
+    if (chunk) chunk->caller = ctx->h_ret_ptr;
+    if (!OPT_CALLSITES || !chunk || !ctx->h_ret_ptr) return;
+
+    CallSite *site = _get_callsite(ctx, ctx->h_ret_ptr, 1);
+    uint64_t nbytes = chunk_bytes(chunk);
+    site->count++;
+    site->bytes += nbytes;
+    site->live_count++;
+    site->live_bytes += nbytes;
+    if (site->live_bytes > site->peak_bytes) site->peak_bytes = site->live_bytes;
+
+    chunk->site = ctx->h_ret_ptr;
+}
+
+
+// removes a chunk's bytes from the live counters of the site that allocated it
+void callsite_free(HeaptraceContext *ctx, Chunk *chunk) {
+    if (!OPT_CALLSITES || !chunk || !chunk->site) return;
+
+    CallSite *site = _get_callsite(ctx, chunk->site, 0);
+    if (site) {
+        site->live_count--;
+        site->live_bytes -= chunk_bytes(chunk);
+    }
+
+    chunk->site = 0;
+}
+
+
+// moves a live chunk's bytes from its estimated to its real size, see 
+// flush_chunk_sizes
+void callsite_resize(HeaptraceContext *ctx, Chunk *chunk, uint64_t old_bytes) {
+    if (!OPT_CALLSITES || !chunk->site) return;
+
+    CallSite *site = _get_callsite(ctx, chunk->site, 0);
+    if (!site) return;
+    uint64_t nbytes = chunk_bytes(chunk);
+    site->bytes += nbytes - old_bytes;
+    site->live_bytes += nbytes - old_bytes;
+    if (site->live_bytes > site->peak_bytes) site->peak_bytes = site->live_bytes;
+}
+
+
+static int _cmp_live_bytes(const void *a, const void *b) {
+    const CallSite *x = *(const CallSite **)a;
+    const CallSite *y = *(const CallSite **)b;
+    if (x->live_bytes != y->live_bytes) return x->live_bytes < y->live_bytes ? 1 : -1;
+    return x->addr < y->addr ? -1 : (x->addr > y->addr);
+}
+
+
+static int _cmp_bytes(const void *a, const void *b) {
+    const CallSite *x = *(const CallSite **)a;
+    const CallSite *y = *(const CallSite **)b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return x->addr < y->addr ? -1 : (x->addr > y->addr);
+}
+
+
+static void _print_callsite(HeaptraceContext *ctx, CallSite *site, int leaks) {
+    const char *name = describe_address(ctx, site->addr);
+    color_log(COLOR_LOG);
+    log("... ");
+    color_log(COLOR_LOG_BOLD);
+    log("%s", name);
+    color_log(COLOR_LOG);
+    log(" (" U64T "): ", site->addr);
+    if (leaks) {
+        log(CNT " unfreed chunks, " SZ_ERR " bytes" COLOR_LOG " (peak " SZ ")\n", site->live_count, SZ_ARG(site->live_bytes), SZ_ARG(site->peak_bytes));
+    } else {
+        log(CNT " allocations, " SZ " bytes (peak " SZ ")\n", site->count, SZ_ARG(site->bytes), SZ_ARG(site->peak_bytes));
+    }
+}
+
+
+static void _show_callsite_stats_jsonl(HeaptraceContext *ctx, CallSite **sites, size_t nsites) {
+    for (size_t i = 0; i < nsites; i++) {
+        CallSite *site = sites[i];
+        const char *name = describe_address(ctx, site->addr);
+        jsonl_begin();
+        jsonl_key("type");
+        jsonl_str("callsite");
+        jsonl_key("caller");
+        jsonl_hex(site->addr);
+        jsonl_key("caller_func");
+        jsonl_str(name);
+        jsonl_key("count");
+        jsonl_u64(site->count);
+        jsonl_key("bytes");
+        jsonl_u64(site->bytes);
+        jsonl_key("live_count");
+        jsonl_u64(site->live_count);
+        jsonl_key("live_bytes");
+        jsonl_u64(site->live_bytes);
+        jsonl_key("peak_bytes");
+        jsonl_u64(site->peak_bytes);
+        jsonl_end(event_fd);
+    }
+}
+
+
+void show_callsite_stats(HeaptraceContext *ctx) {
+    if (!OPT_CALLSITES || !ctx->callsites_count) return;
+
+    CallSite **sites = (CallSite **)malloc(ctx->callsites_count * sizeof(CallSite *));
+    size_t nsites = 0;
+    for (size_t i = 0; i < ctx->callsites_cap; i++) {
+        if (ctx->callsites[i].addr) sites[nsites++] = &ctx->callsites[i];
+    }
+
+    if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) {
+        // consumers can sort however they like, so dump everything
+        _show_callsite_stats_jsonl(ctx, sites, nsites);
+        free(sites);
+        return;
+    }
+
+    size_t top = (size_t)OPT_CALLSITES;
+    if (top > nsites) top = nsites;
+
+    qsort(sites, nsites, sizeof(CallSite *), _cmp_live_bytes);
+    if (sites[0]->live_bytes) {
+        color_log(COLOR_LOG);
+        log("Top leaking call sites:\n");
+        for (size_t i = 0; i < top && sites[i]->live_bytes; i++) {
+            _print_callsite(ctx, sites[i], 1);
+        }
+    }
+
+    qsort(sites, nsites, sizeof(CallSite *), _cmp_bytes);
+    color_log(COLOR_LOG);
+    log("Top allocating call sites:\n");
+    for (size_t i = 0; i < top; i++) {
+        _print_callsite(ctx, sites[i], 0);
+    }
+    color_log(COLOR_RESET);
+
+    free(sites);
+}
+
+
+void free_callsites(HeaptraceContext *ctx) {
+    free(ctx->callsites);
+    ctx->callsites = 0;
+    ctx->callsites_cap = 0;
+    ctx->callsites_count = 0;
+}
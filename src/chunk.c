@@ -1,9 +1,16 @@
 #ifndef CHUNK_C
 #define CHUNK_C
 
+#define _GNU_SOURCE
+#include <sys/uio.h>
+
 #include "chunk.h"
 #include "heap.h"
 #include "context.h"
+#include "allocator.h"
+#include "callsite.h"
+
+int OPT_REAL_SIZES = 0;
 
 static const size_t CHUNK_ARR_SZ = 1000;
 
@@ -86,7 +93,7 @@ uint64_t count_unfreed_bytes(Chunk *chunk) {
     uint64_t nbytes = 0;
     if (chunk) {
         if (chunk->state == STATE_MALLOC) {
-            nbytes += CHUNK_SIZE(chunk->size);
+            nbytes += chunk_bytes(chunk);
         }
         nbytes += count_unfreed_bytes(chunk->left);
         nbytes += count_unfreed_bytes(chunk->right);
@@ -94,4 +101,88 @@ uint64_t count_unfreed_bytes(Chunk *chunk) {
     return nbytes;
 }
 
+
+// how much heap memory a live chunk takes: its real size if --real-sizes 
+// read it, or else the allocator profile's estimate
+uint64_t chunk_bytes(Chunk *chunk) {
+    if (chunk->real_size) return chunk->real_size;
+    return allocator_chunk_size(chunk->size);
+}
+
+
+/*
+ * --real-sizes reads the size field glibc keeps right before each returned 
+ * pointer. Chunks are queued as they are allocated and their headers read 
+ * in one process_vm_readv per SIZE_BATCH_SZ chunks. The batch is also 
+ * flushed before a queued chunk is released (free can merge it into its 
+ * neighbours, changing the header) and before the tracee exits.
+ */
+void queue_chunk_size(HeaptraceContext *ctx, Chunk *chunk) {
+    if (!OPT_REAL_SIZES || !chunk->ptr) return;
+    chunk->real_size = 0;
+    if (chunk->size_pending) return; // read with its current header anyway
+
+    if (!ctx->size_batch) {
+        ctx->size_batch = (Chunk **)calloc(SIZE_BATCH_SZ, sizeof(Chunk *));
+        ASSERT(ctx->size_batch, "queue_chunk_size: calloc out of memory");
+    }
+    chunk->size_pending = 1;
+    ctx->size_batch[ctx->size_batch_sz++] = chunk;
+    if (ctx->size_batch_sz == SIZE_BATCH_SZ) flush_chunk_sizes(ctx);
+}
+
+
+// makes sure a chunk's real size is read before it is released
+void sync_chunk_size(HeaptraceContext *ctx, Chunk *chunk) {
+    if (chunk && chunk->size_pending) flush_chunk_sizes(ctx);
+}
+
+
+// returns the chunk size in a glibc size field, or 0 if it can't belong to a
+// chunk holding `req` bytes
+static uint64_t _parse_size_field(uint64_t field, uint64_t req) {
+    uint64_t size = field & ~(uint64_t)0x7;
+    uint64_t overhead = (field & 0x2) ? 0x10 : 0x8; // IS_MMAPPED chunks have no next chunk to borrow prev_size from
+    if (size < 0x20 || size & 0xf || size - overhead < req) return 0;
+    if (req && size > CHUNK_SIZE(req) + (1LU << 32)) return 0;
+    return size;
+}
+
+
+void flush_chunk_sizes(HeaptraceContext *ctx) {
+    size_t n = ctx->size_batch_sz;
+    if (!n) return;
+    ctx->size_batch_sz = 0;
+
+    struct iovec local[SIZE_BATCH_SZ];
+    struct iovec remote[SIZE_BATCH_SZ];
+    uint64_t fields[SIZE_BATCH_SZ];
+    for (size_t i = 0; i < n; i++) {
+        local[i].iov_base = &fields[i];
+        local[i].iov_len = sizeof(uint64_t);
+        remote[i].iov_base = (void *)(ctx->size_batch[i]->ptr - sizeof(uint64_t));
+        remote[i].iov_len = sizeof(uint64_t);
+    }
+
+    // reads stop at the first unreadable header, leaving the rest estimated
+    ssize_t nread = process_vm_readv(ctx->pid, local, n, remote, n, 0);
+    size_t nfields = nread > 0 ? (size_t)nread / sizeof(uint64_t) : 0;
+    if (nfields < n) debug("flush_chunk_sizes: read %lu of %lu chunk headers\n", nfields, n);
+
+    for (size_t i = 0; i < n; i++) {
+        Chunk *chunk = ctx->size_batch[i];
+        chunk->size_pending = 0;
+        if (i >= nfields) continue;
+
+        uint64_t size = _parse_size_field(fields[i], chunk->size);
+        if (!size) {
+            debug("flush_chunk_sizes: ignoring size field " U64T " of chunk " U64T " (size " U64T ")\n", fields[i], chunk->ptr, chunk->size);
+            continue;
+        }
+        uint64_t old_bytes = chunk_bytes(chunk);
+        chunk->real_size = size;
+        callsite_resize(ctx, chunk, old_bytes);
+    }
+}
+
 #endif
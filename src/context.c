@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "context.h"
 #include "logging.h"
@@ -11,11 +12,26 @@ HeaptraceFile *alloc_file(HeaptraceContext *ctx) {
 }
 
 
+// the mapping of hf->path shared by all of the analysis phases, opened on 
+// first use. libc's path is only known once it is mapped into the tracee, 
+// so if the path changed the old image (and the symbol names pointing into 
+// it) is released first.
+ElfImage *get_file_image(HeaptraceFile *hf) {
+    if (hf->elf && hf->path && !strcmp(hf->elf->path, hf->path)) return hf->elf;
+    free_static_symbols(hf);
+    elf_image_close(hf->elf);
+    hf->elf = elf_image_open(hf->path);
+    return hf->elf;
+}
+
+
 HeaptraceContext *alloc_ctx() {
     HeaptraceContext *ctx = (HeaptraceContext *)calloc(1, sizeof(HeaptraceContext));
     ctx->h_ret_ptr_section_type = PROCELF_TYPE_UNKNOWN;
     ctx->target = alloc_file(ctx);
     ctx->libc = alloc_file(ctx);
+    ctx->libstdcxx = alloc_file(ctx);
+    ctx->allocator = alloc_file(ctx);
     ctx->hlm.warnings = malloc(HLM_WARNINGS_SIZE + 2);
     return ctx;
 }
@@ -23,19 +39,37 @@ HeaptraceContext *alloc_ctx() {
 void *free_ctx(HeaptraceContext *ctx) {
     debug("Freeing context %p...\n", ctx);
     
-    free_pme_list(ctx->pme_head);
+    free_proc_maps(ctx->proc_maps);
     free(ctx->libc_version);
     free(ctx->pre_analysis_bps);
     free(ctx->se_names);
 
     free_se_list(ctx->target->se_head);
-    free_se_list(ctx->target->all_static_se_head);
+    free_static_symbols(ctx->target);
+    elf_image_close(ctx->target->elf);
     free_se_list(ctx->libc->se_head);
-    free_se_list(ctx->libc->all_static_se_head);
+    free_static_symbols(ctx->libc);
+    elf_image_close(ctx->libc->elf);
+    free_se_list(ctx->libstdcxx->se_head);
+    free_static_symbols(ctx->libstdcxx);
+    elf_image_close(ctx->libstdcxx->elf);
+    free(ctx->libstdcxx->path);
+    free_se_list(ctx->allocator->se_head);
+    free_static_symbols(ctx->allocator);
+    elf_image_close(ctx->allocator->elf);
+    free(ctx->allocator->path);
+    free_source_cache(ctx);
     free(ctx->target);
     free(ctx->libc);
+    free(ctx->libstdcxx);
+    free(ctx->allocator);
 
     free(ctx->hlm.warnings);
+    free_callsites(ctx);
+    free(ctx->size_batch);
+    free_leak_stats(ctx);
+    free_heapcheck(ctx);
+    free_bins(ctx);
 
     free(ctx);
 }
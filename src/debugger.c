@@ -17,19 +17,88 @@
 #include "proc.h"
 #include "main.h"
 #include "user-breakpoint.h"
+#include "cache.h"
+#include "startup.h"
+#include "allocator.h"
 
 static int in_breakpoint = 0;
+static Breakpoint *catcher = 0; // the pending return catcher, if any
+
+// time spent in each phase of startup analysis, reported with --debug
+typedef enum StartupPhase {
+    STARTUP_TARGET_SYMBOLS,
+    STARTUP_PROC_MAPS,
+    STARTUP_LIBC_SYMBOLS,
+    STARTUP_LIBC_VERSION,
+    STARTUP_FUNCID,
+    STARTUP_BREAKPOINTS,
+    STARTUP_PHASES
+} StartupPhase;
+
+static const char *STARTUP_PHASE_NAMES[STARTUP_PHASES] = {"target symbols", "memory maps", "libc symbols", "libc version", "funcid", "breakpoints"};
+static double startup_ms[STARTUP_PHASES];
+static struct timespec startup_begin;
+static struct timespec phase_begin;
+
+static inline void _phase_start() {
+    clock_gettime(CLOCK_MONOTONIC, &phase_begin);
+}
+
+static inline void _phase_end(StartupPhase phase) {
+    startup_ms[phase] += ms_since(&phase_begin);
+}
 
 int OPT_FOLLOW_FORK = 0;
 
+// disarms (or re-arms) the allocator functions operator new/delete were seen 
+// calling, so that calls nothing is logged for don't stop the tracee
+static void _arm_inner_breakpoints(HeaptraceContext *ctx, int arm) {
+    for (int i = 0; i < ctx->breakpoints_sz; i++) {
+        Breakpoint *bp = ctx->breakpoints[i];
+        if (bp && bp->_inner) {
+            PTRACE(PTRACE_POKEDATA, ctx->pid, bp->addr, arm ? ((uint64_t)bp->orig_data & ~((uint64_t)0xff)) | ((uint64_t)'\xcc' & (uint64_t)0xff) : (uint64_t)bp->orig_data);
+        }
+    }
+}
+
+
+// the hooked function was left by an exception (e.g. operator new throwing 
+// std::bad_alloc), so its return catcher will never be hit. Without this, 
+// nothing would be logged for the rest of the run.
+static void _abandon_catcher(HeaptraceContext *ctx) {
+    Breakpoint *orig_bp = catcher->_bp;
+    debug("%s was unwound by an exception, removing its return catcher\n", orig_bp->name);
+
+    ctx->h_when = UBP_WHEN_AFTER;
+    ctx->hlm.ret_options = 0;
+    concat_note(insert_note(ctx), "threw an exception");
+    print_handler_log_message_2(ctx);
+
+    _remove_breakpoint(ctx, catcher, BREAKPOINT_OPTS_ALL);
+    if (orig_bp->wrapper) _arm_inner_breakpoints(ctx, 1);
+    orig_bp->_is_inside = 0;
+    catcher = 0;
+    in_breakpoint = 0;
+    ctx->between_pre_and_post = 0;
+}
+
+
+// operator new allocates the std::bad_alloc it throws while its return 
+// catcher is pending. Dropping the catcher here, rather than when the 
+// exception is caught, gets the exception's own malloc logged.
+static void _pre_cxa_allocate_exception(HeaptraceContext *ctx) {
+    if (catcher) _abandon_catcher(ctx);
+}
+
 void _check_breakpoints(HeaptraceContext *ctx) {
     struct user_regs_struct regs;
     PTRACE(PTRACE_GETREGS, ctx->pid, NULL, &regs);
     uint64_t reg_rip = (uint64_t)regs.rip - 1;
+    uint64_t reg_args[6] = {regs.rdi, regs.rsi, regs.rdx, regs.rcx, regs.r8, regs.r9};
 
     int _was_bp = 0;
 
-    for (int i = 0; i < BREAKPOINTS_COUNT; i++) {
+    for (int i = 0; i < ctx->breakpoints_sz; i++) {
         Breakpoint *bp = ctx->breakpoints[i];
         if (bp) {
             if (bp->addr == reg_rip) { // hit the breakpoint
@@ -40,6 +109,25 @@ void _check_breakpoints(HeaptraceContext *ctx) {
                 regs.rip = reg_rip; // NOTE: this is actually $rip-1
                 PTRACE(PTRACE_SETREGS, ctx->pid, NULL, &regs);
                 
+                uint64_t arg0 = reg_args[bp->args[0]];
+                uint64_t arg1 = reg_args[bp->args[1]];
+                uint64_t arg2 = reg_args[bp->args[2]];
+
+                if (bp->nested) {
+                    ((void(*)(HeaptraceContext *, uint64_t, uint64_t, uint64_t))bp->pre_handler)(ctx, arg0, arg1, arg2);
+
+                    // step over the original instruction and re-arm
+                    PTRACE(PTRACE_SINGLESTEP, ctx->pid, NULL, NULL);
+                    wait(NULL);
+                    PTRACE(PTRACE_POKEDATA, ctx->pid, reg_rip, ((uint64_t)bp->orig_data & ~((uint64_t)0xff)) | ((uint64_t)'\xcc' & (uint64_t)0xff));
+                    continue;
+                }
+
+                // a function called from above the pending one's frame means 
+                // that frame is gone, even if __cxa_allocate_exception isn't 
+                // hooked
+                if (catcher && !bp->_bp && regs.rsp > catcher->_ret_slot) _abandon_catcher(ctx);
+
                 ctx->h_when = UBP_WHEN_BEFORE;
                 
                 if (!in_breakpoint && !bp->_is_inside) {
@@ -49,23 +137,38 @@ void _check_breakpoints(HeaptraceContext *ctx) {
                         ctx->hlm.func_name = bp->func_name;
                         ctx->hlm.ret_options = bp->ret_options;
                         if (ctx->hlm.func_name) memcpy(ctx->hlm.arg_options, bp->arg_options, sizeof(uint) * 3);
-                        ctx->hlm.arg_ptr[0] = regs.rdi;
-                        ctx->hlm.arg_ptr[1] = regs.rsi;
-                        ctx->hlm.arg_ptr[2] = regs.rdx;
+                        ctx->hlm.arg_ptr[0] = arg0;
+                        ctx->hlm.arg_ptr[1] = arg1;
+                        ctx->hlm.arg_ptr[2] = arg2;
                         ctx->between_pre_and_post = bp->func_name;
                         print_handler_log_message_1(ctx);
                         if (nargs == 0) {
                             ((void(*)(HeaptraceContext *))bp->pre_handler)(ctx);
                         } else if (nargs == 1) {
-                            ((void(*)(HeaptraceContext *, uint64_t))bp->pre_handler)(ctx, regs.rdi);
+                            ((void(*)(HeaptraceContext *, uint64_t))bp->pre_handler)(ctx, arg0);
                         } else if (nargs == 2) {
-                            ((void(*)(HeaptraceContext *, uint64_t, uint64_t))bp->pre_handler)(ctx, regs.rdi, regs.rsi);
+                            ((void(*)(HeaptraceContext *, uint64_t, uint64_t))bp->pre_handler)(ctx, arg0, arg1);
                         } else if (nargs == 3) {
-                            ((void(*)(HeaptraceContext *, uint64_t, uint64_t, uint64_t))bp->pre_handler)(ctx, regs.rdi, regs.rsi, regs.rdx);
+                            ((void(*)(HeaptraceContext *, uint64_t, uint64_t, uint64_t))bp->pre_handler)(ctx, arg0, arg1, arg2);
                         } else {
                             ASSERT(0, "nargs is only supported up to 3 args; ignoring bp pre_handler. Please report this!");
                         }
 
+                        if (ctx->h_set_args) {
+                            // the handler changed the arguments the function will see
+                            for (int j = 0; j < 3; j++) {
+                                if (ctx->h_set_args & (1 << j)) reg_args[bp->args[j]] = ctx->h_new_args[j];
+                            }
+                            regs.rdi = reg_args[0];
+                            regs.rsi = reg_args[1];
+                            regs.rdx = reg_args[2];
+                            regs.rcx = reg_args[3];
+                            regs.r8 = reg_args[4];
+                            regs.r9 = reg_args[5];
+                            PTRACE(PTRACE_SETREGS, ctx->pid, NULL, &regs);
+                            ctx->h_set_args = 0;
+                        }
+
                         color_log(COLOR_ERROR_BOLD); // this way any errors inside func are bold red
                     }
                 }
@@ -86,12 +189,10 @@ void _check_breakpoints(HeaptraceContext *ctx) {
 
                             if (bp->post_handler) {
                                 uint64_t val_at_reg_rsp = (uint64_t)ptrace(PTRACE_PEEKDATA, ctx->pid, regs.rsp, NULL);
+                                ctx->h_ret_ptr = val_at_reg_rsp; // needed for --callsites and jsonl "caller"
                                 if (OPT_VERBOSE) {
-                                    ProcMapsEntry *pme = pme_find_addr(ctx->pme_head, val_at_reg_rsp);
-                                    if (pme) {
-                                        ctx->h_ret_ptr_section_type = pme->pet;
-                                        ctx->h_ret_ptr = val_at_reg_rsp;
-                                    }
+                                    ProcMapsEntry *pme = pme_find_addr(ctx->proc_maps, val_at_reg_rsp);
+                                    ctx->h_ret_ptr_section_type = pme ? pme->pet : PROCELF_TYPE_UNKNOWN;
                                 }
 
                                 // install return value catcher breakpoint
@@ -102,27 +203,39 @@ void _check_breakpoints(HeaptraceContext *ctx) {
                                 bp2->post_handler = 0;
                                 install_breakpoint(ctx, bp2);
                                 bp2->_bp = bp;
+                                bp2->_ret_slot = regs.rsp;
+                                catcher = bp2;
+                                if (bp->wrapper) _arm_inner_breakpoints(ctx, 0);
                             } else {
                                 // we don't need a return catcher, so no way to track being inside func
                                 in_breakpoint = 0;
                             }
                         }
 
-                        // reinstall original breakpoint
-                        PTRACE(PTRACE_POKEDATA, ctx->pid, reg_rip, ((uint64_t)bp->orig_data & ~((uint64_t)0xff)) | ((uint64_t)'\xcc' & (uint64_t)0xff));
+                        if (catcher && bp != catcher->_bp && bp->post_handler && ((Breakpoint *)catcher->_bp)->wrapper) {
+                            // called by operator new/delete: leave it disarmed 
+                            // until they return, and disarm it up front next time
+                            bp->_inner = 1;
+                        } else {
+                            // reinstall original breakpoint
+                            PTRACE(PTRACE_POKEDATA, ctx->pid, reg_rip, ((uint64_t)bp->orig_data & ~((uint64_t)0xff)) | ((uint64_t)'\xcc' & (uint64_t)0xff));
+                        }
                     } else { // this is a return value catcher breakpoint
                         Breakpoint *orig_bp = bp->_bp;
                         if (orig_bp) {
                             ctx->h_when = UBP_WHEN_AFTER;
+                            ctx->hlm.ret_ptr = regs.rax; // post handlers may override it
                             if (orig_bp->post_handler) {
                                 ((void(*)(HeaptraceContext *, uint64_t))orig_bp->post_handler)(ctx, regs.rax);
+                                heapcheck_after_op(ctx);
                             }
                             ctx->h_when = UBP_WHEN_AFTER;
-                            ctx->hlm.ret_ptr = regs.rax;
                             print_handler_log_message_2(ctx);
                             check_should_break(ctx);
                             _remove_breakpoint(ctx, bp, BREAKPOINT_OPTS_ALL);
+                            if (orig_bp->wrapper) _arm_inner_breakpoints(ctx, 1);
                             orig_bp->_is_inside = 0;
+                            catcher = 0;
                         } else {
                             // we never installed a return value catcher breakpoint!
                             bp->_is_inside = 0;
@@ -140,61 +253,72 @@ void _check_breakpoints(HeaptraceContext *ctx) {
 }
 
 
+// resolves ctx->se_names in the first mapped library whose path contains 
+// `needle`, if there is one
+static ProcMapsEntry *_analyze_library(HeaptraceContext *ctx, HeaptraceFile *hf, const char *needle) {
+    ProcMapsEntry *pme = pme_find_name(ctx->proc_maps, needle);
+    if (!pme) return 0;
+
+    hf->path = strdup(pme->name);
+    _phase_start();
+    if (!cache_load(hf, ctx->se_names, 0)) {
+        lookup_symbols(hf, ctx->se_names);
+        cache_store(hf, 0);
+    }
+    _phase_end(STARTUP_LIBC_SYMBOLS);
+    return pme;
+}
+
+
+// returns the symbol if hf exports a definition of it
+static SymbolEntry *_find_defined_se(HeaptraceFile *hf, char *name) {
+    SymbolEntry *se = find_se_name(hf->se_head, name);
+    return (se && se->type == SE_TYPE_STATIC && se->offset) ? se : 0;
+}
+
+
 static uint calculate_bp_addrs(HeaptraceContext *ctx, Breakpoint **bps) {
     uint show_banner = 0;
-    ProcMapsEntry *bin_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_BINARY);
+    ProcMapsEntry *bin_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_BINARY);
     ASSERT(bin_pme, "calculate_bp_addrs: target binary is missing from process mappings (!bin_pme). Please report this!");
 
     // if glibc exists, lookup symbols
-    ProcMapsEntry *libc_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_LIBC);
-    if (libc_pme) {
-        ctx->libc->path = libc_pme->name;
-
-        // prefix all se_names with "__libc_"
-        int i = 0;
-        int arr_len = 10;
-        char **arr = malloc(sizeof(char *) * arr_len);
-        while (1) {
-            if (!ctx->se_names[i]) break;
-            if (!arr || i >= arr_len) {
-                arr_len *= 2;
-                arr = (char **)(realloc(arr, sizeof(char *) * arr_len));
-            }
-            size_t str1_len = 7; // strlen("__libc_");
-            size_t str2_len = strlen(ctx->se_names[i]);
-            char *se_name = malloc(str1_len + str2_len + 1);
-            memcpy(se_name, "__libc_", str1_len);
-            memcpy(se_name + str1_len, ctx->se_names[i], str2_len + 1);
-            arr[i] = se_name;
-            i++;
-        }
-        arr[i] = NULL;
-        lookup_symbols(ctx->libc, arr);
-        
-        // free temp sym array
-        i = 0;
-        char *buf;
-        while ((buf = arr[i++]), buf) free(buf);
-        free(arr);
-
-        // remove "__libc_" prefix
-        SymbolEntry *cse = ctx->libc->se_head;
-        while (cse) {
-            char *old_name = cse->name;
-            cse->name = strdup(cse->name + 7); // 7 == strlen("__libc_")
-            if (!cse->offset) {
-                cse->type = SE_TYPE_UNRESOLVED;
-            }
-            free(old_name);
-            cse = cse->_next;
+    ProcMapsEntry *libc_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_LIBC);
+    if (libc_pme && !ctx->libc->from_cache) {
+        if (!ctx->libc->analyzed) {
+            // not already done by a startup worker (see startup.c)
+            ctx->libc->path = libc_pme->name;
+            _phase_start();
+            lookup_libc_symbols(ctx->libc, ctx->se_names);
+            _phase_end(STARTUP_LIBC_SYMBOLS);
         }
         
         // find function signatures in case it's stripped
         ASSERT(ctx->libc, "ctx->libc is NULL. Please report this!");
-        show_banner |= evaluate_funcid(ctx->libc);
+        _phase_start();
+        show_banner |= evaluate_funcid(ctx->libc, 0);
+        _phase_end(STARTUP_FUNCID);
+        cache_store(ctx->libc, ctx->libc_version);
     }
 
-    show_banner |= evaluate_funcid(ctx->target);
+    // the C++ operators are defined in libstdc++, not in libc
+    ProcMapsEntry *cxx_pme = _analyze_library(ctx, ctx->libstdcxx, "/libstdc++");
+
+    // and a non-glibc allocator's library comes before both
+    ProcMapsEntry *alloc_pme = ALLOCATOR->library ? _analyze_library(ctx, ctx->allocator, ALLOCATOR->library) : 0;
+    if (alloc_pme) {
+        verbose("Using the %s allocator (%s)\n", ALLOCATOR->name, alloc_pme->name);
+    } else if (ALLOCATOR->library) {
+        debug("no library matching \"%s\" is mapped, looking for %s in the target\n", ALLOCATOR->library, ALLOCATOR->name);
+    }
+
+    if (!ctx->target->from_cache) {
+        // a dynamic target's heap calls go to libc when libc defines them
+        _phase_start();
+        show_banner |= evaluate_funcid(ctx->target, (ctx->target->is_dynamic && libc_pme) ? ctx->libc : 0);
+        _phase_end(STARTUP_FUNCID);
+        cache_store(ctx->target, 0);
+    }
 
     int i = 0;
     Breakpoint *bp;
@@ -209,12 +333,25 @@ static uint calculate_bp_addrs(HeaptraceContext *ctx, Breakpoint **bps) {
             //debug("libc %s: %s 0x%x (type=%d)\n", ctx->libc_path, libc_se->name, libc_se->offset, libc_se->type);
         }
 
+        SymbolEntry *cxx_se = cxx_pme ? _find_defined_se(ctx->libstdcxx, bp->name) : 0;
+        SymbolEntry *alloc_se = alloc_pme ? _find_defined_se(ctx->allocator, bp->name) : 0;
+
         uint64_t addr = 0;
 
-        if (ctx->target->is_dynamic && libc_pme && libc_se && libc_se->offset) {
+        if (alloc_se) {
+            addr = alloc_pme->base + alloc_se->offset;
+            debug(". used %s addr " U64T "\n", ALLOCATOR->name, addr);
+        } else if (ALLOCATOR->library && !alloc_pme && target_se->type == SE_TYPE_STATIC && target_se->offset) {
+            // the allocator is linked into the target, which then comes first
+            addr = bin_pme->base + target_se->offset;
+            debug(". used static %s addr " U64T "\n", ALLOCATOR->name, addr);
+        } else if (ctx->target->is_dynamic && libc_pme && libc_se && libc_se->offset) {
             // prioritize the libc symbols over target's symbols
             addr = libc_pme->base + libc_se->offset;
             debug(". used dynamic libc addr " U64T "\n", addr);
+        } else if (ctx->target->is_dynamic && cxx_se) {
+            addr = cxx_pme->base + cxx_se->offset;
+            debug(". used dynamic libstdc++ addr " U64T "\n", addr);
         } else if (target_se->type == SE_TYPE_STATIC) {
             // static symbol in ELF
             addr = bin_pme->base + target_se->offset;
@@ -246,52 +383,61 @@ static uint calculate_bp_addrs(HeaptraceContext *ctx, Breakpoint **bps) {
 }
 
 
-// attempts to identify functions in stripped ELFs (bin_pme->base only, not libc)
-uint evaluate_funcid(HeaptraceFile *hf) {
+// attempts to identify heap functions in stripped ELFs. Only functions that 
+// are still unresolved in hf (and, if `provider` is given, in the file the 
+// calls will be routed to instead) are searched for; if there are none, the 
+// file is not even opened.
+uint evaluate_funcid(HeaptraceFile *hf, HeaptraceFile *provider) {
     uint show_banner = 0;
     int _printed_debug = 0;
-    FILE *f = fopen(hf->path, "r");
-    FunctionSignature *sigs = find_function_signatures(f);
-    for (int i = 0; i < 5; i++) {
+
+    FunctionSignature sigs[FUNCID_FUNCS];
+    SymbolEntry *sig_ses[FUNCID_FUNCS];
+    int sigs_sz = 0;
+    for (SymbolEntry *se = hf->se_head; se && sigs_sz < FUNCID_FUNCS; se = se->_next) {
+        if (se->type != SE_TYPE_UNRESOLVED || !is_funcid_function(se->name)) continue;
+        if (provider) {
+            SymbolEntry *provider_se = find_se_name(provider->se_head, se->name);
+            if (provider_se && provider_se->type != SE_TYPE_UNRESOLVED && provider_se->offset) continue;
+        }
+        sigs[sigs_sz].name = se->name;
+        sigs[sigs_sz].offset = 0;
+        sig_ses[sigs_sz++] = se;
+    }
+
+    if (!sigs_sz) {
+        debug("funcid skipped for %s: heap symbols are already resolved\n", hf->path);
+        return 0;
+    }
+
+    int found = find_function_signatures(get_file_image(hf), sigs, sigs_sz);
+    if (found <= 0) return 0;
+
+    for (int i = 0; i < sigs_sz; i++) {
         FunctionSignature *sig = &sigs[i];
-        //printf("(2) -> %s (%p) - %x (%p)\n", sig->name, sig, sig->offset, sig->offset);
-        if (sig->offset) {
-            uint64_t ptr = sig->offset;
-            int j = 0;
-            SymbolEntry *se = hf->se_head;
-            while (se) {
-                if (se->type != SE_TYPE_UNRESOLVED) {
-                    se = se->_next;
-                    continue;
-                }
-                if (!strcmp(sig->name, se->name)) {
-                    if (!_printed_debug) {
-                        _printed_debug = 1;
-                        info("Attempting to identify function signatures in ");
-                        color_log(COLOR_LOG_BOLD);
-                        log("%s", hf->path);
-                        color_log(COLOR_LOG); 
-                        log("...\n");
-                        show_banner = 1;
-                    }
-                    info("* found ");
-                    color_log(COLOR_LOG_BOLD);
-                    log("%s", sig->name);
-                    color_log(COLOR_LOG);
-                    log(" at " PTR ".\n", PTR_ARG(sig->offset));
-                    color_log(COLOR_RESET);
-                    se->offset = ptr;
-                    se->_sub_offset = 0;
-                    se->type = SE_TYPE_STATIC; // to make sure it gets resolved as bin_base+addr
-                    break;
-                }
-                se = se->_next;
-            }
+        SymbolEntry *se = sig_ses[i];
+        if (!sig->offset) continue;
+
+        if (!_printed_debug) {
+            _printed_debug = 1;
+            info("Attempting to identify function signatures in ");
+            color_log(COLOR_LOG_BOLD);
+            log("%s", hf->path);
+            color_log(COLOR_LOG); 
+            log("...\n");
+            show_banner = 1;
         }
+        info("* found ");
+        color_log(COLOR_LOG_BOLD);
+        log("%s", sig->name);
+        color_log(COLOR_LOG);
+        log(" at " PTR ".\n", PTR_ARG(sig->offset));
+        color_log(COLOR_RESET);
+        se->offset = sig->offset;
+        se->_sub_offset = 0;
+        se->type = SE_TYPE_STATIC; // to make sure it gets resolved as bin_base+addr
     }
 
-    if (sigs) free(sigs);
-    fclose(f);
     return show_banner;
 }
 
@@ -299,6 +445,11 @@ uint evaluate_funcid(HeaptraceFile *hf) {
 void end_debugger(HeaptraceContext *ctx, int should_detach) {
     if (ctx == FIRST_CTX) FIRST_CTX = 0; // prevent race condition on free()
     ctx->h_state = PROCESS_STATE_STOPPED;
+    flush_chunk_sizes(ctx); // only works if the tracee is still around, e.g. after a segfault
+    uaf_check_all(ctx);
+    redzone_check_all(ctx);
+    heapcheck_at_exit(ctx);
+    leak_scan(ctx);
 
     uint _was_sigsegv = 0;
     uint _show_newline = 0;
@@ -346,6 +497,7 @@ void end_debugger(HeaptraceContext *ctx, int should_detach) {
 
     if (_show_newline) log("\n");
 
+    if (in_breakpoint) print_handler_log_message_pending(ctx);
     show_stats(ctx);
 
     if (_was_sigsegv) {
@@ -362,34 +514,52 @@ void end_debugger(HeaptraceContext *ctx, int should_detach) {
         kill(ctx->pid, SIGINT);
     }
 
+    cancel_startup_workers();
     free_ctx(ctx);
     free_user_breakpoints();
     exit(0);
 }
 
 
-char *get_libc_version(char *libc_path) {
-    FILE *f = fopen(libc_path, "r");
-    if (!f) return 0;
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char *string = malloc(fsize + 1);
-    fread(string, 1, fsize, f);
-    fclose(f);
-    string[fsize] = 0;
+// parses "<banner> version 2.33.\n" out of data. The banner is anchored on 
+// "GNU C Library" when present so unrelated " version " strings are skipped.
+static char *_find_libc_version(char *data, size_t sz) {
+    char *end = data + sz;
+    char *_banner = memmem(data, sz, "GNU C Library", 13);
+    if (_banner) data = _banner;
 
     char *_prefix = " version ";
-    char *_version = memmem(string, fsize, _prefix, strlen(_prefix));
+    char *_version = memmem(data, end - data, _prefix, strlen(_prefix));
     if (!_version) return 0;
     _version += strlen(_prefix);
-    char *_period = strstr(_version, ".\n");
+    char *_period = memmem(_version, strnlen(_version, end - _version), ".\n", 2);
     if (!_period) return 0;
-    *_period = '\x00';
 
-    char *version = strdup(_version);
-    free(string);
-    return version;
+    return strndup(_version, _period - _version);
+}
+
+
+// finds the version in libc's banner ("... release version 2.33.\n"). Only 
+// .rodata is searched, or the read-only segments if there are no section 
+// headers; the whole file is the last resort.
+char *get_libc_version(ElfImage *img) {
+    if (!img) return 0;
+
+    Elf64_Shdr *rodata = img->ehdr ? elf_image_section(img, ".rodata") : 0;
+    char *data = (char *)elf_image_section_data(img, rodata);
+    if (data) {
+        char *version = _find_libc_version(data, rodata->sh_size);
+        if (version) return version;
+    } else {
+        for (uint16_t i = 0; i < img->phnum; i++) {
+            Elf64_Phdr *phdr = &img->phdrs[i];
+            if (phdr->p_type != PT_LOAD || (phdr->p_flags & (PF_X | PF_W)) || !elf_image_range_ok(img, phdr->p_offset, phdr->p_filesz)) continue;
+            char *version = _find_libc_version((char *)img->bytes + phdr->p_offset, phdr->p_filesz);
+            if (version) return version;
+        }
+    }
+
+    return _find_libc_version((char *)img->bytes, img->size);
 }
 
 
@@ -405,57 +575,164 @@ void _pre_entry(HeaptraceContext *ctx) {
     ctx->h_state = PROCESS_STATE_RUNNING;
 }
 
-const struct {
+typedef struct BreakpointDef {
     char *name;
     void *pre_handler;
     size_t pre_handler_nargs;
     void *post_handler;
     uint arg_options[3];
     uint ret_options;
-} breakpoint_defs[] = {
+    int nested;
+    char *func_name; // logged instead of the symbol name, if set
+    int skip_args; // leading arguments the pre_handler doesn't take
+    int wrapper;
+} BreakpointDef;
+
+const BreakpointDef breakpoint_defs[] = {
     {"malloc", pre_malloc, 1, post_malloc, {HLM_OPTION_SIZE, 0, 0}, 1},
     {"calloc", pre_calloc, 2, post_calloc, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1},
     {"free", pre_free, 1, post_free, {HLM_OPTION_SYMBOL, 0, 0}, 0},
     {"realloc", pre_realloc, 2, post_realloc, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 1},
-    {"reallocarray", pre_reallocarray, 3, post_reallocarray, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, HLM_OPTION_SIZE}, 1}
+    {"reallocarray", pre_reallocarray, 3, post_reallocarray, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, HLM_OPTION_SIZE}, 1},
+    {"posix_memalign", pre_posix_memalign, 3, post_posix_memalign, {HLM_OPTION_ADDRESS, HLM_OPTION_SIZE, HLM_OPTION_SIZE}, 1},
+    {"memalign", pre_memalign, 2, post_memalign, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1},
+    {"aligned_alloc", pre_aligned_alloc, 2, post_aligned_alloc, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1}, // an alias of memalign before glibc 2.38
+    {"valloc", pre_valloc, 1, post_valloc, {HLM_OPTION_SIZE, 0, 0}, 1},
+    {"pvalloc", pre_pvalloc, 1, post_pvalloc, {HLM_OPTION_SIZE, 0, 0}, 1},
+    {"malloc_usable_size", pre_malloc_usable_size, 1, post_malloc_usable_size, {HLM_OPTION_SYMBOL, 0, 0}, 1}
+};
+
+// C++ operators, found in libstdc++ or in a static target. The malloc or free 
+// they call is not logged separately, because nothing is while inside of a 
+// hooked function, and stops being hooked while they run once it has been 
+// seen. The nothrow and aligned forms take extra arguments after the size or 
+// pointer; only the alignment is logged.
+const BreakpointDef operator_defs[] = {
+    {"_Znwm", pre_operator_new, 1, post_operator_new, {HLM_OPTION_SIZE, 0, 0}, 1, 0, "operator new", 0, 1},
+    {"_ZnwmRKSt9nothrow_t", pre_operator_new, 1, post_operator_new, {HLM_OPTION_SIZE, 0, 0}, 1, 0, "operator new", 0, 1},
+    {"_ZnwmSt11align_val_t", pre_operator_new_aligned, 2, post_operator_new, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1, 0, "operator new", 0, 1},
+    {"_ZnwmSt11align_val_tRKSt9nothrow_t", pre_operator_new_aligned, 2, post_operator_new, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1, 0, "operator new", 0, 1},
+    {"_Znam", pre_operator_new_array, 1, post_operator_new, {HLM_OPTION_SIZE, 0, 0}, 1, 0, "operator new[]", 0, 1},
+    {"_ZnamRKSt9nothrow_t", pre_operator_new_array, 1, post_operator_new, {HLM_OPTION_SIZE, 0, 0}, 1, 0, "operator new[]", 0, 1},
+    {"_ZnamSt11align_val_t", pre_operator_new_array_aligned, 2, post_operator_new, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1, 0, "operator new[]", 0, 1},
+    {"_ZnamSt11align_val_tRKSt9nothrow_t", pre_operator_new_array_aligned, 2, post_operator_new, {HLM_OPTION_SIZE, HLM_OPTION_SIZE, 0}, 1, 0, "operator new[]", 0, 1},
+    {"_ZdlPv", pre_operator_delete, 1, post_free, {HLM_OPTION_SYMBOL, 0, 0}, 0, 0, "operator delete", 0, 1},
+    {"_ZdlPvm", pre_operator_delete_sized, 2, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 0, 0, "operator delete", 0, 1},
+    {"_ZdlPvSt11align_val_t", pre_operator_delete, 1, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 0, 0, "operator delete", 0, 1},
+    {"_ZdlPvmSt11align_val_t", pre_operator_delete_sized, 2, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, HLM_OPTION_SIZE}, 0, 0, "operator delete", 0, 1},
+    {"_ZdlPvRKSt9nothrow_t", pre_operator_delete, 1, post_free, {HLM_OPTION_SYMBOL, 0, 0}, 0, 0, "operator delete", 0, 1},
+    {"_ZdlPvSt11align_val_tRKSt9nothrow_t", pre_operator_delete, 1, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 0, 0, "operator delete", 0, 1},
+    {"_ZdaPv", pre_operator_delete_array, 1, post_free, {HLM_OPTION_SYMBOL, 0, 0}, 0, 0, "operator delete[]", 0, 1},
+    {"_ZdaPvm", pre_operator_delete_array_sized, 2, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 0, 0, "operator delete[]", 0, 1},
+    {"_ZdaPvSt11align_val_t", pre_operator_delete_array, 1, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 0, 0, "operator delete[]", 0, 1},
+    {"_ZdaPvmSt11align_val_t", pre_operator_delete_array_sized, 2, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, HLM_OPTION_SIZE}, 0, 0, "operator delete[]", 0, 1},
+    {"_ZdaPvRKSt9nothrow_t", pre_operator_delete_array, 1, post_free, {HLM_OPTION_SYMBOL, 0, 0}, 0, 0, "operator delete[]", 0, 1},
+    {"_ZdaPvSt11align_val_tRKSt9nothrow_t", pre_operator_delete_array, 1, post_free, {HLM_OPTION_SYMBOL, HLM_OPTION_SIZE, 0}, 0, 0, "operator delete[]", 0, 1},
+    {"__cxa_allocate_exception", _pre_cxa_allocate_exception, 0, 0, {0, 0, 0}, 0, 1} // only to notice exceptions
 };
 
+// only with --trace-mmap. glibc's malloc calls these wrappers for large chunks 
+// and to grow the heap. sbrk is hooked instead of brk because it is what 
+// malloc uses and because older glibcs implement it by calling brk.
+const BreakpointDef addrspace_defs[] = {
+    {"mmap", pre_mmap, 1, 0, {0, 0, 0}, 0, 1, 0, 1}, // length
+    {"munmap", pre_munmap, 1, 0, {0, 0, 0}, 0, 1, 0, 1}, // length
+    {"mremap", pre_mremap, 2, 0, {0, 0, 0}, 0, 1, 0, 1}, // old_len, new_len
+    {"sbrk", pre_sbrk, 1, 0, {0, 0, 0}, 0, 1}
+};
+
+
+static Breakpoint *_create_breakpoint(const BreakpointDef *def) {
+    Breakpoint *bp = (Breakpoint *)calloc(1, sizeof(struct Breakpoint));
+    bp->name = def->name;
+    bp->pre_handler = def->pre_handler;
+    bp->pre_handler_nargs = def->pre_handler_nargs;
+    bp->post_handler = def->post_handler;
+    bp->nested = def->nested;
+    bp->wrapper = def->wrapper;
+
+    // for HLM logging
+    bp->func_name = def->func_name ? def->func_name : def->name;
+    bp->ret_options = def->ret_options;
+    memcpy(bp->arg_options, def->arg_options, sizeof(def->arg_options));
+    for (int i = 0; i < 3; i++) bp->args[i] = def->skip_args + i;
+    return bp;
+}
+
+
+// an extra symbol from the allocator profile, handled like def
+static Breakpoint *_create_allocator_breakpoint(const BreakpointDef *def, AllocatorEntry *entry) {
+    Breakpoint *bp = _create_breakpoint(def);
+    bp->name = entry->symbol;
+    bp->func_name = entry->symbol;
+    memcpy(bp->args, entry->args, sizeof(entry->args));
+    return bp;
+}
+
 void pre_analysis(HeaptraceContext *ctx) {
-    int breakpoint_defs_c = sizeof(breakpoint_defs) / sizeof(breakpoint_defs[0]);
+    struct { const BreakpointDef *defs; int defs_c; } tables[] = {
+        {breakpoint_defs, sizeof(breakpoint_defs) / sizeof(breakpoint_defs[0])},
+        {operator_defs, sizeof(operator_defs) / sizeof(operator_defs[0])},
+        {addrspace_defs, OPT_TRACE_MMAP ? sizeof(addrspace_defs) / sizeof(addrspace_defs[0]) : 0}
+    };
+    int tables_c = sizeof(tables) / sizeof(tables[0]);
+    int bps_c = ALLOCATOR->entries_sz;
+    for (int t = 0; t < tables_c; t++) bps_c += tables[t].defs_c;
     size_t ubp_sym_refs_c = count_symbol_references((char **)0);
 
-    Breakpoint **bps = (Breakpoint **)calloc(breakpoint_defs_c + 1, sizeof(Breakpoint *));
+    Breakpoint **bps = (Breakpoint **)calloc(bps_c + 1, sizeof(Breakpoint *));
     ctx->pre_analysis_bps = bps;
 
-    size_t se_names_sz = sizeof(char *) * (breakpoint_defs_c + ubp_sym_refs_c + 1);
+    size_t se_names_sz = sizeof(char *) * (bps_c + ubp_sym_refs_c + 1);
     char **se_names = (char **)malloc(se_names_sz);
     ctx->se_names = se_names;
 
 
-    bps[breakpoint_defs_c] = NULL;
-    count_symbol_references(&(ctx->se_names[breakpoint_defs_c]));
-    ctx->se_names[breakpoint_defs_c + ubp_sym_refs_c] = NULL;
+    bps[bps_c] = NULL;
+    count_symbol_references(&(ctx->se_names[bps_c]));
+    ctx->se_names[bps_c + ubp_sym_refs_c] = NULL;
 
-    Breakpoint *bp;
-    for (int i = 0; i < breakpoint_defs_c; i++) {
-        ctx->se_names[i] = breakpoint_defs[i].name;
-        bp = (Breakpoint *)calloc(1, sizeof(struct Breakpoint));
-        bp->name = breakpoint_defs[i].name;
-        bp->pre_handler = breakpoint_defs[i].pre_handler;
-        bp->pre_handler_nargs = breakpoint_defs[i].pre_handler_nargs;
-        bp->post_handler = breakpoint_defs[i].post_handler;
-
-        // for HLM logging
-        bp->func_name = breakpoint_defs[i].name;
-        bp->ret_options = breakpoint_defs[i].ret_options;
-        //bp->arg_options = calloc(sizeof(breakpoint_defs[i].arg_options) + 1);
-        memcpy(bp->arg_options, breakpoint_defs[i].arg_options, sizeof(breakpoint_defs[i].arg_options));
-
-        bps[i] = bp;
+    int i = 0;
+    for (int t = 0; t < tables_c; t++) {
+        for (int j = 0; j < tables[t].defs_c; j++, i++) {
+            ctx->se_names[i] = tables[t].defs[j].name;
+            bps[i] = _create_breakpoint(&tables[t].defs[j]);
+        }
     }
-    
+
+    int breakpoint_defs_c = tables[0].defs_c;
+    for (size_t j = 0; j < ALLOCATOR->entries_sz; j++, i++) {
+        AllocatorEntry *entry = &ALLOCATOR->entries[j];
+        const BreakpointDef *def = 0;
+        for (int k = 0; k < breakpoint_defs_c && !def; k++) {
+            if (!strcmp(breakpoint_defs[k].name, entry->func)) def = &breakpoint_defs[k];
+        }
+        ASSERT(def, "allocator function %s has no breakpoint def. Please report this!", entry->func);
+        ctx->se_names[i] = entry->symbol;
+        bps[i] = _create_allocator_breakpoint(def, entry);
+    }
+}
+
+
+// resolves ctx->se_names in the target, unless the startup worker already 
+// did so for this exact file
+static void _analyze_target(HeaptraceContext *ctx) {
     debug("Looking up symbols...\n");
-    lookup_symbols(ctx->target, ctx->se_names);
+    _phase_start();
+    if (!join_target_worker(ctx) && !cache_load(ctx->target, ctx->se_names, 0)) {
+        lookup_symbols(ctx->target, ctx->se_names);
+    }
+    _phase_end(STARTUP_TARGET_SYMBOLS);
+}
+
+
+static void _show_startup_timings() {
+    if (!OPT_DEBUG) return;
+    // the total includes starting the tracee and running it up to its entry point
+    debug("startup took %.2f ms:", ms_since(&startup_begin));
+    for (int i = 0; i < STARTUP_PHASES; i++) {
+        debug2(" %s %.2f ms%s", STARTUP_PHASE_NAMES[i], startup_ms[i], i + 1 < STARTUP_PHASES ? "," : "\n");
+    }
 }
 
 
@@ -464,23 +741,32 @@ uint map_syms(HeaptraceContext *ctx) {
     uint show_banner = 0;
 
     // parse /proc/pid/maps
-    if (!ctx->pme_head) ctx->pme_head = build_pme_list(ctx->pid); // already built if attaching
-    ProcMapsEntry *bin_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_BINARY);
-    ProcMapsEntry *libc_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_LIBC);
+    _phase_start();
+    if (!ctx->proc_maps) ctx->proc_maps = build_proc_maps(ctx->pid); // already built if attaching
+    ProcMapsEntry *bin_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_BINARY);
+    ProcMapsEntry *libc_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_LIBC);
     ctx->target->pme = bin_pme;
     ctx->libc->pme = libc_pme;
+    _phase_end(STARTUP_PROC_MAPS);
     
     // quick debug info about addresses/paths we found
     ASSERT(bin_pme, "failed to find target binary in process mapping (!bin_pme). Please report this!");
     debug("found memory maps... binary (%s): " U64T "-" U64T, bin_pme->name, bin_pme->base, bin_pme->end);
     if (libc_pme) {
         char *name = libc_pme->name;
-        ctx->libc->path = name;
         if (!name) name = "<UNKNOWN>";
         debug2(", libc (%s): " U64T "-" U64T, name, libc_pme->base, libc_pme->end);
     }
     debug2("\n");
 
+    // adopt the startup worker's libc analysis if it guessed the right file
+    _phase_start();
+    if (libc_pme) ctx->libc->path = libc_pme->name;
+    if (!join_libc_worker(ctx, libc_pme ? libc_pme->name : 0) && libc_pme) {
+        cache_load(ctx->libc, ctx->se_names, ctx->libc_version ? 0 : &ctx->libc_version);
+    }
+    _phase_end(STARTUP_LIBC_SYMBOLS);
+
     // print the type of binary etc
     ASSERT(ctx->target, "!ctx->target. Please report this.");
     color_verbose(COLOR_RESET COLOR_RESET_BOLD);
@@ -490,7 +776,10 @@ uint map_syms(HeaptraceContext *ctx) {
         verbose(" binary")
 
         if (libc_pme && libc_pme->name) {
-            char *ptr = get_libc_version(libc_pme->name);
+            char *ptr = ctx->libc_version;
+            _phase_start();
+            if (!ptr) ptr = get_libc_version(get_file_image(ctx->libc));
+            _phase_end(STARTUP_LIBC_VERSION);
             char *libc_version = ptr;
             if (!ptr) libc_version = "???";
             verbose(" using glibc version %s (%s)\n", libc_version, libc_pme->name);
@@ -511,13 +800,26 @@ uint map_syms(HeaptraceContext *ctx) {
     evaluate_symbol_defs(ctx, ctx->pre_analysis_bps);
 
     // install breakpoints
+    _phase_start();
     int k = 0;
     Breakpoint *bp;
     while (1) {
         bp = (ctx->pre_analysis_bps)[k++];
         if (!bp) break;
+
+        // aliases (e.g. memalign and aligned_alloc) are only hooked once, 
+        // under the first name
+        for (int j = 0; j < k - 1 && bp->addr; j++) {
+            if (ctx->pre_analysis_bps[j]->addr == bp->addr) {
+                debug("%s is an alias of %s, not hooking it separately\n", bp->name, ctx->pre_analysis_bps[j]->name);
+                bp->addr = 0;
+            }
+        }
         install_breakpoint(ctx, bp);
     }
+    _phase_end(STARTUP_BREAKPOINTS);
+
+    _show_startup_timings();
 
     return show_banner;
 }
@@ -564,8 +866,8 @@ void start_debugger(HeaptraceContext *ctx) {
 
     if (OPT_ATTACH_PID) {
         ctx->pid = OPT_ATTACH_PID;
-        ctx->pme_head = build_pme_list(ctx->pid);
-        ProcMapsEntry *bin_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_BINARY);
+        ctx->proc_maps = build_proc_maps(ctx->pid);
+        ProcMapsEntry *bin_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_BINARY);
         if (!bin_pme) {
             fatal("failed to find process %d's binary name. Are you sure you have the right process ID? Does heaptrace have permission to ptrace the target process?\n", OPT_ATTACH_PID);
             exit(1);
@@ -575,10 +877,20 @@ void start_debugger(HeaptraceContext *ctx) {
     }
     
 
+    pre_analysis(ctx);
+    clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+
     int show_banner = 0;
     if (!OPT_ATTACH_PID) {
         ctx->pid = start_process(ctx);
         debug("Started target process in PID %d\n", ctx->pid);
+
+        // analyze the target and the libc it will probably load while it execs
+        char *target_path = resolve_target_path(ctx->target->path);
+        char *libc_path = resolve_libc_path(target_path);
+        start_startup_workers(ctx, target_path, libc_path);
+        free(target_path);
+        free(libc_path);
     } else {
         ctx->pid = OPT_ATTACH_PID;
         info("Attaching to target process PID %d...\n", ctx->pid);
@@ -587,6 +899,9 @@ void start_debugger(HeaptraceContext *ctx) {
             exit(1);
         }
         show_banner = 1;
+
+        ProcMapsEntry *libc_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_LIBC);
+        start_startup_workers(ctx, ctx->target->path, libc_pme ? libc_pme->name : 0);
     }
 
 
@@ -599,6 +914,7 @@ void start_debugger(HeaptraceContext *ctx) {
 
     int first_run = 1;
     while(KEEP_RUNNING && waitpid(ctx->pid, &(ctx->status), 0) != -1) {
+        pme_invalidate(ctx->proc_maps); // it may have mapped something new
         struct user_regs_struct regs;
         if (ptrace(PTRACE_GETREGS, ctx->pid, NULL, &regs) != -1) {
             ctx->h_rip = regs.rip;
@@ -611,7 +927,7 @@ void start_debugger(HeaptraceContext *ctx) {
             first_run = 0;
 
             ctx->target->path = get_path_by_pid(ctx->pid);
-            pre_analysis(ctx);
+            _analyze_target(ctx);
 
             look_for_brk = ctx->target->is_dynamic;
             ctx->h_state = PROCESS_STATE_RUNNING;
@@ -694,6 +1010,14 @@ void start_debugger(HeaptraceContext *ctx) {
         } else if (ctx->status16 == PTRACE_EVENT_EXEC) {
             debug("Detected exec() call, detaching...\n");
             end_debugger(ctx, 1);
+        } else if (ctx->status16 == PTRACE_EVENT_EXIT) {
+            // last chance to read the headers of chunks that are still queued
+            debug("tracee is exiting\n");
+            flush_chunk_sizes(ctx);
+            uaf_check_all(ctx);
+            redzone_check_all(ctx);
+            heapcheck_at_exit(ctx);
+            leak_scan(ctx);
         } else {
             debug("warning: hit unknown status code %d (16: %d)\n", ctx->status, ctx->status16);
         }
@@ -715,7 +1039,7 @@ void start_debugger(HeaptraceContext *ctx) {
 
         }
 
-        PTRACE(PTRACE_SETOPTIONS, ctx->pid, NULL, PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC);
+        PTRACE(PTRACE_SETOPTIONS, ctx->pid, NULL, PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | ((OPT_REAL_SIZES || OPT_CHECK_UAF || OPT_REDZONE || OPT_LEAK_CHECK || OPT_CHECK_HEAP || OPT_CHECK_HEAP_MS) ? PTRACE_O_TRACEEXIT : 0));
         PTRACE(PTRACE_CONT, ctx->pid, NULL, NULL);
     }
 
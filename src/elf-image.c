@@ -0,0 +1,100 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elf-image.h"
+#include "logging.h"
+
+
+// maps `path` read-only. Returns 0 if it can't be opened or mapped.
+ElfImage *elf_image_open(const char *path) {
+    if (!path) return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+
+    void *bytes = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (bytes == MAP_FAILED) {
+        debug("failed to mmap %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    ElfImage *img = (ElfImage *)calloc(1, sizeof(ElfImage));
+    img->path = strdup(path);
+    img->bytes = (uint8_t *)bytes;
+    img->size = (size_t)st.st_size;
+    img->dev = st.st_dev;
+    img->ino = st.st_ino;
+    img->mtime = st.st_mtime;
+
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)img->bytes;
+    if (img->size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ehdr->e_ident[EI_CLASS] != ELFCLASS64) return img;
+    img->ehdr = ehdr;
+
+    if (ehdr->e_phnum && ehdr->e_phentsize == sizeof(Elf64_Phdr) && elf_image_range_ok(img, ehdr->e_phoff, (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr))) {
+        img->phdrs = (Elf64_Phdr *)(img->bytes + ehdr->e_phoff);
+        img->phnum = ehdr->e_phnum;
+    }
+    if (ehdr->e_shoff && ehdr->e_shnum && ehdr->e_shentsize == sizeof(Elf64_Shdr) && elf_image_range_ok(img, ehdr->e_shoff, (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr))) {
+        img->shdrs = (Elf64_Shdr *)(img->bytes + ehdr->e_shoff);
+        img->shnum = ehdr->e_shnum;
+        if (ehdr->e_shstrndx < img->shnum) {
+            Elf64_Shdr *shstrtab = &img->shdrs[ehdr->e_shstrndx];
+            if (shstrtab->sh_size && elf_image_range_ok(img, shstrtab->sh_offset, shstrtab->sh_size)) {
+                img->shstrtab = (const char *)img->bytes + shstrtab->sh_offset;
+                img->shstrtab_sz = shstrtab->sh_size;
+            }
+        }
+    }
+    return img;
+}
+
+
+void elf_image_close(ElfImage *img) {
+    if (!img) return;
+    munmap(img->bytes, img->size);
+    free(img->path);
+    free(img);
+}
+
+
+// whether [offset, offset + len) lies inside the file
+int elf_image_range_ok(ElfImage *img, uint64_t offset, uint64_t len) {
+    return offset <= img->size && len <= img->size - offset;
+}
+
+
+// the first section called `name`, or 0
+Elf64_Shdr *elf_image_section(ElfImage *img, const char *name) {
+    if (!img->shstrtab) return 0;
+    size_t name_sz = strlen(name) + 1;
+    for (uint16_t i = 0; i < img->shnum; i++) {
+        uint32_t off = img->shdrs[i].sh_name;
+        if (off < img->shstrtab_sz && name_sz <= img->shstrtab_sz - off && !memcmp(img->shstrtab + off, name, name_sz)) return &img->shdrs[i];
+    }
+    return 0;
+}
+
+
+// the first program header of the given type, or 0
+Elf64_Phdr *elf_image_segment(ElfImage *img, uint32_t type) {
+    for (uint16_t i = 0; i < img->phnum; i++) {
+        if (img->phdrs[i].p_type == type) return &img->phdrs[i];
+    }
+    return 0;
+}
+
+
+// the file contents of a section, or 0 if it has none or is out of bounds
+void *elf_image_section_data(ElfImage *img, Elf64_Shdr *shdr) {
+    if (!shdr || shdr->sh_type == SHT_NOBITS || !elf_image_range_ok(img, shdr->sh_offset, shdr->sh_size)) return 0;
+    return img->bytes + shdr->sh_offset;
+}
@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "funcid-db.h"
+#include "funcid.h"
+#include "elf-image.h"
+#include "logging.h"
+
+/*
+ * Database layout (little-endian, every section 8-byte aligned):
+ *
+ *   FuncidDbHeader
+ *   uint32_t func_names[funcs_sz]       offsets into the string table
+ *   uint32_t sources[sources_sz]        offsets into the string table
+ *   FuncidPattern patterns[patterns_sz]
+ *   uint32_t bucket_start[0x10000 + 1]
+ *   uint32_t bucket_entries[bucket_start[0x10000]]
+ *   uint32_t anywhere[anywhere_sz]
+ *   char strtab[strtab_sz]              NUL-terminated strings
+ */
+
+char *OPT_FUNCID_DB = 0;
+char *OPT_FUNCID_BUILD_DB = 0;
+
+typedef struct FuncidDbHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sig_sz; // FUNCSIG_SZ the database was built with
+    uint32_t funcs_sz;
+    uint32_t sources_sz;
+    uint32_t patterns_sz;
+    uint32_t anywhere_sz;
+    uint64_t funcs_off;
+    uint64_t sources_off;
+    uint64_t patterns_off;
+    uint64_t bucket_start_off;
+    uint64_t bucket_entries_off;
+    uint64_t anywhere_off;
+    uint64_t strtab_off;
+    uint64_t strtab_sz;
+} FuncidDbHeader;
+
+#define FUNCID_BUCKETS 0x10000
+#define FUNCID_MIN_DEFINED 16 // extracted signatures with fewer defined bytes are too generic
+
+_Static_assert(sizeof(FuncidPattern) == 76, "FuncidPattern is part of the database format");
+
+
+// fills the bucket tables from index->patterns, replacing any old ones
+void funcid_index_build_buckets(FuncidIndex *index) {
+    free(index->bucket_start);
+    free(index->bucket_entries);
+    free(index->anywhere);
+    index->bucket_start = (uint32_t *)calloc(FUNCID_BUCKETS + 1, sizeof(uint32_t));
+    index->bucket_entries = (uint32_t *)malloc((index->patterns_sz + 1) * sizeof(uint32_t));
+    index->anywhere = (uint32_t *)malloc((index->patterns_sz + 1) * sizeof(uint32_t));
+    index->anywhere_sz = 0;
+
+    // counting sort into the buckets
+    for (size_t i = 0; i < index->patterns_sz; i++) {
+        FuncidPattern *pat = &index->patterns[i];
+        if (pat->mask[0] && pat->mask[1]) index->bucket_start[((pat->data[0] << 8) | pat->data[1]) + 1]++;
+        else index->anywhere[index->anywhere_sz++] = i;
+    }
+    for (size_t k = 0; k < FUNCID_BUCKETS; k++) index->bucket_start[k + 1] += index->bucket_start[k];
+
+    uint32_t *fill = (uint32_t *)malloc(FUNCID_BUCKETS * sizeof(uint32_t));
+    memcpy(fill, index->bucket_start, FUNCID_BUCKETS * sizeof(uint32_t));
+    for (size_t i = 0; i < index->patterns_sz; i++) {
+        FuncidPattern *pat = &index->patterns[i];
+        if (!(pat->mask[0] && pat->mask[1])) continue;
+        index->bucket_entries[fill[(pat->data[0] << 8) | pat->data[1]]++] = i;
+    }
+    free(fill);
+}
+
+
+void free_funcid_index(FuncidIndex *index) {
+    if (index->map) {
+        // everything but the string pointer arrays lives in the mapping
+        munmap(index->map, index->map_sz);
+    } else {
+        free(index->patterns);
+        free(index->bucket_start);
+        free(index->bucket_entries);
+        free(index->anywhere);
+        for (size_t i = 0; i < index->funcs_sz; i++) free(index->func_names[i]);
+        for (size_t i = 0; i < index->sources_sz; i++) free(index->sources[i]);
+    }
+    free(index->func_names);
+    free(index->sources);
+    memset(index, 0, sizeof(FuncidIndex));
+}
+
+
+// $XDG_DATA_HOME/heaptrace/funcid.db (or ~/.local/share/...) if it exists, 
+// otherwise the system-wide database. Returns a malloc'd path or 0.
+char *funcid_db_default_path() {
+    char path[4096];
+    const char *xdg = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    int n = -1;
+    if (xdg && *xdg) n = snprintf(path, sizeof(path), "%s/heaptrace/funcid.db", xdg);
+    else if (home && *home) n = snprintf(path, sizeof(path), "%s/.local/share/heaptrace/funcid.db", home);
+    if (n > 0 && (size_t)n < sizeof(path) && !access(path, R_OK)) return strdup(path);
+
+    if (!access("/usr/share/heaptrace/funcid.db", R_OK)) return strdup("/usr/share/heaptrace/funcid.db");
+    return 0;
+}
+
+
+
+// identifies the database funcid would load (its path, size and mtime), or 
+// returns 0 for the built-in signatures. Computed once.
+uint64_t funcid_db_stamp() {
+    static uint64_t stamp;
+    static int done = 0;
+    if (done) return stamp;
+    done = 1;
+
+    char *path = OPT_FUNCID_DB ? strdup(OPT_FUNCID_DB) : funcid_db_default_path();
+    struct stat st;
+    if (path && !stat(path, &st)) {
+        // FNV-1a
+        stamp = 0xcbf29ce484222325LU;
+        for (char *c = path; *c; c++) stamp = (stamp ^ (uint8_t)*c) * 0x100000001b3LU;
+        stamp = (stamp ^ (uint64_t)st.st_size) * 0x100000001b3LU;
+        stamp = (stamp ^ (uint64_t)st.st_mtim.tv_sec) * 0x100000001b3LU;
+        stamp = (stamp ^ (uint64_t)st.st_mtim.tv_nsec) * 0x100000001b3LU;
+    }
+    free(path);
+    return stamp;
+}
+
+static inline int _db_range_ok(size_t map_sz, uint64_t off, uint64_t count, size_t elem_sz) {
+    return off <= map_sz && count <= (map_sz - off) / elem_sz;
+}
+
+
+// resolves a table of string offsets, returns 0 if any are out of bounds
+static char **_db_strings(char *map, FuncidDbHeader *hdr, uint64_t off, uint32_t count) {
+    uint32_t *offsets = (uint32_t *)(map + off);
+    char **strings = (char **)malloc((count + 1) * sizeof(char *));
+    for (uint32_t i = 0; i < count; i++) {
+        if (offsets[i] >= hdr->strtab_sz) {
+            free(strings);
+            return 0;
+        }
+        strings[i] = map + hdr->strtab_off + offsets[i];
+    }
+    return strings;
+}
+
+
+// maps a database built by --funcid-build-db. Everything is validated up 
+// front so the scanner can trust the indices.
+int funcid_db_load(FuncidIndex *index, const char *path) {
+    memset(index, 0, sizeof(FuncidIndex));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(FuncidDbHeader)) {
+        close(fd);
+        return 0;
+    }
+    size_t map_sz = (size_t)st.st_size;
+    char *map = (char *)mmap(0, map_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    FuncidDbHeader *hdr = (FuncidDbHeader *)map;
+    if (memcmp(hdr->magic, FUNCID_DB_MAGIC, sizeof(hdr->magic)) || hdr->version != FUNCID_DB_VERSION || hdr->sig_sz != FUNCSIG_SZ) {
+        debug("%s is not a compatible funcid database\n", path);
+        goto fail;
+    }
+    if (!_db_range_ok(map_sz, hdr->funcs_off, hdr->funcs_sz, sizeof(uint32_t))
+            || !_db_range_ok(map_sz, hdr->sources_off, hdr->sources_sz, sizeof(uint32_t))
+            || !_db_range_ok(map_sz, hdr->patterns_off, hdr->patterns_sz, sizeof(FuncidPattern))
+            || !_db_range_ok(map_sz, hdr->bucket_start_off, FUNCID_BUCKETS + 1, sizeof(uint32_t))
+            || !_db_range_ok(map_sz, hdr->anywhere_off, hdr->anywhere_sz, sizeof(uint32_t))
+            || !_db_range_ok(map_sz, hdr->strtab_off, hdr->strtab_sz, 1)
+            || !hdr->strtab_sz || map[hdr->strtab_off + hdr->strtab_sz - 1] != '\x00') {
+        debug("funcid database %s is truncated\n", path);
+        goto fail;
+    }
+
+    index->map = map;
+    index->map_sz = map_sz;
+    index->patterns = (FuncidPattern *)(map + hdr->patterns_off);
+    index->patterns_sz = hdr->patterns_sz;
+    index->bucket_start = (uint32_t *)(map + hdr->bucket_start_off);
+    index->anywhere = (uint32_t *)(map + hdr->anywhere_off);
+    index->anywhere_sz = hdr->anywhere_sz;
+    index->funcs_sz = hdr->funcs_sz;
+    index->sources_sz = hdr->sources_sz;
+
+    uint32_t entries_sz = index->bucket_start[FUNCID_BUCKETS];
+    if (!_db_range_ok(map_sz, hdr->bucket_entries_off, entries_sz, sizeof(uint32_t))) goto fail_index;
+    index->bucket_entries = (uint32_t *)(map + hdr->bucket_entries_off);
+    for (size_t k = 0; k < FUNCID_BUCKETS; k++) {
+        if (index->bucket_start[k] > index->bucket_start[k + 1]) goto fail_index;
+    }
+    for (uint32_t i = 0; i < entries_sz; i++) {
+        if (index->bucket_entries[i] >= index->patterns_sz) goto fail_index;
+    }
+    for (size_t i = 0; i < index->anywhere_sz; i++) {
+        if (index->anywhere[i] >= index->patterns_sz) goto fail_index;
+    }
+    for (size_t i = 0; i < index->patterns_sz; i++) {
+        if (index->patterns[i].func >= index->funcs_sz || index->patterns[i].source >= index->sources_sz) goto fail_index;
+    }
+
+    index->func_names = _db_strings(map, hdr, hdr->funcs_off, hdr->funcs_sz);
+    index->sources = _db_strings(map, hdr, hdr->sources_off, hdr->sources_sz);
+    if (!index->func_names || !index->sources) goto fail_index;
+    return 1;
+
+fail_index:
+    debug("funcid database %s has an invalid index\n", path);
+    free_funcid_index(index);
+    return 0;
+
+fail:
+    munmap(map, map_sz);
+    return 0;
+}
+
+
+static void _write_padding(FILE *f, uint64_t *pos) {
+    static const char zeros[8] = {0};
+    size_t pad = (8 - (*pos & 7)) & 7;
+    fwrite(zeros, 1, pad, f);
+    *pos += pad;
+}
+
+
+static void _write_section(FILE *f, uint64_t *pos, uint64_t *off, const void *data, size_t sz) {
+    _write_padding(f, pos);
+    *off = *pos;
+    if (sz) fwrite(data, 1, sz, f);
+    *pos += sz;
+}
+
+
+static int funcid_db_write(FuncidIndex *index, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+
+    // string table: function names, then sources
+    size_t strtab_sz = 0;
+    for (size_t i = 0; i < index->funcs_sz; i++) strtab_sz += strlen(index->func_names[i]) + 1;
+    for (size_t i = 0; i < index->sources_sz; i++) strtab_sz += strlen(index->sources[i]) + 1;
+    char *strtab = (char *)malloc(strtab_sz + 1);
+    uint32_t *func_offs = (uint32_t *)malloc((index->funcs_sz + 1) * sizeof(uint32_t));
+    uint32_t *source_offs = (uint32_t *)malloc((index->sources_sz + 1) * sizeof(uint32_t));
+    size_t s = 0;
+    for (size_t i = 0; i < index->funcs_sz; i++) {
+        func_offs[i] = s;
+        strcpy(strtab + s, index->func_names[i]);
+        s += strlen(index->func_names[i]) + 1;
+    }
+    for (size_t i = 0; i < index->sources_sz; i++) {
+        source_offs[i] = s;
+        strcpy(strtab + s, index->sources[i]);
+        s += strlen(index->sources[i]) + 1;
+    }
+
+    FuncidDbHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FUNCID_DB_MAGIC, sizeof(hdr.magic));
+    hdr.version = FUNCID_DB_VERSION;
+    hdr.sig_sz = FUNCSIG_SZ;
+    hdr.funcs_sz = index->funcs_sz;
+    hdr.sources_sz = index->sources_sz;
+    hdr.patterns_sz = index->patterns_sz;
+    hdr.anywhere_sz = index->anywhere_sz;
+    hdr.strtab_sz = strtab_sz;
+
+    // write the sections (recording their offsets), then rewrite the header
+    uint64_t pos = 0;
+    fwrite(&hdr, 1, sizeof(hdr), f);
+    pos += sizeof(hdr);
+    _write_section(f, &pos, &hdr.funcs_off, func_offs, index->funcs_sz * sizeof(uint32_t));
+    _write_section(f, &pos, &hdr.sources_off, source_offs, index->sources_sz * sizeof(uint32_t));
+    _write_section(f, &pos, &hdr.patterns_off, index->patterns, index->patterns_sz * sizeof(FuncidPattern));
+    _write_section(f, &pos, &hdr.bucket_start_off, index->bucket_start, (FUNCID_BUCKETS + 1) * sizeof(uint32_t));
+    _write_section(f, &pos, &hdr.bucket_entries_off, index->bucket_entries, index->bucket_start[FUNCID_BUCKETS] * sizeof(uint32_t));
+    _write_section(f, &pos, &hdr.anywhere_off, index->anywhere, index->anywhere_sz * sizeof(uint32_t));
+    _write_section(f, &pos, &hdr.strtab_off, strtab, strtab_sz);
+
+    int ok = !fseek(f, 0, SEEK_SET) && fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr);
+    ok &= !fclose(f);
+
+    free(strtab);
+    free(func_offs);
+    free(source_offs);
+    return ok;
+}
+
+
+/*
+ * Masks the parts of a function prologue that change between builds of the 
+ * same source: relative branch targets and RIP-relative displacements. This 
+ * is a length decoder for the instructions that show up in allocator 
+ * prologues; everything after the first unknown opcode is masked out.
+ */
+static void _mask_prologue(const uint8_t *code, uint8_t *mask) {
+    memset(mask, 0xff, FUNCSIG_SZ);
+    size_t i = 0;
+    while (i < FUNCSIG_SZ) {
+        size_t start = i;
+        int rex_w = 0;
+        int opsize16 = 0;
+
+        while (i < FUNCSIG_SZ && (code[i] == 0x66 || code[i] == 0xf2 || code[i] == 0xf3 || code[i] == 0xf0 || code[i] == 0x2e || code[i] == 0x3e || code[i] == 0x64 || code[i] == 0x65)) {
+            if (code[i] == 0x66) opsize16 = 1;
+            i++;
+        }
+        if (i < FUNCSIG_SZ && (code[i] & 0xf0) == 0x40) rex_w = code[i++] & 0x08;
+        if (i >= FUNCSIG_SZ) break;
+
+        uint8_t op = code[i++];
+        int has_modrm = 0;
+        size_t imm = 0;
+        size_t rel = 0; // size of a relative branch target
+
+        if (op == 0x0f) {
+            if (i >= FUNCSIG_SZ) break;
+            uint8_t op2 = code[i++];
+            if (op2 >= 0x80 && op2 <= 0x8f) rel = 4; // jcc rel32
+            else if (op2 == 0x05 || op2 == 0x0b || op2 == 0xa2) ; // syscall, ud2, cpuid
+            else if (op2 == 0x10 || op2 == 0x11 || op2 == 0x1e || op2 == 0x1f || op2 == 0x28 || op2 == 0x29
+                    || (op2 >= 0x40 && op2 <= 0x4f) || op2 == 0x57 || op2 == 0x6f || op2 == 0x7f
+                    || (op2 >= 0x90 && op2 <= 0x9f) || op2 == 0xa3 || op2 == 0xaf || op2 == 0xb0 || op2 == 0xb1
+                    || op2 == 0xb6 || op2 == 0xb7 || op2 == 0xbc || op2 == 0xbd || op2 == 0xbe || op2 == 0xbf
+                    || op2 == 0xd6 || op2 == 0xef) has_modrm = 1;
+            else goto unknown;
+        } else if (op < 0x40 && (op & 7) < 4) has_modrm = 1; // add/or/adc/sbb/and/sub/xor/cmp
+        else if (op < 0x40 && (op & 7) == 4) imm = 1;
+        else if (op < 0x40 && (op & 7) == 5) imm = opsize16 ? 2 : 4;
+        else if (op >= 0x50 && op <= 0x5f) ; // push/pop
+        else if (op == 0x63 || (op >= 0x84 && op <= 0x8b) || op == 0x8d || op == 0x8f || op == 0xd1 || op == 0xd3 || op == 0xff || op == 0xf6 || op == 0xf7) has_modrm = 1;
+        else if (op == 0x69 || op == 0x81 || op == 0xc7) {
+            has_modrm = 1;
+            imm = opsize16 ? 2 : 4;
+        } else if (op == 0x6b || op == 0x80 || op == 0x83 || op == 0xc0 || op == 0xc1 || op == 0xc6) {
+            has_modrm = 1;
+            imm = 1;
+        } else if ((op >= 0x70 && op <= 0x7f) || op == 0xeb) rel = 1;
+        else if (op == 0xe8 || op == 0xe9) rel = 4;
+        else if (op >= 0xb8 && op <= 0xbf) imm = rex_w ? 8 : 4;
+        else if (op >= 0xb0 && op <= 0xb7) imm = 1;
+        else if (op == 0xa8) imm = 1;
+        else if (op == 0xa9) imm = 4;
+        else if (op == 0x90 || op == 0x98 || op == 0x99 || op == 0xc3 || op == 0xc9 || op == 0xcc) ;
+        else goto unknown;
+
+        if (has_modrm) {
+            if (i >= FUNCSIG_SZ) break;
+            uint8_t modrm = code[i++];
+            uint8_t mod = modrm >> 6;
+            uint8_t reg = (modrm >> 3) & 7;
+            uint8_t rm = modrm & 7;
+            if ((op == 0xf6 || op == 0xf7) && reg < 2) imm = op == 0xf6 ? 1 : (opsize16 ? 2 : 4); // test r/m, imm
+
+            size_t disp = 0;
+            int rip_relative = 0;
+            if (mod != 3 && rm == 4) {
+                if (i >= FUNCSIG_SZ) break;
+                uint8_t sib = code[i++];
+                if (mod == 0 && (sib & 7) == 5) disp = 4;
+            }
+            if (mod == 1) disp = 1;
+            else if (mod == 2) disp = 4;
+            else if (mod == 0 && rm == 5) {
+                disp = 4;
+                rip_relative = 1;
+            }
+            for (size_t k = i; k < i + disp && k < FUNCSIG_SZ; k++) {
+                if (rip_relative) mask[k] = 0x00;
+            }
+            i += disp;
+        }
+
+        i += imm;
+        for (size_t k = i; k < i + rel && k < FUNCSIG_SZ; k++) mask[k] = 0x00;
+        i += rel;
+        continue;
+
+unknown:
+        for (size_t k = start; k < FUNCSIG_SZ; k++) mask[k] = 0x00;
+        break;
+    }
+}
+
+
+// finds `name` (or __libc_`name`) in .symtab/.dynsym and returns its file 
+// offset, or 0
+static uint64_t _find_function_offset(ElfImage *img, const char *name) {
+    uint8_t *bytes = img->bytes;
+    size_t size = img->size;
+    Elf64_Shdr *shdrs = img->shdrs;
+    uint16_t shnum = img->shnum;
+
+    char libc_name[256];
+    snprintf(libc_name, sizeof(libc_name), "__libc_%s", name);
+
+    for (uint16_t i = 0; i < shnum; i++) {
+        if (shdrs[i].sh_type != SHT_SYMTAB && shdrs[i].sh_type != SHT_DYNSYM) continue;
+        if (shdrs[i].sh_link >= shnum || !elf_image_range_ok(img, shdrs[i].sh_offset, shdrs[i].sh_size)) continue;
+        Elf64_Shdr *strtab = &shdrs[shdrs[i].sh_link];
+        if (!elf_image_range_ok(img, strtab->sh_offset, strtab->sh_size)) continue;
+
+        Elf64_Sym *syms = (Elf64_Sym *)(bytes + shdrs[i].sh_offset);
+        size_t count = shdrs[i].sh_size / sizeof(Elf64_Sym);
+        for (size_t j = 0; j < count; j++) {
+            Elf64_Sym *sym = &syms[j];
+            if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF || sym->st_shndx >= shnum) continue;
+            if (sym->st_name >= strtab->sh_size) continue;
+            const char *sym_name = (const char *)bytes + strtab->sh_offset + sym->st_name;
+            if (strnlen(sym_name, strtab->sh_size - sym->st_name) == strtab->sh_size - sym->st_name) continue;
+            if (strcmp(sym_name, name) && strcmp(sym_name, libc_name)) continue;
+
+            Elf64_Shdr *sec = &shdrs[sym->st_shndx];
+            if (sym->st_value < sec->sh_addr) continue;
+            uint64_t offset = sec->sh_offset + (sym->st_value - sec->sh_addr);
+            if (offset && offset + FUNCSIG_SZ <= size) return offset;
+        }
+    }
+    return 0;
+}
+
+
+// adds a signature for every function in the index that `path` defines. 
+// Returns the number of signatures added, or -1 if the file can't be read.
+static int _add_elf_signatures(FuncidIndex *index, const char *path) {
+    ElfImage *img = elf_image_open(path);
+    if (!img) return -1;
+    if (!img->ehdr) {
+        elf_image_close(img);
+        return -1;
+    }
+    uint8_t *bytes = img->bytes;
+
+    const char *source = strrchr(path, '/');
+    source = source ? source + 1 : path;
+    uint32_t source_i = index->sources_sz;
+
+    int added = 0;
+    for (size_t j = 0; j < index->funcs_sz; j++) {
+        uint64_t offset = _find_function_offset(img, index->func_names[j]);
+        if (!offset) {
+            debug("%s: no symbol for \"%s\"\n", path, index->func_names[j]);
+            continue;
+        }
+
+        FuncidPattern pat;
+        memset(&pat, 0, sizeof(pat));
+        _mask_prologue(bytes + offset, pat.mask);
+        int defined = 0;
+        for (int k = 0; k < FUNCSIG_SZ; k++) {
+            pat.data[k] = bytes[offset + k] & pat.mask[k];
+            if (pat.mask[k]) defined++;
+        }
+        if (defined < FUNCID_MIN_DEFINED) {
+            debug("%s: prologue of \"%s\" is too generic (%d defined bytes)\n", path, index->func_names[j], defined);
+            continue;
+        }
+
+        // skip duplicates and find the next rank for this function
+        uint16_t rank = 0;
+        int duplicate = 0;
+        for (size_t i = 0; i < index->patterns_sz; i++) {
+            FuncidPattern *other = &index->patterns[i];
+            if (other->func != j) continue;
+            if (other->rank >= rank) rank = other->rank + 1;
+            if (!memcmp(other->data, pat.data, FUNCSIG_SZ) && !memcmp(other->mask, pat.mask, FUNCSIG_SZ)) duplicate = 1;
+        }
+        if (duplicate) continue;
+
+        pat.func = j;
+        pat.rank = rank;
+        pat.source = source_i;
+        index->patterns = (FuncidPattern *)realloc(index->patterns, (index->patterns_sz + 1) * sizeof(FuncidPattern));
+        index->patterns[index->patterns_sz++] = pat;
+        added++;
+    }
+
+    if (added) {
+        index->sources = (char **)realloc(index->sources, (index->sources_sz + 1) * sizeof(char *));
+        index->sources[index->sources_sz++] = strdup(source);
+    }
+    elf_image_close(img);
+    return added;
+}
+
+
+// --funcid-build-db: writes the built-in signatures plus new ones extracted 
+// from the given ELFs (which must still have symbols) to out_path
+int funcid_build_db(const char *out_path, char **elf_paths, int elf_paths_sz) {
+    FuncidIndex index;
+    build_builtin_funcid_index(&index);
+    size_t builtin_sz = index.patterns_sz;
+
+    for (int i = 0; i < elf_paths_sz; i++) {
+        int added = _add_elf_signatures(&index, elf_paths[i]);
+        if (added < 0) {
+            warn("failed to read ELF \"%s\", skipping...\n", elf_paths[i]);
+            continue;
+        }
+        info("%s: added %d new signature%s\n", elf_paths[i], added, added == 1 ? "" : "s");
+    }
+
+    funcid_index_build_buckets(&index);
+    int ok = funcid_db_write(&index, out_path);
+    if (ok) {
+        info("wrote %zu signatures (%zu built-in, %zu extracted) to %s\n", index.patterns_sz, builtin_sz, index.patterns_sz - builtin_sz, out_path);
+    } else {
+        fatal("failed to write funcid signature database \"%s\".\n", out_path);
+    }
+    free_funcid_index(&index);
+    return ok ? 0 : 1;
+}
@@ -3,27 +3,33 @@
 #include "heap.h"
 #include "options.h"
 #include "user-breakpoint.h"
+#include "callsite.h"
+#include "allocator.h"
 
 
 static void PRINT_SOURCE(HeaptraceContext *ctx) {
-    if (OPT_VERBOSE) {
-        char *SRC_FUNC = get_source_function(ctx);
+    if (OPT_VERBOSE && OPT_FORMAT == OUTPUT_FORMAT_TEXT) {
+        const char *SRC_FUNC = get_source_function(ctx);
         HandlerLogMessageNote *note_src = insert_note(ctx);
         concat_note(note_src, "called by: ");
         concat_note_color(note_src, COLOR_LOG_BOLD);
         concat_note(note_src, "%s", SRC_FUNC);
-        free(SRC_FUNC);
 
         HandlerLogMessageNote *note_ret = insert_note(ctx);
         concat_note(note_ret, "returns to 0x%lx", ctx->h_ret_ptr);
     }
 }
 
+// indexed by ALLOC_API_*
+static const char *ALLOC_API_ALLOCATORS[] = {"malloc", "operator new", "operator new[]"};
+static const char *ALLOC_API_DEALLOCATORS[] = {"free", "operator delete", "operator delete[]"};
+
 
 // check if pointer is in stack, libc, or binary, and error if so
 static void _check_heap_ptr_retval(HeaptraceContext *ctx, uint64_t ptr) {
     if (!ptr) return; // we already have NULL warnings
-    ProcMapsEntry *pme = pme_find_addr(ctx->pme_head, ptr);
+    if (ALLOCATOR->outside_heap) return;
+    ProcMapsEntry *pme = pme_find_addr(ctx->proc_maps, ptr);
     if (pme) {
         if (pme->pet == PROCELF_TYPE_LIBC // possibly malloc hook?
                 || pme->pet == PROCELF_TYPE_BINARY // possibly GOT?
@@ -38,6 +44,15 @@ static void _check_heap_ptr_retval(HeaptraceContext *ctx, uint64_t ptr) {
 
 void pre_calloc(HeaptraceContext *ctx, uint64_t nmemb, uint64_t isize) {
     ctx->h_size = (size_t)isize * (size_t)nmemb;
+    ctx->h_redzone = 0;
+    if (!__builtin_mul_overflow(nmemb, isize, &ctx->h_size)) {
+        // calloc(1, nmemb * size + redzone)
+        redzone_grow(ctx, 1, ctx->h_size);
+        if (ctx->h_redzone) {
+            ctx->h_new_args[0] = 1;
+            ctx->h_set_args |= 1;
+        }
+    }
 
     ctx->calloc_count++;
     ctx->h_oid = get_oid(ctx);
@@ -66,17 +81,25 @@ void post_calloc(HeaptraceContext *ctx, uint64_t ptr) {
 
     _check_heap_ptr_retval(ctx, ptr);
 
+    uaf_allocated(ctx, chunk, ptr, ctx->h_size, 0);
+    callsite_free(ctx, chunk);
     chunk->state = STATE_MALLOC;
+    chunk->api = ALLOC_API_MALLOC;
     chunk->ptr = ptr;
     chunk->size = ctx->h_size;
     chunk->ops[STATE_MALLOC] = ctx->h_oid;
     chunk->ops[STATE_FREE] = 0;
     chunk->ops[STATE_REALLOC] = 0;
+    queue_chunk_size(ctx, chunk);
+    redzone_arm(ctx, chunk);
+    bins_malloc(ctx, chunk, ctx->h_size + ctx->h_redzone, 1);
+    callsite_alloc(ctx, chunk);
 }
 
 
 void pre_malloc(HeaptraceContext *ctx, uint64_t isize) {
     ctx->h_size = (size_t)isize;
+    redzone_grow(ctx, 0, isize);
     ctx->malloc_count++;
     ctx->h_oid = get_oid(ctx);
 }
@@ -104,18 +127,26 @@ void post_malloc(HeaptraceContext *ctx, uint64_t ptr) {
 
     _check_heap_ptr_retval(ctx, ptr);
 
+    uaf_allocated(ctx, chunk, ptr, ctx->h_size, 1);
+    callsite_free(ctx, chunk);
     chunk->state = STATE_MALLOC;
+    chunk->api = ALLOC_API_MALLOC;
     chunk->ptr = ptr;
     chunk->size = ctx->h_size;
     chunk->ops[STATE_MALLOC] = ctx->h_oid;
     chunk->ops[STATE_FREE] = 0;
     chunk->ops[STATE_REALLOC] = 0;
+    queue_chunk_size(ctx, chunk);
+    redzone_arm(ctx, chunk);
+    bins_malloc(ctx, chunk, ctx->h_size + ctx->h_redzone, 0);
+    callsite_alloc(ctx, chunk);
 }
 
 
-void pre_free(HeaptraceContext *ctx, uint64_t iptr) {
+// checks the chunk that iptr points to and marks it as freed. `api` is the 
+// family of the function releasing it (ALLOC_API_*)
+static void _pre_free(HeaptraceContext *ctx, uint64_t iptr, int api) {
     ctx->h_ptr = iptr;
-    ctx->free_count++;
     ctx->h_oid = get_oid(ctx);
 
     Chunk *chunk = find_chunk(ctx, ctx->h_ptr);
@@ -133,18 +164,40 @@ void pre_free(HeaptraceContext *ctx, uint64_t iptr) {
         warn_heap("attempting to double free a chunk");
         warn_heap2("allocated in operation " SYM, chunk->ops[STATE_MALLOC]);
         warn_heap2("first freed in operation " SYM, chunk->ops[STATE_FREE]);
+        bins_free(ctx, chunk);
     } else {
         // all is good!
         ASSERT(chunk->state != STATE_UNUSED, "cannot free unused chunk");
+        sync_chunk_size(ctx, chunk);
+        bins_free(ctx, chunk); // before redzone_check forgets the redzone
+        redzone_check(ctx, chunk);
+        if (chunk->api != api) {
+            warn_heap("releasing a chunk allocated by %s with %s", ALLOC_API_ALLOCATORS[chunk->api], ALLOC_API_DEALLOCATORS[api]);
+            warn_heap2("it must be released with %s", ALLOC_API_DEALLOCATORS[chunk->api]);
+            warn_heap2("allocated in operation " SYM, chunk->ops[STATE_MALLOC]);
+        }
+        callsite_free(ctx, chunk);
         chunk->state = STATE_FREE;
         chunk->ops[STATE_FREE] = ctx->h_oid;
     }
 }
 
 
+void pre_free(HeaptraceContext *ctx, uint64_t iptr) {
+    ctx->free_count++;
+    _pre_free(ctx, iptr, ALLOC_API_MALLOC);
+}
+
+
 void post_free(HeaptraceContext *ctx, uint64_t retval) {
-    log(COLOR_RESET);
+    color_log(COLOR_RESET);
     PRINT_SOURCE(ctx);
+
+    // only hash chunks this very operation freed, not double frees
+    Chunk *chunk = find_chunk(ctx, ctx->h_ptr);
+    if (chunk && chunk->ptr == ctx->h_ptr && chunk->state == STATE_FREE && chunk->ops[STATE_FREE] == ctx->h_oid) {
+        uaf_freed(ctx, chunk);
+    }
 }
 
 
@@ -159,6 +212,14 @@ void _pre_realloc(HeaptraceContext *ctx, int _type, uint64_t iptr, uint64_t nmem
     ctx->h_oid = get_oid(ctx);
 
     ctx->h_orig_chunk = alloc_chunk(ctx, ctx->h_ptr);
+    sync_chunk_size(ctx, ctx->h_orig_chunk);
+
+    // realloc(ptr, 0) frees, and reallocarray can't be grown by exactly 
+    // OPT_REDZONE bytes
+    ctx->h_redzone = 0;
+    if (_type == 1 && isize) redzone_grow(ctx, 1, isize);
+    bins_pre_realloc(ctx, ctx->h_orig_chunk);
+    if (ctx->h_orig_chunk && ctx->h_orig_chunk->state == STATE_MALLOC) redzone_check(ctx, ctx->h_orig_chunk);
 
     if (ctx->h_orig_chunk && ctx->h_orig_chunk->state == STATE_FREE) {
         warn_heap("attempting to %s a previously-freed chunk", _name);
@@ -168,6 +229,9 @@ void _pre_realloc(HeaptraceContext *ctx, int _type, uint64_t iptr, uint64_t nmem
         // ptr && because https://github.com/Arinerron/heaptrace/issues/9
         //   0x0 is a special value
         warn_heap("attempting to %s a chunk that was never allocated", _name);
+    } else if (ctx->h_orig_chunk && ctx->h_orig_chunk->api != ALLOC_API_MALLOC) {
+        warn_heap("attempting to %s a chunk allocated by %s", _name, ALLOC_API_ALLOCATORS[ctx->h_orig_chunk->api]);
+        warn_heap2("allocated in operation " SYM, ctx->h_orig_chunk->ops[STATE_MALLOC]);
     }
 }
 
@@ -201,7 +265,12 @@ static inline void _post_realloc(HeaptraceContext *ctx, int _type, uint64_t new_
             new_chunk->ops[STATE_MALLOC] = ctx->h_oid; // NOTE: we treat it as a malloc for now
             new_chunk->ops[STATE_REALLOC] = ctx->h_oid;
             if (ctx->h_orig_chunk) {
+                uaf_allocated(ctx, ctx->h_orig_chunk, new_ptr, ctx->h_size, 0); // it may have grown into a freed chunk
+                callsite_free(ctx, ctx->h_orig_chunk);
                 ctx->h_orig_chunk->size = ctx->h_size;
+                queue_chunk_size(ctx, ctx->h_orig_chunk);
+                redzone_arm(ctx, ctx->h_orig_chunk);
+                callsite_alloc(ctx, ctx->h_orig_chunk);
             } // the else condition is unnecessary because there's a check above for !ctx->h_orig_chunk
         }
     } else {
@@ -214,13 +283,19 @@ static inline void _post_realloc(HeaptraceContext *ctx, int _type, uint64_t new_
                 warn_heap2("first allocated in operation " SYM, new_chunk->ops[STATE_MALLOC]);
             }
 
+            uaf_allocated(ctx, new_chunk, new_ptr, ctx->h_size, 0); // realloc copied the old data into it
+            callsite_free(ctx, new_chunk);
             new_chunk->state = STATE_MALLOC;
+            new_chunk->api = ALLOC_API_MALLOC;
             new_chunk->ptr = new_ptr;
             new_chunk->size = ctx->h_size;
             new_chunk->ops[STATE_MALLOC] = ctx->h_oid; // NOTE: I changed my mind. Treat it as a malloc.
             //new_chunk->ops[STATE_MALLOC] = (ptr ? ctx->h_orig_chunk->ops[STATE_MALLOC] : oid); // realloc can act as malloc() when ptr is 0
             new_chunk->ops[STATE_FREE] = 0;
             new_chunk->ops[STATE_REALLOC] = ctx->h_oid;
+            queue_chunk_size(ctx, new_chunk);
+            redzone_arm(ctx, new_chunk);
+            callsite_alloc(ctx, new_chunk);
 
             // old chunk gets marked as free after this if block
         } else {
@@ -243,10 +318,15 @@ static inline void _post_realloc(HeaptraceContext *ctx, int _type, uint64_t new_
         _check_heap_ptr_retval(ctx, new_ptr);
         
         if (ctx->h_ptr && ctx->h_orig_chunk && _override_free) {
+            callsite_free(ctx, ctx->h_orig_chunk);
             ctx->h_orig_chunk->state = STATE_FREE;
             ctx->h_orig_chunk->ops[STATE_FREE] = ctx->h_oid;
+            uaf_freed(ctx, ctx->h_orig_chunk);
         } // no need for else if (!ctx->h_orig_chunk) because !ctx->h_orig_chunk is above
     }
+
+    if (ctx->h_ptr) bins_realloc(ctx, ctx->h_orig_chunk, new_ptr ? new_chunk : 0, ctx->h_size + ctx->h_redzone);
+    else if (new_ptr) bins_malloc(ctx, new_chunk, ctx->h_size + ctx->h_redzone, 0);
 }
 
 void post_realloc(HeaptraceContext *ctx, uint64_t new_ptr) {
@@ -257,3 +337,224 @@ void post_realloc(HeaptraceContext *ctx, uint64_t new_ptr) {
 void post_reallocarray(HeaptraceContext *ctx, uint64_t new_ptr) {
     _post_realloc(ctx, 2, new_ptr);
 }
+
+
+// the memalign family: posix_memalign, aligned_alloc, memalign, valloc and 
+// pvalloc. Their pre handlers only differ in where the size, the alignment 
+// and (for posix_memalign) the result pointer are passed. operator new uses 
+// _post_aligned too.
+static void _pre_aligned(HeaptraceContext *ctx, uint64_t isize, uint64_t alignment, uint64_t memptr) {
+    ctx->h_size = (size_t)isize;
+    ctx->h_alignment = alignment;
+    ctx->h_ptr = memptr;
+    ctx->h_redzone = 0;
+    ctx->memalign_count++;
+    ctx->h_oid = get_oid(ctx);
+}
+
+
+static Chunk *_post_aligned(HeaptraceContext *ctx, const char *_name, uint64_t ptr) {
+    PRINT_SOURCE(ctx);
+
+    Chunk *chunk = alloc_chunk(ctx, ptr);
+
+    if (chunk->state == STATE_MALLOC) {
+        warn_heap("%s returned a pointer to a chunk that was never freed, which indicates some form of heap corruption", _name);
+        warn_heap2("first allocated in operation " SYM, chunk->ops[STATE_MALLOC]);
+    }
+
+    if (!ptr) {
+        warn_heap("NULL return value indicates that an error happened");
+    } else if (ctx->h_alignment && (ptr & (ctx->h_alignment - 1))) {
+        warn_heap("%s returned a pointer that is not aligned to 0x%lx", _name, ctx->h_alignment);
+    }
+
+    _check_heap_ptr_retval(ctx, ptr);
+
+    uaf_allocated(ctx, chunk, ptr, ctx->h_size, 1);
+    callsite_free(ctx, chunk);
+    chunk->state = STATE_MALLOC;
+    chunk->api = ALLOC_API_MALLOC;
+    chunk->ptr = ptr;
+    chunk->size = ctx->h_size;
+    chunk->ops[STATE_MALLOC] = ctx->h_oid;
+    chunk->ops[STATE_FREE] = 0;
+    chunk->ops[STATE_REALLOC] = 0;
+    queue_chunk_size(ctx, chunk);
+    redzone_arm(ctx, chunk);
+    // operator new is malloc in glibc, but memalign splits chunks
+    if (ctx->h_alignment) bins_aligned(ctx, chunk, ctx->h_size);
+    else bins_malloc(ctx, chunk, ctx->h_size + ctx->h_redzone, 0);
+    callsite_alloc(ctx, chunk);
+    return chunk;
+}
+
+
+void pre_posix_memalign(HeaptraceContext *ctx, uint64_t memptr, uint64_t alignment, uint64_t isize) {
+    _pre_aligned(ctx, isize, alignment, memptr);
+}
+
+
+// posix_memalign returns an error code and stores the pointer in *memptr
+void post_posix_memalign(HeaptraceContext *ctx, uint64_t retval) {
+    if (retval) {
+        PRINT_SOURCE(ctx);
+        warn_heap("posix_memalign failed with error %lu (%s)", retval, strerror((int)retval));
+        ctx->hlm.ret_ptr = 0;
+        return;
+    }
+
+    errno = 0;
+    uint64_t ptr = (uint64_t)ptrace(PTRACE_PEEKDATA, ctx->pid, ctx->h_ptr, NULL);
+    if (errno) {
+        PRINT_SOURCE(ctx);
+        warn_heap("posix_memalign succeeded, but its result pointer " PTR_ERR " is not readable", PTR_ARG(ctx->h_ptr));
+        ctx->hlm.ret_ptr = 0;
+        return;
+    }
+
+    ctx->hlm.ret_ptr = ptr; // log the chunk rather than the 0 return value
+    _post_aligned(ctx, "posix_memalign", ptr);
+}
+
+
+void pre_aligned_alloc(HeaptraceContext *ctx, uint64_t alignment, uint64_t isize) {
+    _pre_aligned(ctx, isize, alignment, 0);
+}
+
+
+void post_aligned_alloc(HeaptraceContext *ctx, uint64_t ptr) {
+    _post_aligned(ctx, "aligned_alloc", ptr);
+}
+
+
+void pre_memalign(HeaptraceContext *ctx, uint64_t alignment, uint64_t isize) {
+    _pre_aligned(ctx, isize, alignment, 0);
+}
+
+
+void post_memalign(HeaptraceContext *ctx, uint64_t ptr) {
+    _post_aligned(ctx, "memalign", ptr);
+}
+
+
+void pre_valloc(HeaptraceContext *ctx, uint64_t isize) {
+    _pre_aligned(ctx, isize, getpagesize(), 0);
+}
+
+
+void post_valloc(HeaptraceContext *ctx, uint64_t ptr) {
+    _post_aligned(ctx, "valloc", ptr);
+}
+
+
+void pre_pvalloc(HeaptraceContext *ctx, uint64_t isize) {
+    // pvalloc rounds the size up to a multiple of the page size
+    uint64_t page = getpagesize();
+    _pre_aligned(ctx, (isize + page - 1) & ~(page - 1), page, 0);
+}
+
+
+void post_pvalloc(HeaptraceContext *ctx, uint64_t ptr) {
+    _post_aligned(ctx, "pvalloc", ptr);
+}
+
+
+void pre_malloc_usable_size(HeaptraceContext *ctx, uint64_t iptr) {
+    ctx->h_ptr = iptr;
+    ctx->malloc_usable_size_count++;
+    ctx->h_oid = get_oid(ctx);
+
+    Chunk *chunk = find_chunk(ctx, ctx->h_ptr);
+    if (!chunk) {
+        if (ctx->h_ptr) warn_heap("querying the size of an unknown chunk");
+    } else if (chunk->ptr != ctx->h_ptr) {
+        warn_heap("querying the size of a pointer that is inside of a chunk");
+        warn_heap2("container chunk malloc()'d in " SYM " @ " PTR " with size " SZ, chunk->ops[STATE_MALLOC], PTR_ARG(chunk->ptr), SZ_ARG(chunk->size));
+    } else if (chunk->state == STATE_FREE) {
+        warn_heap("querying the size of a freed chunk");
+        warn_heap2("allocated in operation " SYM, chunk->ops[STATE_MALLOC]);
+        warn_heap2("freed in operation " SYM, chunk->ops[STATE_FREE]);
+    }
+}
+
+
+void post_malloc_usable_size(HeaptraceContext *ctx, uint64_t retval) {
+    PRINT_SOURCE(ctx);
+}
+
+
+// every operator new variant takes the size first. The aligned ones pass the 
+// alignment next, and the nothrow ones end with a nothrow_t reference that 
+// is ignored.
+static void _pre_new(HeaptraceContext *ctx, int api, uint64_t isize, uint64_t alignment) {
+    ctx->h_size = (size_t)isize;
+    ctx->h_alignment = alignment;
+    ctx->h_api = api;
+    redzone_grow(ctx, 0, isize);
+    ctx->new_count++;
+    ctx->h_oid = get_oid(ctx);
+}
+
+
+void pre_operator_new(HeaptraceContext *ctx, uint64_t isize) {
+    _pre_new(ctx, ALLOC_API_NEW, isize, 0);
+}
+
+
+void pre_operator_new_aligned(HeaptraceContext *ctx, uint64_t isize, uint64_t alignment) {
+    _pre_new(ctx, ALLOC_API_NEW, isize, alignment);
+}
+
+
+void pre_operator_new_array(HeaptraceContext *ctx, uint64_t isize) {
+    _pre_new(ctx, ALLOC_API_NEW_ARRAY, isize, 0);
+}
+
+
+void pre_operator_new_array_aligned(HeaptraceContext *ctx, uint64_t isize, uint64_t alignment) {
+    _pre_new(ctx, ALLOC_API_NEW_ARRAY, isize, alignment);
+}
+
+
+void post_operator_new(HeaptraceContext *ctx, uint64_t ptr) {
+    Chunk *chunk = _post_aligned(ctx, ALLOC_API_ALLOCATORS[ctx->h_api], ptr);
+    chunk->api = ctx->h_api;
+}
+
+
+// sized deallocation passes the size that was given to operator new (or 
+// new[]) back, so a mismatch means the wrong type is being deleted. Chunks 
+// from the wrong family get a warning from _pre_free instead.
+static void _check_delete_size(HeaptraceContext *ctx, uint64_t iptr, int api, uint64_t isize) {
+    Chunk *chunk = find_chunk(ctx, iptr);
+    if (chunk && chunk->ptr == iptr && chunk->state == STATE_MALLOC && chunk->api == api && chunk->size != isize) {
+        warn_heap("sized delete was given size " SZ_ERR ", but the chunk was allocated with size " SZ_ERR, SZ_ARG(isize), SZ_ARG(chunk->size));
+    }
+}
+
+
+// the unsized variants also handle the aligned and nothrow forms, whose extra 
+// arguments come after the pointer
+void pre_operator_delete(HeaptraceContext *ctx, uint64_t iptr) {
+    ctx->delete_count++;
+    _pre_free(ctx, iptr, ALLOC_API_NEW);
+}
+
+
+void pre_operator_delete_sized(HeaptraceContext *ctx, uint64_t iptr, uint64_t isize) {
+    _check_delete_size(ctx, iptr, ALLOC_API_NEW, isize);
+    pre_operator_delete(ctx, iptr);
+}
+
+
+void pre_operator_delete_array(HeaptraceContext *ctx, uint64_t iptr) {
+    ctx->delete_count++;
+    _pre_free(ctx, iptr, ALLOC_API_NEW_ARRAY);
+}
+
+
+void pre_operator_delete_array_sized(HeaptraceContext *ctx, uint64_t iptr, uint64_t isize) {
+    _check_delete_size(ctx, iptr, ALLOC_API_NEW_ARRAY, isize);
+    pre_operator_delete_array(ctx, iptr);
+}
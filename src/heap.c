@@ -3,18 +3,61 @@
 #include "logging.h"
 #include "debugger.h"
 #include "handlers.h"
+#include "jsonl.h"
 
 // returns the current operation ID
 uint64_t get_oid(HeaptraceContext *ctx) {
-    uint64_t oid = ctx->malloc_count + ctx->calloc_count + ctx->free_count + ctx->realloc_count + ctx->reallocarray_count;
+    uint64_t oid = ctx->malloc_count + ctx->calloc_count + ctx->free_count + ctx->realloc_count + ctx->reallocarray_count + ctx->memalign_count + ctx->malloc_usable_size_count + ctx->new_count + ctx->delete_count;
     ASSERT(oid < (uint64_t)0xFFFFFFFFFFFFFFF0LLU, "ran out of oids"); // avoid overflows
     return oid;
 }
 
 
+static void show_stats_jsonl(HeaptraceContext *ctx, uint64_t unfreed_sum) {
+    jsonl_begin();
+    jsonl_key("type");
+    jsonl_str("stats");
+    jsonl_key("mallocs");
+    jsonl_u64(ctx->malloc_count);
+    jsonl_key("callocs");
+    jsonl_u64(ctx->calloc_count);
+    jsonl_key("frees");
+    jsonl_u64(ctx->free_count);
+    jsonl_key("reallocs");
+    jsonl_u64(ctx->realloc_count);
+    jsonl_key("reallocarrays");
+    jsonl_u64(ctx->reallocarray_count);
+    jsonl_key("memaligns");
+    jsonl_u64(ctx->memalign_count);
+    jsonl_key("malloc_usable_sizes");
+    jsonl_u64(ctx->malloc_usable_size_count);
+    jsonl_key("news");
+    jsonl_u64(ctx->new_count);
+    jsonl_key("deletes");
+    jsonl_u64(ctx->delete_count);
+    jsonl_key("unfreed_bytes");
+    jsonl_u64(unfreed_sum);
+    show_addrspace_stats_jsonl(ctx);
+    show_uaf_stats_jsonl(ctx);
+    show_redzone_stats_jsonl(ctx);
+    show_heapcheck_stats_jsonl(ctx);
+    show_bins_stats_jsonl(ctx);
+    show_leak_stats_jsonl(ctx);
+    jsonl_end(event_fd);
+    fflush(event_fd);
+}
+
+
 void show_stats(HeaptraceContext *ctx) {
     uint64_t unfreed_sum = count_unfreed_bytes(ctx->chunk_root);
 
+    if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) {
+        show_callsite_stats(ctx);
+        show_leak_stats(ctx);
+        show_stats_jsonl(ctx, unfreed_sum);
+        return;
+    }
+
     if (get_oid(ctx) || unfreed_sum) {
         color_log(COLOR_LOG);
         log("Statistics:\n");
@@ -23,12 +66,24 @@ void show_stats(HeaptraceContext *ctx) {
         if (ctx->free_count) log("... frees count: " CNT "\n", ctx->free_count);
         if (ctx->realloc_count) log("... reallocs count: " CNT "\n", ctx->realloc_count);
         if (ctx->reallocarray_count) log("... reallocarrays count: " CNT "\n", ctx->reallocarray_count);
+        if (ctx->memalign_count) log("... memaligns count: " CNT "\n", ctx->memalign_count);
+        if (ctx->malloc_usable_size_count) log("... malloc_usable_sizes count: " CNT "\n", ctx->malloc_usable_size_count);
+        if (ctx->new_count) log("... operator news count: " CNT "\n", ctx->new_count);
+        if (ctx->delete_count) log("... operator deletes count: " CNT "\n", ctx->delete_count);
+        show_addrspace_stats(ctx);
         color_log(COLOR_RESET);
 
         if (unfreed_sum) {
             color_log(COLOR_ERROR);
             log("... unfreed bytes: " SZ_ERR "\n", SZ_ARG(unfreed_sum));
         }
+        show_uaf_stats(ctx);
+        show_redzone_stats(ctx);
+        show_heapcheck_stats(ctx);
+        show_bins_stats(ctx);
+        show_leak_stats(ctx);
+
+        show_callsite_stats(ctx);
     }
 
     log(COLOR_RESET);
@@ -0,0 +1,623 @@
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "heapcheck.h"
+#include "context.h"
+#include "heap.h"
+#include "logging.h"
+#include "jsonl.h"
+
+uint64_t OPT_CHECK_HEAP = 0;
+uint64_t OPT_CHECK_HEAP_MS = 0;
+int OPT_SOFT_DIRTY = 0;
+
+/*
+ * --check-heap walks glibc's main heap every n operations (or milliseconds) 
+ * instead of waiting for a handler to notice something strange. A walk 
+ * follows the chunk headers from the start of the heap to the top chunk, 
+ * checks them against each other (size, prev_inuse and prev_size) and 
+ * against the chunks heaptrace knows are live, then follows the tcache and 
+ * fastbin lists. The first walk that fails names the operations between 
+ * which the heap was corrupted; walking after every one (the default) 
+ * narrows it down to a single oid.
+ *
+ * The heap is mirrored locally. With --soft-dirty, and if the kernel keeps 
+ * soft-dirty bits, only the pages the tracee wrote to since the last walk 
+ * are read again. Otherwise all of it is read in one call and compared with 
+ * the copy, which leaves the tracee's page tables alone. 
+ * Either way, runs of chunks whose headers sit in clean pages are taken 
+ * from the last walk instead of being checked again.
+ */
+
+#define PAGE_SZ 0x1000
+#define PREV_INUSE 0x1
+#define IS_MMAPPED 0x2
+#define NON_MAIN_ARENA 0x4
+#define SIZE_FLAGS 0x7
+#define TCACHE_BINS 64
+#define NFASTBINS 10
+#define PM_SOFT_DIRTY ((uint64_t)1 << 55)
+
+// how a walk went
+#define WALK_OK 0
+#define WALK_BAD 1 // hc->reason says why
+#define WALK_STALE 2 // the heap grew or shrank since the maps were read
+
+
+// parses --check-heap's argument: n operations, or `Tms`
+int parse_check_heap(const char *arg) {
+    char buf[32];
+    size_t len = strlen(arg);
+    int ms = len > 2 && !strcmp(arg + len - 2, "ms");
+    if (ms) len -= 2;
+    if (!len || len >= sizeof(buf)) return 0;
+    memcpy(buf, arg, len);
+    buf[len] = '\x00';
+    if (!is_uint(buf) || !atoi(buf)) return 0;
+    if (ms) {
+        OPT_CHECK_HEAP_MS = atoi(buf);
+        OPT_CHECK_HEAP = 0;
+    } else {
+        OPT_CHECK_HEAP = atoi(buf);
+        OPT_CHECK_HEAP_MS = 0;
+    }
+    return 1;
+}
+
+
+static int _bad(HeapCheck *hc, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(hc->reason, sizeof(hc->reason), fmt, args);
+    va_end(args);
+    return WALK_BAD;
+}
+
+
+static uint64_t _u64(HeapCheck *hc, uint64_t off) {
+    return *(uint64_t *)(hc->mirror + off);
+}
+
+
+static int _write_clear_refs(int fd) {
+    return fd > 0 && pwrite(fd, "4", 1, 0) == 1;
+}
+
+
+// whether the kernel keeps soft-dirty bits (CONFIG_MEM_SOFT_DIRTY), found 
+// by clearing our own and writing to a page
+static int _soft_dirty_supported() {
+    static int supported = -1;
+    if (supported != -1) return supported;
+    supported = 0;
+
+    volatile uint8_t *page = (volatile uint8_t *)aligned_alloc(PAGE_SZ, PAGE_SZ);
+    int clear_fd = open("/proc/self/clear_refs", O_WRONLY);
+    int pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    page[0] = 1;
+    if (page && _write_clear_refs(clear_fd) && pagemap_fd != -1) {
+        uint64_t entry = 0;
+        page[0] = 2;
+        if (pread(pagemap_fd, &entry, sizeof(entry), ((uint64_t)page / PAGE_SZ) * sizeof(entry)) == sizeof(entry)) {
+            supported = !!(entry & PM_SOFT_DIRTY);
+        }
+    }
+    if (clear_fd != -1) close(clear_fd);
+    if (pagemap_fd != -1) close(pagemap_fd);
+    free((void *)page);
+    debug("heapcheck: soft-dirty bits are %ssupported\n", supported ? "" : "not ");
+    return supported;
+}
+
+
+// returns whether the tracee's pagemap and clear_refs are open. If they 
+// can't be, every walk compares the heap instead.
+static int _open_proc_files(HeaptraceContext *ctx, HeapCheck *hc) {
+    if (hc->pagemap_fd) return hc->pagemap_fd != -1;
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", ctx->pid);
+    hc->pagemap_fd = open(path, O_RDONLY);
+    snprintf(path, sizeof(path), "/proc/%d/clear_refs", ctx->pid);
+    hc->clear_refs_fd = open(path, O_WRONLY);
+    if (hc->pagemap_fd == -1 || hc->clear_refs_fd == -1) {
+        debug("heapcheck: failed to open the pagemap of pid %d, comparing the heap instead\n", ctx->pid);
+        if (hc->pagemap_fd != -1) close(hc->pagemap_fd);
+        if (hc->clear_refs_fd != -1) close(hc->clear_refs_fd);
+        hc->pagemap_fd = hc->clear_refs_fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+
+static void _reserve(HeapCheck *hc, size_t size) {
+    if (size <= hc->cap) return;
+    size_t cap = hc->cap ? hc->cap : 16 * PAGE_SZ;
+    while (cap < size) cap *= 2;
+    hc->mirror = (uint8_t *)realloc(hc->mirror, cap);
+    hc->scratch = (uint8_t *)realloc(hc->scratch, cap);
+    hc->dirty = (uint8_t *)realloc(hc->dirty, cap / PAGE_SZ);
+    hc->pagemap = (uint64_t *)realloc(hc->pagemap, cap / PAGE_SZ * sizeof(uint64_t));
+    ASSERT(hc->mirror && hc->scratch && hc->dirty && hc->pagemap, "_reserve: realloc out of memory");
+    hc->cap = cap;
+}
+
+
+// reads the dirty pages of [base, base + size) into the mirror, in as few 
+// process_vm_readv calls as possible
+static int _read_dirty(HeaptraceContext *ctx, HeapCheck *hc) {
+    struct iovec local[HEAPCHECK_READ_IOVS];
+    struct iovec remote[HEAPCHECK_READ_IOVS];
+    size_t npages = hc->size / PAGE_SZ;
+    size_t page = 0;
+    while (page < npages) {
+        size_t n = 0;
+        size_t want = 0;
+        for (; page < npages && n < HEAPCHECK_READ_IOVS; page++) {
+            if (!hc->dirty[page]) continue;
+            size_t run = page;
+            while (page + 1 < npages && hc->dirty[page + 1]) page++;
+            local[n].iov_base = hc->mirror + run * PAGE_SZ;
+            local[n].iov_len = (page + 1 - run) * PAGE_SZ;
+            remote[n].iov_base = (void *)(hc->base + run * PAGE_SZ);
+            remote[n].iov_len = local[n].iov_len;
+            want += local[n++].iov_len;
+        }
+        if (!n) break;
+        if (process_vm_readv(ctx->pid, local, n, remote, n, 0) != (ssize_t)want) return 0;
+        hc->pages_read += want / PAGE_SZ;
+    }
+    return 1;
+}
+
+
+/*
+ * brings the mirror up to date with [base, end) and flags the pages that 
+ * changed. Returns 0 if the memory could not be read, e.g. because the heap 
+ * was trimmed since the maps were read.
+ */
+static int _sync_mirror(HeaptraceContext *ctx, HeapCheck *hc, uint64_t base, uint64_t end) {
+    size_t size = end - base;
+    size_t old_size = (base == hc->base) ? hc->size : 0;
+    if (old_size > size) old_size = size;
+    size_t npages = size / PAGE_SZ;
+    size_t old_npages = old_size / PAGE_SZ;
+    _reserve(hc, size);
+    hc->base = base;
+    hc->size = size;
+    memset(hc->dirty, 1, npages);
+
+    if (OPT_SOFT_DIRTY && _soft_dirty_supported() && _open_proc_files(ctx, hc)) {
+        if (old_npages) {
+            size_t len = old_npages * sizeof(uint64_t);
+            if (pread(hc->pagemap_fd, hc->pagemap, len, (base / PAGE_SZ) * sizeof(uint64_t)) != (ssize_t)len) {
+                hc->size = 0;
+                return 0;
+            }
+            for (size_t i = 0; i < old_npages; i++) hc->dirty[i] = !!(hc->pagemap[i] & PM_SOFT_DIRTY);
+        }
+        if (!_read_dirty(ctx, hc)) {
+            hc->size = 0;
+            return 0;
+        }
+        _write_clear_refs(hc->clear_refs_fd);
+        return 1;
+    }
+
+    // no soft-dirty bits: read it all and see what changed
+    struct iovec local = {hc->scratch, size};
+    struct iovec remote = {(void *)base, size};
+    if (process_vm_readv(ctx->pid, &local, 1, &remote, 1, 0) != (ssize_t)size) {
+        hc->size = 0;
+        return 0;
+    }
+    hc->pages_read += npages;
+    for (size_t i = 0; i < old_npages; i++) {
+        hc->dirty[i] = memcmp(hc->scratch + i * PAGE_SZ, hc->mirror + i * PAGE_SZ, PAGE_SZ) != 0;
+    }
+    uint8_t *tmp = hc->mirror;
+    hc->mirror = hc->scratch;
+    hc->scratch = tmp;
+    return 1;
+}
+
+
+// the offset of the first dirty page at or after off's page
+static uint64_t _next_dirty(HeapCheck *hc, uint64_t off) {
+    size_t npages = hc->size / PAGE_SZ;
+    for (size_t page = off / PAGE_SZ; page < npages; page++) {
+        if (hc->dirty[page]) return page * PAGE_SZ;
+    }
+    return hc->size;
+}
+
+
+static void _push_bound(HeapCheck *hc, size_t *sz, uint64_t off) {
+    if (*sz == hc->bounds_cap) {
+        hc->bounds_cap = hc->bounds_cap ? hc->bounds_cap * 2 : 1024;
+        hc->bounds = (uint64_t *)realloc(hc->bounds, hc->bounds_cap * sizeof(uint64_t));
+        hc->next_bounds = (uint64_t *)realloc(hc->next_bounds, hc->bounds_cap * sizeof(uint64_t));
+        ASSERT(hc->bounds && hc->next_bounds, "_push_bound: realloc out of memory");
+    }
+    hc->next_bounds[(*sz)++] = off;
+}
+
+
+// returns the index of off in the sorted array, or -1
+static ssize_t _search(const uint64_t *arr, size_t sz, uint64_t off) {
+    size_t lo = 0;
+    size_t hi = sz;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (arr[mid] < off) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < sz && arr[lo] == off) ? (ssize_t)lo : -1;
+}
+
+
+/*
+ * follows the chunk headers from the start of the heap to the top chunk. 
+ * When it reaches a chunk the last walk found too, and whose header is in a 
+ * clean page, the chunks after it up to the next dirty page are taken from 
+ * the last walk as they are: none of their headers changed.
+ */
+static int _walk_headers(HeapCheck *hc) {
+    size_t sz = 0;
+    size_t old = 0; // cursor in hc->bounds
+    uint64_t off = 0;
+    uint64_t prev_size = 0;
+    while (1) {
+        uint64_t field = _u64(hc, off + 8);
+        uint64_t size = field & ~(uint64_t)SIZE_FLAGS;
+        if (size < MINSIZE || (size & 0xf)) {
+            return _bad(hc, "the chunk at " U64T " has a bad size (" U64T ")", hc->base + off, field);
+        }
+        if (size > hc->size - off) {
+            _bad(hc, "the chunk at " U64T " has a bad size (" U64T ")", hc->base + off, field);
+            return WALK_STALE; // unless the heap grew
+        }
+        if (field & (IS_MMAPPED | NON_MAIN_ARENA)) {
+            return _bad(hc, "the chunk at " U64T " has bad flags in its size (" U64T ")", hc->base + off, field);
+        }
+        if (!(field & PREV_INUSE)) {
+            if (!off) return _bad(hc, "the first chunk at " U64T " has prev_inuse clear", hc->base);
+            if (_u64(hc, off) != prev_size) {
+                return _bad(hc, "the chunk at " U64T " has prev_size " U64T ", but the chunk before it is " U64T " bytes", hc->base + off, _u64(hc, off), prev_size);
+            }
+        }
+        _push_bound(hc, &sz, off);
+        if (off + size == hc->size) break; // the top chunk
+
+        // headers are 16 bytes and 16-aligned, so they never straddle pages
+        while (old < hc->bounds_sz && hc->bounds[old] < off) old++;
+        if (old < hc->bounds_sz && hc->bounds[old] == off && !hc->dirty[off / PAGE_SZ]) {
+            uint64_t clean_end = _next_dirty(hc, off);
+            size_t last = old;
+            while (last + 1 < hc->bounds_sz && hc->bounds[last + 1] < clean_end) last++;
+            if (last >= old + 2) {
+                // the last one is checked again, since the heap may have shrunk
+                for (size_t i = old + 1; i < last; i++) _push_bound(hc, &sz, hc->bounds[i]);
+                prev_size = hc->bounds[last] - hc->bounds[last - 1];
+                off = hc->bounds[last];
+                continue;
+            }
+        }
+        prev_size = size;
+        off += size;
+    }
+
+    uint64_t *tmp = hc->bounds;
+    hc->bounds = hc->next_bounds;
+    hc->next_bounds = tmp;
+    hc->bounds_sz = sz;
+    return WALK_OK;
+}
+
+
+static void _push_live(HeapCheck *hc, uint64_t off) {
+    if (hc->live_sz == hc->live_cap) {
+        hc->live_cap = hc->live_cap ? hc->live_cap * 2 : 1024;
+        hc->live = (uint64_t *)realloc(hc->live, hc->live_cap * sizeof(uint64_t));
+        ASSERT(hc->live, "_push_live: realloc out of memory");
+    }
+    hc->live[hc->live_sz++] = off;
+}
+
+
+/*
+ * checks the chunks heaptrace saw malloc return against the walk: each one 
+ * must start a chunk that is big enough for what was requested, and the 
+ * chunk after it must have prev_inuse set. Also collects their offsets, 
+ * sorted, for the freelist checks.
+ */
+static int _check_live(HeaptraceContext *ctx, HeapCheck *hc) {
+    hc->live_sz = 0;
+    size_t stack_cap = 256;
+    size_t stack_sz = 0;
+    Chunk **stack = (Chunk **)malloc(stack_cap * sizeof(Chunk *));
+    ASSERT(stack, "_check_live: malloc out of memory");
+
+    int ret = WALK_OK;
+    Chunk *cur = ctx->chunk_root;
+    while (ret == WALK_OK && (cur || stack_sz)) {
+        while (cur) {
+            if (stack_sz == stack_cap) {
+                stack_cap *= 2;
+                stack = (Chunk **)realloc(stack, stack_cap * sizeof(Chunk *));
+                ASSERT(stack, "_check_live: realloc out of memory");
+            }
+            stack[stack_sz++] = cur;
+            cur = cur->left;
+        }
+        cur = stack[--stack_sz];
+        if (cur->state == STATE_MALLOC && cur->ptr >= hc->base + 0x10 && cur->ptr < hc->base + hc->size) {
+            uint64_t off = cur->ptr - 0x10 - hc->base;
+            if (_search(hc->bounds, hc->bounds_sz, off) < 0) {
+                ret = _bad(hc, "chunk #%lu (" U64T ") is live, but no chunk starts there anymore", cur->ops[STATE_MALLOC], cur->ptr);
+                break;
+            }
+            uint64_t size = _u64(hc, off + 8) & ~(uint64_t)SIZE_FLAGS;
+            if (off + size == hc->size) {
+                _bad(hc, "chunk #%lu (" U64T ") is live, but it is the top chunk", cur->ops[STATE_MALLOC], cur->ptr);
+                ret = WALK_STALE; // unless the heap grew
+            } else if (size < cur->size + 8) {
+                ret = _bad(hc, "chunk #%lu (" U64T ") is " U64T " bytes, too small for the " U64T " bytes requested", cur->ops[STATE_MALLOC], cur->ptr, size, cur->size);
+            } else if (!(_u64(hc, off + size + 8) & PREV_INUSE)) {
+                ret = _bad(hc, "chunk #%lu (" U64T ") is live, but the chunk after it has prev_inuse clear", cur->ops[STATE_MALLOC], cur->ptr);
+            }
+            _push_live(hc, off);
+        }
+        cur = cur->right;
+    }
+    free(stack);
+    return ret;
+}
+
+
+// the chunk sizes each tcache bin and fastbin holds
+static uint64_t _bin_size(int fastbin, size_t i) {
+    return fastbin ? (i + 2) * 0x10 : MINSIZE + i * 0x10;
+}
+
+
+// checks that a freelist entry is a free chunk of the right size in the heap
+static int _check_entry(HeapCheck *hc, const char *bin, size_t i, uint64_t chunk, uint64_t size) {
+    if (chunk < hc->base || chunk >= hc->base + hc->size || _search(hc->bounds, hc->bounds_sz, chunk - hc->base) < 0) {
+        return _bad(hc, "%s %lu points to " U64T ", which is not a chunk", bin, i, chunk);
+    }
+    uint64_t off = chunk - hc->base;
+    uint64_t real = _u64(hc, off + 8) & ~(uint64_t)SIZE_FLAGS;
+    if (real != size) return _bad(hc, "%s %lu holds the chunk at " U64T ", which is " U64T " bytes instead of " U64T, bin, i, chunk, real, size);
+    if (_search(hc->live, hc->live_sz, off) >= 0) return _bad(hc, "%s %lu holds the chunk at " U64T ", which is live", bin, i, chunk);
+    return WALK_OK;
+}
+
+
+// with safe-linking (glibc 2.32+), `next` pointers are stored xored with 
+// their own address >> 12. The stored value is tried as it is first, since a 
+// mangled pointer never looks like a heap pointer.
+static uint64_t _reveal(HeapCheck *hc, uint64_t pos, uint64_t next) {
+    if (!next || (next >= hc->base && next < hc->base + hc->size && !(next & 0xf))) return next;
+    return (pos >> 12) ^ next;
+}
+
+
+// the main thread's tcache. Entries point to the user data, 0x10 bytes in.
+static int _check_tcache(HeaptraceContext *ctx, HeapCheck *hc) {
+    if (!hc->tcache_counts_sz) return WALK_OK;
+    uint64_t counts = hc->tcache + 0x10;
+    uint64_t entries = counts + TCACHE_BINS * hc->tcache_counts_sz;
+    for (size_t i = 0; i < TCACHE_BINS; i++) {
+        uint64_t count = hc->tcache_counts_sz == 2 ? *(uint16_t *)(hc->mirror + counts + i * 2) : hc->mirror[counts + i];
+        uint64_t e = _u64(hc, entries + i * 8);
+        uint64_t n = 0;
+        while (e) {
+            if (n == count) return _bad(hc, "tcache bin %lu holds more than the %lu chunks it counts", i, count);
+            if (e < hc->base + 0x10 || e >= hc->base + hc->size) {
+                // freed by this thread, but from another thread's arena, 
+                // which is not walked
+                Chunk *chunk = find_chunk(ctx, e);
+                if (!chunk || chunk->state == STATE_MALLOC) return _bad(hc, "tcache bin %lu points to " U64T ", which is not a free chunk", i, e);
+                n = count;
+                break;
+            }
+            if (_check_entry(hc, "tcache bin", i, e - 0x10, _bin_size(0, i))) return WALK_BAD;
+            e = _reveal(hc, e, _u64(hc, e - hc->base));
+            n++;
+        }
+        if (n != count) return _bad(hc, "tcache bin %lu holds %lu chunks, but counts %lu", i, n, count);
+    }
+    return WALK_OK;
+}
+
+
+/*
+ * finds main_arena by looking for a pointer to the top chunk in libc's 
+ * writable data (or the binary's, if it is static) that is followed by 
+ * last_remainder and a sane unsorted bin: when it is empty, its fd and bk 
+ * point to the arena's top field.
+ */
+static uint64_t _find_arena(HeaptraceContext *ctx, HeapCheck *hc, uint64_t top) {
+    ProcMaps *maps = ctx->proc_maps;
+    for (size_t r = 0; r < maps->writable_sz; r++) {
+        ProcMapsRange *range = &maps->writable[r];
+        if (range->pet != PROCELF_TYPE_LIBC && range->pet != PROCELF_TYPE_BINARY) continue;
+        size_t size = range->end - range->base;
+        uint64_t *words = (uint64_t *)malloc(size);
+        ASSERT(words, "_find_arena: malloc out of memory");
+        struct iovec local = {words, size};
+        struct iovec remote = {(void *)range->base, size};
+        ssize_t nread = process_vm_readv(ctx->pid, &local, 1, &remote, 1, 0);
+        uint64_t found = 0;
+        for (size_t i = NFASTBINS + 1; nread > 0 && i + 3 < (size_t)nread / 8 && !found; i++) {
+            if (words[i] != top) continue;
+            uint64_t addr = range->base + i * 8;
+            uint64_t fd = words[i + 2];
+            uint64_t bk = words[i + 3];
+            int in_heap = fd >= hc->base && fd < hc->base + hc->size && bk >= hc->base && bk < hc->base + hc->size;
+            if ((fd == addr && bk == addr) || in_heap) found = addr;
+        }
+        free(words);
+        if (found) {
+            debug("heapcheck: found main_arena.top at " U64T "\n", found);
+            return found;
+        }
+    }
+    return 0;
+}
+
+
+// main_arena's fastbins, which point to the chunks themselves
+static int _check_fastbins(HeaptraceContext *ctx, HeapCheck *hc) {
+    uint64_t top = hc->base + hc->bounds[hc->bounds_sz - 1];
+    if (!hc->arena_top) hc->arena_top = _find_arena(ctx, hc, top);
+    if (!hc->arena_top) return WALK_OK;
+
+    uint64_t arena[NFASTBINS + 1]; // fastbinsY and top
+    struct iovec local = {arena, sizeof(arena)};
+    struct iovec remote = {(void *)(hc->arena_top - NFASTBINS * 8), sizeof(arena)};
+    if (process_vm_readv(ctx->pid, &local, 1, &remote, 1, 0) != sizeof(arena)) return WALK_OK;
+    if (arena[NFASTBINS] != top) {
+        _bad(hc, "main_arena.top is " U64T ", but the last chunk is at " U64T, arena[NFASTBINS], top);
+        return WALK_STALE; // unless the heap grew
+    }
+
+    for (size_t i = 0; i < NFASTBINS; i++) {
+        uint64_t c = arena[i];
+        for (size_t n = 0; c; n++) {
+            if (n > hc->bounds_sz) return _bad(hc, "fastbin %lu loops", i);
+            if (_check_entry(hc, "fastbin", i, c, _bin_size(1, i))) return WALK_BAD;
+            c = _reveal(hc, c + 0x10, _u64(hc, c - hc->base + 0x10));
+        }
+    }
+    return WALK_OK;
+}
+
+
+// one walk of the heap in [base, end)
+static int _walk(HeaptraceContext *ctx, HeapCheck *hc, uint64_t base, uint64_t end) {
+    if (!_sync_mirror(ctx, hc, base, end)) {
+        _bad(hc, "failed to read the heap at " U64T "-" U64T, base, end);
+        return WALK_STALE; // unless it was trimmed
+    }
+    int ret = _walk_headers(hc);
+    if (ret != WALK_OK) {
+        hc->bounds_sz = 0; // the dirty flags are used up, so start over next time
+        return ret;
+    }
+
+    // glibc 2.26+ allocates the main thread's tcache first
+    uint64_t first = hc->bounds_sz > 1 ? (_u64(hc, 8) & ~(uint64_t)SIZE_FLAGS) : 0;
+    hc->tcache = 0;
+    hc->tcache_counts_sz = 0;
+    if (first == 0x290 || first == 0x250) hc->tcache_counts_sz = first == 0x290 ? 2 : 1;
+
+    if ((ret = _check_live(ctx, hc))) return ret;
+    if (hc->tcache_counts_sz && _search(hc->live, hc->live_sz, 0) >= 0) hc->tcache_counts_sz = 0;
+    if ((ret = _check_tcache(ctx, hc))) return ret;
+    return _check_fastbins(ctx, hc);
+}
+
+
+// walks the heap now, re-reading the maps once if they are out of date
+static void _check_heap(HeaptraceContext *ctx, int in_op) {
+    HeapCheck *hc = &ctx->heapcheck;
+    ProcMaps *maps = ctx->proc_maps;
+    if (hc->bad_oid || !maps) return;
+    hc->ops = 0;
+    clock_gettime(CLOCK_MONOTONIC, &hc->last_walk);
+
+    ProcMapsEntry *heap = pme_walk(maps, PROCELF_TYPE_HEAP);
+    if ((!heap || heap->base != hc->base || heap->end != hc->base + hc->size) && (maps->maybe_stale || maps->changed)) {
+        refresh_proc_maps(maps);
+        heap = pme_walk(maps, PROCELF_TYPE_HEAP);
+    }
+    if (!heap) return; // nothing was allocated from the main arena yet
+
+    int ret = _walk(ctx, hc, heap->base, heap->end);
+    if (ret == WALK_STALE) {
+        refresh_proc_maps(maps);
+        heap = pme_walk(maps, PROCELF_TYPE_HEAP);
+        ret = heap ? _walk(ctx, hc, heap->base, heap->end) : WALK_OK;
+        if (ret == WALK_STALE) ret = WALK_BAD;
+    }
+    hc->walks++;
+
+    uint64_t oid = get_oid(ctx);
+    if (ret == WALK_OK) {
+        hc->good_oid = oid;
+        return;
+    }
+    hc->bad_oid = oid ? oid : 1;
+    if (in_op) {
+        warn_heap("the heap is inconsistent: %s", hc->reason);
+        if (hc->good_oid) warn_heap2("it was still consistent after operation " SYM, hc->good_oid);
+    }
+}
+
+
+// called after each heap operation
+void heapcheck_after_op(HeaptraceContext *ctx) {
+    if (!OPT_CHECK_HEAP && !OPT_CHECK_HEAP_MS) return;
+    HeapCheck *hc = &ctx->heapcheck;
+    hc->ops++;
+    if (OPT_CHECK_HEAP && hc->ops < OPT_CHECK_HEAP) return;
+    if (OPT_CHECK_HEAP_MS && hc->walks && ms_since(&hc->last_walk) < OPT_CHECK_HEAP_MS) return;
+    _check_heap(ctx, 1);
+}
+
+
+// a last walk for the operations since the previous one
+void heapcheck_at_exit(HeaptraceContext *ctx) {
+    if (!OPT_CHECK_HEAP && !OPT_CHECK_HEAP_MS) return;
+    if (ctx->heapcheck.ops) _check_heap(ctx, 0);
+}
+
+
+void show_heapcheck_stats(HeaptraceContext *ctx) {
+    HeapCheck *hc = &ctx->heapcheck;
+    if (!hc->bad_oid) return;
+    color_log(COLOR_ERROR);
+    log("... heap inconsistent after: " SYM COLOR_ERROR, hc->bad_oid);
+    if (hc->good_oid) log(" (consistent after " SYM COLOR_ERROR ")", hc->good_oid);
+    log("\n... %s\n", hc->reason);
+    color_log(COLOR_RESET);
+}
+
+
+// adds the walker's results to the stats record that is being built
+void show_heapcheck_stats_jsonl(HeaptraceContext *ctx) {
+    if (!OPT_CHECK_HEAP && !OPT_CHECK_HEAP_MS) return;
+    HeapCheck *hc = &ctx->heapcheck;
+    jsonl_key("heap_walks");
+    jsonl_u64(hc->walks);
+    jsonl_key("heap_consistent_after");
+    jsonl_u64(hc->good_oid);
+    jsonl_key("heap_inconsistent_after");
+    if (hc->bad_oid) jsonl_u64(hc->bad_oid);
+    else jsonl_null();
+    jsonl_key("heap_inconsistency");
+    if (hc->bad_oid) jsonl_str(hc->reason);
+    else jsonl_null();
+}
+
+
+void free_heapcheck(HeaptraceContext *ctx) {
+    HeapCheck *hc = &ctx->heapcheck;
+    if (hc->walks) debug("heapcheck: %lu walks read %lu pages\n", hc->walks, hc->pages_read);
+    free(hc->mirror);
+    free(hc->scratch);
+    free(hc->dirty);
+    free(hc->pagemap);
+    free(hc->bounds);
+    free(hc->next_bounds);
+    free(hc->live);
+    if (hc->pagemap_fd > 0) close(hc->pagemap_fd);
+    if (hc->clear_refs_fd > 0) close(hc->clear_refs_fd);
+}
@@ -0,0 +1,220 @@
+#include <string.h>
+
+#include "jsonl.h"
+
+static char buf[JSONL_BUF_SIZE];
+static size_t buf_i = 0;
+static int truncated = 0;
+
+static int depth = 0;
+static int has_items[JSONL_MAX_DEPTH]; // whether the container at depth needs a comma before the next item
+static char closers[JSONL_MAX_DEPTH];
+static int after_key = 0;
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+
+// room that is always kept free for closing quotes, brackets and the newline
+#define JSONL_SLACK (JSONL_MAX_DEPTH + 4)
+
+static inline void _putc(char c) {
+    if (truncated || buf_i + JSONL_SLACK >= JSONL_BUF_SIZE) {
+        truncated = 1;
+        return;
+    }
+    buf[buf_i++] = c;
+}
+
+
+// for structural characters only; these may use the reserved slack
+static inline void _putc_raw(char c) {
+    if (buf_i < JSONL_BUF_SIZE) buf[buf_i++] = c;
+}
+
+
+// marks the record as truncated unless n more bytes fit
+static inline int _reserve(size_t n) {
+    if (truncated || buf_i + n + JSONL_SLACK >= JSONL_BUF_SIZE) {
+        truncated = 1;
+        return 0;
+    }
+    return 1;
+}
+
+
+static inline void _puts(const char *s, size_t n) {
+    if (truncated || buf_i + n + JSONL_SLACK >= JSONL_BUF_SIZE) {
+        truncated = 1;
+        return;
+    }
+    memcpy(buf + buf_i, s, n);
+    buf_i += n;
+}
+
+
+// writes a comma if this is not the first item in the current container
+static inline void _separate() {
+    if (after_key) {
+        after_key = 0;
+        return;
+    }
+    if (has_items[depth]) _putc(',');
+    has_items[depth] = 1;
+}
+
+
+static inline void _push(char open, char close) {
+    if (!_reserve(2)) return;
+    _separate();
+    _putc(open);
+    if (truncated) return;
+    if (depth + 1 < JSONL_MAX_DEPTH) depth++;
+    has_items[depth] = 0;
+    closers[depth] = close;
+}
+
+
+static inline void _pop() {
+    if (!depth) return;
+    _putc_raw(closers[depth]);
+    depth--;
+}
+
+
+void jsonl_begin() {
+    buf_i = 0;
+    truncated = 0;
+    depth = 0;
+    has_items[0] = 0;
+    after_key = 0;
+    _push('{', '}');
+}
+
+
+void jsonl_end(FILE *f) {
+    // close anything the caller (or a truncation) left open so the line is
+    // always valid JSON
+    if (after_key) {
+        _putc_raw('0');
+        after_key = 0;
+    }
+    while (depth) _pop();
+    _putc_raw('\n');
+    fwrite(buf, 1, buf_i, f);
+}
+
+
+void jsonl_begin_object() {
+    _push('{', '}');
+}
+
+
+void jsonl_end_object() {
+    if (!truncated) _pop();
+}
+
+
+void jsonl_begin_array() {
+    _push('[', ']');
+}
+
+
+void jsonl_end_array() {
+    if (!truncated) _pop();
+}
+
+
+void jsonl_strn(const char *s, size_t n) {
+    if (!_reserve(2)) return; // comma and opening quote
+    _separate();
+    _putc('"');
+    for (size_t i = 0; i < n && s[i]; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '\e' && i + 1 < n && s[i + 1] == '[') {
+            // strip ANSI color sequences, they are meaningless outside a terminal
+            i += 2;
+            while (i < n && s[i] && !(s[i] >= 0x40 && s[i] <= 0x7e)) i++;
+            continue;
+        }
+
+        switch (c) {
+            case '"': _puts("\\\"", 2); break;
+            case '\\': _puts("\\\\", 2); break;
+            case '\n': _puts("\\n", 2); break;
+            case '\r': _puts("\\r", 2); break;
+            case '\t': _puts("\\t", 2); break;
+            default:
+                if (c < 0x20) {
+                    char esc[6] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xf]};
+                    _puts(esc, 6);
+                } else {
+                    _putc(c);
+                }
+        }
+    }
+
+    if (truncated) _putc_raw('"'); // terminate the cut-off string
+    else _putc('"');
+}
+
+
+void jsonl_str(const char *s) {
+    jsonl_strn(s, (size_t)-1);
+}
+
+
+void jsonl_key(const char *key) {
+    if (!_reserve(strlen(key) + 4)) return; // keys are plain ascii, never escaped
+    jsonl_str(key);
+    _putc(':');
+    after_key = 1;
+}
+
+
+void jsonl_u64(uint64_t val) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - ++n] = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+
+    if (!_reserve(n + 1)) return;
+    _separate();
+    _puts(tmp + sizeof(tmp) - n, n);
+}
+
+
+// pointers are emitted as "0x..." strings so consumers don't lose precision
+// on values above 2^53
+void jsonl_hex(uint64_t val) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - ++n] = HEX_DIGITS[val & 0xf];
+        val >>= 4;
+    } while (val);
+    tmp[sizeof(tmp) - ++n] = 'x';
+    tmp[sizeof(tmp) - ++n] = '0';
+
+    if (!_reserve(n + 3)) return;
+    _separate();
+    _putc('"');
+    _puts(tmp + sizeof(tmp) - n, n);
+    _putc('"');
+}
+
+
+void jsonl_null() {
+    if (!_reserve(5)) return;
+    _separate();
+    _puts("null", 4);
+}
+
+
+void jsonl_bool(int val) {
+    if (!_reserve(6)) return;
+    _separate();
+    if (val) _puts("true", 4);
+    else _puts("false", 5);
+}
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
+#include "leak.h"
+#include "context.h"
+#include "heap.h"
+#include "logging.h"
+#include "symbol.h"
+#include "jsonl.h"
+
+int OPT_LEAK_CHECK = 0;
+
+/*
+ * --leak-check looks for live chunks that nothing points to anymore, like 
+ * LeakSanitizer. At the tracee's exit, its registers, the live part of its 
+ * stack and every other writable mapping that holds no chunks (data and bss 
+ * of the binary and libraries, thread stacks, TLS) are the roots. Each 
+ * aligned word that points into a live chunk, even into the middle of it, 
+ * marks that chunk, which is then scanned the same way.
+ *
+ * The live chunks are kept in arrays sorted by address (the interval index 
+ * binary searches them). Most words are not pointers into the heap at all, 
+ * so each block is first filtered against the [lowest chunk, highest chunk 
+ * end) span with a branchless loop the compiler vectorizes, and only the 
+ * candidates it keeps are looked up.
+ */
+
+#define MARK_NONE 0 // not reached from any root: leaked
+#define MARK_REACHABLE 1
+#define MARK_INDIRECT 2 // leaked, but referenced by another leaked chunk
+
+typedef struct LeakIndex {
+    uint64_t *begs; // sorted
+    uint64_t *ends;
+    Chunk **chunks;
+    uint8_t *marks;
+    size_t sz;
+    uint64_t lo; // begs[0]
+    uint64_t span; // highest end - lo
+
+    size_t *work; // chunks whose contents still have to be scanned
+    size_t work_sz;
+    uint32_t *hits; // candidate filter output, one slot per word of a block
+    uint8_t *buf; // LEAK_READ_BLOCK bytes
+} LeakIndex;
+
+
+// in-order, without recursion: the tree degenerates into a list when chunks 
+// are allocated at increasing addresses, which is the usual case
+static void _index_chunks(HeaptraceContext *ctx, LeakIndex *idx) {
+    size_t cap = 1024;
+    idx->chunks = (Chunk **)malloc(cap * sizeof(Chunk *));
+    Chunk **stack = (Chunk **)malloc(cap * sizeof(Chunk *));
+    size_t stack_sz = 0;
+    size_t stack_cap = cap;
+    ASSERT(idx->chunks && stack, "_index_chunks: malloc out of memory");
+
+    Chunk *cur = ctx->chunk_root;
+    while (cur || stack_sz) {
+        while (cur) {
+            if (stack_sz == stack_cap) {
+                stack_cap *= 2;
+                stack = (Chunk **)realloc(stack, stack_cap * sizeof(Chunk *));
+                ASSERT(stack, "_index_chunks: realloc out of memory");
+            }
+            stack[stack_sz++] = cur;
+            cur = cur->left;
+        }
+        cur = stack[--stack_sz];
+        if (cur->state == STATE_MALLOC && cur->ptr) {
+            if (idx->sz == cap) {
+                cap *= 2;
+                idx->chunks = (Chunk **)realloc(idx->chunks, cap * sizeof(Chunk *));
+                ASSERT(idx->chunks, "_index_chunks: realloc out of memory");
+            }
+            idx->chunks[idx->sz++] = cur;
+        }
+        cur = cur->right;
+    }
+    free(stack);
+
+    idx->begs = (uint64_t *)malloc((idx->sz + 1) * sizeof(uint64_t));
+    idx->ends = (uint64_t *)malloc((idx->sz + 1) * sizeof(uint64_t));
+    idx->marks = (uint8_t *)calloc(idx->sz + 1, 1);
+    idx->work = (size_t *)malloc((idx->sz + 1) * sizeof(size_t));
+    idx->hits = (uint32_t *)malloc(LEAK_READ_BLOCK / sizeof(uint64_t) * sizeof(uint32_t));
+    idx->buf = (uint8_t *)malloc(LEAK_READ_BLOCK);
+    ASSERT(idx->begs && idx->ends && idx->marks && idx->work && idx->hits && idx->buf, "_index_chunks: malloc out of memory");
+
+    uint64_t hi = 0;
+    for (size_t i = 0; i < idx->sz; i++) {
+        idx->begs[i] = idx->chunks[i]->ptr;
+        // a pointer to a zero-sized chunk still keeps it alive
+        idx->ends[i] = idx->chunks[i]->ptr + (idx->chunks[i]->size ? idx->chunks[i]->size : 1);
+        if (idx->ends[i] > hi) hi = idx->ends[i];
+    }
+    idx->lo = idx->sz ? idx->begs[0] : 0;
+    idx->span = idx->sz ? hi - idx->lo : 0;
+}
+
+
+static void _free_index(LeakIndex *idx) {
+    free(idx->begs);
+    free(idx->ends);
+    free(idx->chunks);
+    free(idx->marks);
+    free(idx->work);
+    free(idx->hits);
+    free(idx->buf);
+}
+
+
+// returns the chunk that contains addr, or -1
+static ssize_t _lookup(LeakIndex *idx, uint64_t addr) {
+    size_t lo = 0;
+    size_t hi = idx->sz;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->begs[mid] <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (!lo || addr >= idx->ends[lo - 1]) return -1;
+    return lo - 1;
+}
+
+
+/*
+ * marks the chunks that the aligned words in data point into. Chunks that 
+ * have no mark yet get `mark` and are queued to be scanned when `queue` is 
+ * set. `self` (or -1) is the chunk the words are from.
+ */
+static void _scan_words(LeakIndex *idx, const uint64_t *words, size_t nwords, uint8_t mark, int queue, ssize_t self) {
+    uint64_t lo = idx->lo;
+    uint64_t span = idx->span;
+    uint32_t *hits = idx->hits;
+    size_t nhits = 0;
+    for (size_t i = 0; i < nwords; i++) {
+        hits[nhits] = i;
+        nhits += (words[i] - lo) < span;
+    }
+
+    for (size_t h = 0; h < nhits; h++) {
+        ssize_t c = _lookup(idx, words[hits[h]]);
+        if (c < 0 || c == self || idx->marks[c]) continue;
+        idx->marks[c] = mark;
+        if (queue) idx->work[idx->work_sz++] = c;
+    }
+}
+
+
+// reads [base, end) of the tracee block by block and scans it as roots
+static void _scan_range(HeaptraceContext *ctx, LeakIndex *idx, uint64_t base, uint64_t end) {
+    base = (base + 7) & ~(uint64_t)7;
+    for (uint64_t addr = base; addr < end; addr += LEAK_READ_BLOCK) {
+        size_t len = end - addr < LEAK_READ_BLOCK ? end - addr : LEAK_READ_BLOCK;
+        struct iovec local = {idx->buf, len};
+        struct iovec remote = {(void *)addr, len};
+        ssize_t nread = process_vm_readv(ctx->pid, &local, 1, &remote, 1, 0);
+        if (nread <= 0) continue; // e.g. a guard page
+        _scan_words(idx, (uint64_t *)idx->buf, nread / sizeof(uint64_t), MARK_REACHABLE, 1, -1);
+    }
+}
+
+
+// scans [base, end) minus the live chunks in it, which are only scanned 
+// once something points to them. Heaps of other arenas and mmapped chunks 
+// share their mappings with real roots, e.g. TLS, thread stacks, or a pool in 
+// .bss with an outside_heap profile.
+static void _scan_gaps(HeaptraceContext *ctx, LeakIndex *idx, uint64_t base, uint64_t end) {
+    ssize_t c = _lookup(idx, base);
+    if (c >= 0) base = idx->ends[c];
+    size_t lo = 0;
+    size_t hi = idx->sz;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->begs[mid] < base) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (size_t i = lo; i < idx->sz && idx->begs[i] < end; i++) {
+        if (idx->begs[i] > base) _scan_range(ctx, idx, base, idx->begs[i]);
+        if (idx->ends[i] > base) base = idx->ends[i];
+    }
+    if (base < end) _scan_range(ctx, idx, base, end);
+}
+
+
+// returns 0 if the tracee is gone, in which case nothing can be scanned
+static int _scan_roots(HeaptraceContext *ctx, LeakIndex *idx) {
+    struct user_regs_struct regs;
+    if (ptrace(PTRACE_GETREGS, ctx->pid, NULL, &regs) == -1) return 0;
+    if (!refresh_proc_maps(ctx->proc_maps)) return 0;
+    _scan_words(idx, (uint64_t *)&regs, sizeof(regs) / sizeof(uint64_t), MARK_REACHABLE, 1, -1);
+
+    ProcMaps *maps = ctx->proc_maps;
+    for (size_t i = 0; i < maps->writable_sz; i++) {
+        ProcMapsRange *range = &maps->writable[i];
+        uint64_t base = range->base;
+        if (range->pet == PROCELF_TYPE_HEAP) continue;
+        if (range->pet == PROCELF_TYPE_STACK && regs.rsp >= base && regs.rsp < range->end) {
+            base = regs.rsp; // below it is dead
+        }
+        _scan_gaps(ctx, idx, base, range->end);
+    }
+    return 1;
+}
+
+
+/*
+ * scans the contents of the chunks in idx->work, reading as many of them as 
+ * fit in one process_vm_readv at a time. Chunks bigger than a block are read 
+ * on their own, a block at a time.
+ */
+static void _drain(HeaptraceContext *ctx, LeakIndex *idx, uint8_t mark, int queue) {
+    struct iovec local[LEAK_READ_IOVS];
+    struct iovec remote[LEAK_READ_IOVS];
+    size_t batch[LEAK_READ_IOVS];
+
+    while (idx->work_sz) {
+        size_t n = 0;
+        size_t used = 0;
+        while (idx->work_sz && n < LEAK_READ_IOVS) {
+            size_t c = idx->work[idx->work_sz - 1];
+            uint64_t len = (idx->ends[c] - idx->begs[c]) & ~(uint64_t)7;
+            if (len > LEAK_READ_BLOCK) {
+                if (n) break; // flush the batch first
+                idx->work_sz--;
+                for (uint64_t off = 0; off < len; off += LEAK_READ_BLOCK) {
+                    size_t part = len - off < LEAK_READ_BLOCK ? len - off : LEAK_READ_BLOCK;
+                    struct iovec l = {idx->buf, part};
+                    struct iovec r = {(void *)(idx->begs[c] + off), part};
+                    ssize_t nread = process_vm_readv(ctx->pid, &l, 1, &r, 1, 0);
+                    if (nread <= 0) break;
+                    _scan_words(idx, (uint64_t *)idx->buf, nread / sizeof(uint64_t), mark, queue, c);
+                }
+                continue;
+            }
+            if (used + len > LEAK_READ_BLOCK) break;
+            idx->work_sz--;
+            if (!len) continue;
+            local[n].iov_base = idx->buf + used;
+            local[n].iov_len = len;
+            remote[n].iov_base = (void *)idx->begs[c];
+            remote[n].iov_len = len;
+            batch[n++] = c;
+            used += len;
+        }
+        if (!n) continue;
+
+        // _scan_words may queue more chunks, but idx->buf is only reused by 
+        // the next batch
+        size_t start = 0;
+        while (start < n) {
+            ssize_t nread = process_vm_readv(ctx->pid, local + start, n - start, remote + start, n - start, 0);
+            if (nread < 0) nread = 0;
+            size_t i = start;
+            for (; i < n && (size_t)nread >= local[i].iov_len; i++) {
+                nread -= local[i].iov_len;
+                _scan_words(idx, local[i].iov_base, local[i].iov_len / sizeof(uint64_t), mark, queue, batch[i]);
+            }
+            start = i + 1; // skip the chunk that could not be read
+        }
+    }
+}
+
+
+static int _cmp_caller(const void *a, const void *b) {
+    const Chunk *x = *(const Chunk **)a;
+    const Chunk *y = *(const Chunk **)b;
+    if (x->caller != y->caller) return x->caller < y->caller ? -1 : 1;
+    return x->ops[STATE_MALLOC] < y->ops[STATE_MALLOC] ? -1 : (x->ops[STATE_MALLOC] > y->ops[STATE_MALLOC]);
+}
+
+
+static int _cmp_site_bytes(const void *a, const void *b) {
+    const LeakSite *x = (const LeakSite *)a;
+    const LeakSite *y = (const LeakSite *)b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return x->addr < y->addr ? -1 : (x->addr > y->addr);
+}
+
+
+static void _group_leaks(LeakStats *st, Chunk **leaks, size_t n) {
+    qsort(leaks, n, sizeof(Chunk *), _cmp_caller);
+    st->sites = (LeakSite *)calloc(n ? n : 1, sizeof(LeakSite));
+    ASSERT(st->sites, "_group_leaks: calloc out of memory");
+    for (size_t i = 0; i < n; i++) {
+        if (!i || leaks[i]->caller != leaks[i - 1]->caller) st->sites[st->sites_sz++].addr = leaks[i]->caller;
+        LeakSite *site = &st->sites[st->sites_sz - 1];
+        if (site->count < sizeof(site->oids) / sizeof(site->oids[0])) site->oids[site->count] = leaks[i]->ops[STATE_MALLOC];
+        site->count++;
+        site->bytes += leaks[i]->size;
+    }
+    qsort(st->sites, st->sites_sz, sizeof(LeakSite), _cmp_site_bytes);
+}
+
+
+// runs the scan once, while the tracee is stopped at its exit
+void leak_scan(HeaptraceContext *ctx) {
+    LeakStats *st = &ctx->leaks;
+    if (!OPT_LEAK_CHECK || st->scanned || !ctx->proc_maps) return;
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    LeakIndex idx = {0};
+    _index_chunks(ctx, &idx);
+    if (idx.sz) {
+        if (!_scan_roots(ctx, &idx)) {
+            // every chunk would look leaked
+            debug("leak_scan: the tracee is gone, not scanning\n");
+            _free_index(&idx);
+            return;
+        }
+        _drain(ctx, &idx, MARK_REACHABLE, 1);
+
+        // what is left leaked. Chunks only other leaked chunks point to are 
+        // indirect leaks.
+        for (size_t c = 0; c < idx.sz; c++) {
+            if (idx.marks[c] == MARK_NONE) idx.work[idx.work_sz++] = c;
+        }
+        _drain(ctx, &idx, MARK_INDIRECT, 0);
+    }
+
+    st->scanned = 1;
+    Chunk **leaks = (Chunk **)malloc((idx.sz ? idx.sz : 1) * sizeof(Chunk *));
+    ASSERT(leaks, "leak_scan: malloc out of memory");
+    size_t nleaks = 0;
+    for (size_t c = 0; c < idx.sz; c++) {
+        Chunk *chunk = idx.chunks[c];
+        if (idx.marks[c] == MARK_REACHABLE) {
+            st->reachable_count++;
+            st->reachable_bytes += chunk->size;
+        } else if (idx.marks[c] == MARK_INDIRECT) {
+            st->indirect_count++;
+            st->indirect_bytes += chunk->size;
+        } else {
+            st->direct_count++;
+            st->direct_bytes += chunk->size;
+            leaks[nleaks++] = chunk;
+        }
+    }
+    _group_leaks(st, leaks, nleaks);
+    free(leaks);
+    _free_index(&idx);
+    debug("leak_scan: scanned %lu chunks in %.2f ms\n", idx.sz, ms_since(&begin));
+}
+
+
+static void _show_leak_stats_jsonl(HeaptraceContext *ctx) {
+    LeakStats *st = &ctx->leaks;
+    for (size_t i = 0; i < st->sites_sz; i++) {
+        LeakSite *site = &st->sites[i];
+        jsonl_begin();
+        jsonl_key("type");
+        jsonl_str("leak");
+        jsonl_key("caller");
+        jsonl_hex(site->addr);
+        jsonl_key("caller_func");
+        jsonl_str(describe_address(ctx, site->addr));
+        jsonl_key("count");
+        jsonl_u64(site->count);
+        jsonl_key("bytes");
+        jsonl_u64(site->bytes);
+        jsonl_key("oids");
+        jsonl_begin_array();
+        for (size_t j = 0; j < site->count && j < sizeof(site->oids) / sizeof(site->oids[0]); j++) jsonl_u64(site->oids[j]);
+        jsonl_end_array();
+        jsonl_end(event_fd);
+    }
+}
+
+
+void show_leak_stats(HeaptraceContext *ctx) {
+    LeakStats *st = &ctx->leaks;
+    if (!st->scanned) return;
+    if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) {
+        _show_leak_stats_jsonl(ctx);
+        return;
+    }
+
+    color_log(COLOR_LOG);
+    if (st->reachable_count) log("... still reachable: " CNT " chunks (" SZ " bytes)\n", st->reachable_count, SZ_ARG(st->reachable_bytes));
+    color_log(COLOR_ERROR);
+    if (st->indirect_count) log("... indirectly lost: " COLOR_ERROR_BOLD "%lu" COLOR_ERROR " chunks (" SZ_ERR " bytes)\n", st->indirect_count, SZ_ARG(st->indirect_bytes));
+    if (st->direct_count) log("... definitely lost: " COLOR_ERROR_BOLD "%lu" COLOR_ERROR " chunks (" SZ_ERR " bytes)\n", st->direct_count, SZ_ARG(st->direct_bytes));
+
+    size_t top = OPT_CALLSITES ? (size_t)OPT_CALLSITES : CALLSITE_DEFAULT_TOP;
+    if (top > st->sites_sz) top = st->sites_sz;
+    if (top) {
+        color_log(COLOR_LOG);
+        log("Definite leaks by call site:\n");
+    }
+    for (size_t i = 0; i < top; i++) {
+        LeakSite *site = &st->sites[i];
+        color_log(COLOR_LOG);
+        log("... ");
+        color_log(COLOR_LOG_BOLD);
+        log("%s", describe_address(ctx, site->addr));
+        color_log(COLOR_LOG);
+        log(" (" U64T "): " CNT " chunks, " SZ_ERR " bytes" COLOR_LOG " (", site->addr, site->count, SZ_ARG(site->bytes));
+        for (size_t j = 0; j < site->count && j < sizeof(site->oids) / sizeof(site->oids[0]); j++) {
+            log("%s" SYM, j ? ", " : "", site->oids[j]);
+        }
+        log("%s)\n", site->count > sizeof(site->oids) / sizeof(site->oids[0]) ? ", ..." : "");
+    }
+    color_log(COLOR_RESET);
+}
+
+
+// adds the totals to the stats record that is being built
+void show_leak_stats_jsonl(HeaptraceContext *ctx) {
+    LeakStats *st = &ctx->leaks;
+    if (!st->scanned) return;
+    jsonl_key("definitely_lost");
+    jsonl_u64(st->direct_count);
+    jsonl_key("definitely_lost_bytes");
+    jsonl_u64(st->direct_bytes);
+    jsonl_key("indirectly_lost");
+    jsonl_u64(st->indirect_count);
+    jsonl_key("indirectly_lost_bytes");
+    jsonl_u64(st->indirect_bytes);
+    jsonl_key("still_reachable");
+    jsonl_u64(st->reachable_count);
+    jsonl_key("still_reachable_bytes");
+    jsonl_u64(st->reachable_bytes);
+}
+
+
+void free_leak_stats(HeaptraceContext *ctx) {
+    free(ctx->leaks.sites);
+    ctx->leaks.sites = 0;
+    ctx->leaks.sites_sz = 0;
+}
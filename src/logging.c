@@ -4,11 +4,15 @@
 #include "logging.h"
 #include "context.h"
 #include "heap.h"
+#include "symbol.h"
+#include "jsonl.h"
 
-FILE *output_fd;
+__thread FILE *output_fd;
+FILE *event_fd;
 int OPT_DEBUG = 0;
 int OPT_VERBOSE = 0;
 int OPT_NO_COLOR = 0;
+int OPT_FORMAT = OUTPUT_FORMAT_TEXT;
 
 #define MIN_TERM_WIDTH 40
 static size_t TERM_WIDTH = MIN_TERM_WIDTH;
@@ -58,7 +62,36 @@ void reset_handler_log_message(HeaptraceContext *ctx) {
     char *warnings = hlm->warnings;
     memset(hlm, 0, sizeof(HandlerLogMessage));
     hlm->warnings = warnings;
-    memset(hlm->warnings, 0, HLM_WARNINGS_SIZE + 1);
+    hlm->warnings[0] = '\x00'; // warnings_sz tracks the length, no need to clear it all
+}
+
+
+/*
+ * --format=jsonl only: the warn_heap/warn_heap2 macros append here instead of
+ * printing. Each warning is stored as a line, and detail lines (warn_heap2)
+ * are prefixed with a tab so print_handler_log_message_2 can nest them.
+ */
+void hlm_add_warning(HeaptraceContext *ctx, int is_detail, const char *fmt, ...) {
+    HandlerLogMessage *hlm = &(ctx->hlm);
+    if (hlm->warnings_sz + 2 >= HLM_WARNINGS_SIZE) return; // full, drop it
+
+    char *ptr = hlm->warnings + hlm->warnings_sz;
+    size_t remaining = HLM_WARNINGS_SIZE - hlm->warnings_sz;
+    if (is_detail) {
+        *(ptr++) = '\t';
+        remaining--;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(ptr, remaining - 1, fmt, args);
+    va_end(args);
+    if (n < 0) n = 0;
+    if (n > remaining - 2) n = remaining - 2;
+
+    ptr[n] = '\n';
+    ptr[n + 1] = '\x00';
+    hlm->warnings_sz = (ptr + n + 1) - hlm->warnings;
 }
 
 
@@ -104,6 +137,19 @@ static inline size_t print_arg(HeaptraceContext *ctx, uint options, uint64_t ptr
 void print_handler_log_message_1(HeaptraceContext *ctx) {
     if (!ctx->hlm.func_name) return;
 
+    if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) {
+        // nothing is printed until the function returns, but the chunk args
+        // point to have to be resolved before the handlers modify them
+        for (int i = 0; i < 3; i++) {
+            ctx->hlm.arg_oid[i] = 0;
+            if (ctx->hlm.arg_options[i] & HLM_OPTION_SYMBOL) {
+                Chunk *chunk = find_chunk(ctx, ctx->hlm.arg_ptr[i]);
+                if (chunk) ctx->hlm.arg_oid[i] = chunk->ops[STATE_MALLOC];
+            }
+        }
+        return;
+    }
+
     update_terminal_width();
 
     size_t cur_width = 0;
@@ -201,8 +247,111 @@ inline static size_t calc_spaces_for_position(size_t cur_width, size_t pos) {
 }
 
 
+// emits one --format=jsonl record for the current operation
+static void print_handler_log_message_jsonl(HeaptraceContext *ctx, int returned) {
+    HandlerLogMessage *hlm = &(ctx->hlm);
+
+    jsonl_begin();
+    jsonl_key("type");
+    jsonl_str("op");
+    jsonl_key("oid");
+    jsonl_u64(ctx->h_oid);
+    jsonl_key("func");
+    jsonl_str(hlm->func_name);
+
+    uint64_t chunk_oid = 0;
+    jsonl_key("args");
+    jsonl_begin_array();
+    for (int i = 0; i < 3; i++) {
+        uint options = hlm->arg_options[i];
+        if (!options) continue;
+        if (options & HLM_OPTION_SIZE) {
+            jsonl_u64(hlm->arg_ptr[i]);
+        } else {
+            jsonl_hex(hlm->arg_ptr[i]);
+            if (!chunk_oid) chunk_oid = hlm->arg_oid[i];
+        }
+    }
+    jsonl_end_array();
+
+    if (chunk_oid) {
+        jsonl_key("chunk");
+        jsonl_u64(chunk_oid);
+    }
+
+    if (!returned) {
+        jsonl_key("returned");
+        jsonl_bool(0);
+    } else if (hlm->ret_options) {
+        jsonl_key("ret");
+        jsonl_hex(hlm->ret_ptr);
+    }
+
+    if (ctx->h_ret_ptr) {
+        jsonl_key("caller");
+        jsonl_hex(ctx->h_ret_ptr);
+        if (OPT_VERBOSE) {
+            jsonl_key("caller_func");
+            jsonl_str(get_source_function(ctx));
+        }
+    }
+
+    if (hlm->bin[0]) {
+        jsonl_key("bin");
+        jsonl_str(hlm->bin);
+    }
+
+    jsonl_key("warnings");
+    jsonl_begin_array();
+    char *line = hlm->warnings;
+    int in_warning = 0;
+    while (*line) {
+        char *eol = strchr(line, '\n');
+        if (!eol) eol = line + strlen(line);
+
+        if (*line == '\t') {
+            if (!in_warning) { // detail without a warning; shouldn't happen
+                jsonl_begin_object();
+                jsonl_key("message");
+                jsonl_str("");
+                jsonl_key("details");
+                jsonl_begin_array();
+                in_warning = 1;
+            }
+            jsonl_strn(line + 1, eol - line - 1);
+        } else {
+            if (in_warning) {
+                jsonl_end_array();
+                jsonl_end_object();
+            }
+            jsonl_begin_object();
+            jsonl_key("message");
+            jsonl_strn(line, eol - line);
+            jsonl_key("details");
+            jsonl_begin_array();
+            in_warning = 1;
+        }
+
+        if (!*eol) break;
+        line = eol + 1;
+    }
+    if (in_warning) {
+        jsonl_end_array();
+        jsonl_end_object();
+    }
+    jsonl_end_array();
+
+    jsonl_end(event_fd);
+}
+
+
 // prints return value, the "notes", etc
 void print_handler_log_message_2(HeaptraceContext *ctx) {
+    if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) {
+        print_handler_log_message_jsonl(ctx, 1);
+        return;
+    }
+
     size_t cur_width = ctx->hlm.cur_width;
 
     if (ctx->hlm.ret_options) {
@@ -266,6 +415,15 @@ void print_handler_log_message_2(HeaptraceContext *ctx) {
 }
 
 
+// called when the process stops while inside of a heap function (e.g. it 
+// crashed on a double free). The text output was already printed by then, 
+// but a jsonl record is only written after the function returns.
+void print_handler_log_message_pending(HeaptraceContext *ctx) {
+    if (OPT_FORMAT != OUTPUT_FORMAT_JSONL || !ctx->hlm.func_name) return;
+    print_handler_log_message_jsonl(ctx, 0);
+}
+
+
 // TODO: convert to elf parsing
 /*void describe_symbol(void *ptr) {
     Dl_info ptrinfo;
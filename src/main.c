@@ -17,6 +17,7 @@
 #include "options.h"
 #include "debugger.h"
 #include "context.h"
+#include "funcid-db.h"
 
 
 uint OPT_ATTACH_PID = 0;
@@ -66,6 +67,10 @@ int main(int argc, char *argv[]) {
     char *chargv[argc + 1];
     int start_at = parse_args(argc, argv);
 
+    if (OPT_FUNCID_BUILD_DB) {
+        exit(funcid_build_db(OPT_FUNCID_BUILD_DB, argv + start_at, argc - start_at));
+    }
+
     if (!OPT_ATTACH_PID) {
         for (int i = start_at; i < argc; i++) {
             chargv[i - start_at] = argv[i];
@@ -10,6 +10,30 @@
 #include "heap.h"
 #include "debugger.h"
 #include "user-breakpoint.h"
+#include "callsite.h"
+#include "addrspace.h"
+#include "cache.h"
+#include "funcid-db.h"
+#include "allocator.h"
+#include "uaf.h"
+#include "redzone.h"
+#include "leak.h"
+#include "heapcheck.h"
+#include "bins.h"
+
+// long options without a short form
+#define LONGOPT_NO_CACHE 256
+#define LONGOPT_FUNCID_DB 257
+#define LONGOPT_FUNCID_BUILD_DB 258
+#define LONGOPT_ALLOCATOR 259
+#define LONGOPT_ALLOCATOR_FILE 260
+#define LONGOPT_REAL_SIZES 261
+#define LONGOPT_CHECK_UAF 262
+#define LONGOPT_REDZONE 263
+#define LONGOPT_LEAK_CHECK 264
+#define LONGOPT_CHECK_HEAP 265
+#define LONGOPT_BINS 266
+#define LONGOPT_SOFT_DIRTY 267
 
 char *symbol_defs_str = "";
 
@@ -47,6 +71,28 @@ static struct option long_options[] = {
     {"output", required_argument, NULL, 'o'},
     {"out", required_argument, NULL, 'o'},
 
+    {"format", required_argument, NULL, 'f'},
+
+    {"callsites", optional_argument, NULL, 'C'},
+
+    {"trace-mmap", no_argument, NULL, 'M'},
+
+    {"allocator", required_argument, NULL, LONGOPT_ALLOCATOR},
+    {"allocator-file", required_argument, NULL, LONGOPT_ALLOCATOR_FILE},
+
+    {"real-sizes", no_argument, NULL, LONGOPT_REAL_SIZES},
+    {"check-uaf", optional_argument, NULL, LONGOPT_CHECK_UAF},
+    {"redzone", optional_argument, NULL, LONGOPT_REDZONE},
+    {"leak-check", no_argument, NULL, LONGOPT_LEAK_CHECK},
+    {"check-heap", optional_argument, NULL, LONGOPT_CHECK_HEAP},
+    {"soft-dirty", no_argument, NULL, LONGOPT_SOFT_DIRTY},
+    {"bins", no_argument, NULL, LONGOPT_BINS},
+
+    {"no-cache", no_argument, NULL, LONGOPT_NO_CACHE},
+
+    {"funcid-db", required_argument, NULL, LONGOPT_FUNCID_DB},
+    {"funcid-build-db", required_argument, NULL, LONGOPT_FUNCID_BUILD_DB},
+
     {NULL, 0, NULL, 0}
 };
 
@@ -100,7 +146,8 @@ static void show_help(char *argv[]) {
 
         PND "-s <sym_defs>, --symbols=<sym_defs>\n"
         IND "Override the values heaptrace detects for the \n"
-        IND "malloc/calloc/free/realloc/reallocarray symbols. \n"
+        IND "malloc/calloc/free/realloc/reallocarray symbols \n"
+        IND "(and memalign, posix_memalign, etc). \n"
         IND "Useful if heaptrace fails to automatically \n"
         IND "identify heap functions in a stripped binary. See \n"
         IND "the wiki for more info.\n"
@@ -129,6 +176,128 @@ static void show_help(char *argv[]) {
         "\n"
         "\n"
 
+        PND "-f <format>, --format=<format>\n"
+        IND "Selects the output format. `text` (default) is \n"
+        IND "meant for humans. `jsonl` writes one JSON object \n"
+        IND "per heap operation plus a final statistics object \n"
+        IND "to the --output file (or /dev/stdout), and \n"
+        IND "heaptrace's own messages to /dev/stderr.\n"
+        "\n"
+        "\n"
+
+        PND "-C[n], --callsites[=n]\n"
+        IND "Aggregates allocations by the address they were \n"
+        IND "called from and prints the top `n` (default 10) \n"
+        IND "leaking and allocating call sites at exit.\n"
+        "\n"
+        "\n"
+
+        PND "-M, --trace-mmap\n"
+        IND "Also tracks calls to mmap, munmap, mremap and \n"
+        IND "sbrk, including the ones malloc makes for large \n"
+        IND "chunks and to grow the heap, and prints their \n"
+        IND "counts and requested sizes at exit. The sizes \n"
+        IND "include calls that failed.\n"
+        "\n"
+        "\n"
+
+        PND "--allocator=<name|ALLOC:FREE[:REALLOC]>\n"
+        IND "Selects the allocator profile to trace: glibc \n"
+        IND "(default), jemalloc, tcmalloc, mimalloc or one \n"
+        IND "from --allocator-file. ALLOC:FREE[:REALLOC] hooks \n"
+        IND "an in-house allocator whose functions take the \n"
+        IND "same arguments as malloc, free and realloc.\n"
+        "\n"
+        "\n"
+
+        PND "--allocator-file=<file>\n"
+        IND "Reads more allocator profiles from `file`. Its \n"
+        IND "first profile is used if --allocator is not set.\n"
+        "\n"
+        "\n"
+
+        PND "--real-sizes\n"
+        IND "Reads the size field of each chunk's glibc \n"
+        IND "header instead of estimating it from the \n"
+        IND "requested size, so the unfreed bytes and call \n"
+        IND "site totals include alignment and mmapped chunks.\n"
+        "\n"
+        "\n"
+
+        PND "--check-uaf[=n]\n"
+        IND "Hashes up to `n` (default 256, at most 131072) \n"
+        IND "bytes of each freed chunk and warns if they \n"
+        IND "changed by the time malloc returns the chunk \n"
+        IND "again or the process exits, catching \n"
+        IND "use-after-free writes.\n"
+        "\n"
+        "\n"
+
+        PND "--redzone[=n]\n"
+        IND "Makes malloc, calloc, realloc and operator new \n"
+        IND "allocate `n` (default 16, at most 4096) extra \n"
+        IND "bytes after each chunk and fills them with a \n"
+        IND "canary, which is checked when the chunk is freed \n"
+        IND "and at exit to catch heap buffer overflows.\n"
+        "\n"
+        "\n"
+        PND "--leak-check\n"
+        IND "At exit, scans the registers, stacks and \n"
+        IND "writable data of the process for pointers to \n"
+        IND "unfreed chunks and reports the ones nothing \n"
+        IND "points to anymore, grouped by caller.\n"
+        "\n"
+        "\n"
+        PND "--check-heap[=n|Tms]\n"
+        IND "Walks glibc's heap after every `n` (default 1) \n"
+        IND "operations, or every `T` milliseconds, checking \n"
+        IND "chunk headers and the tcache and fastbin lists, \n"
+        IND "and reports the first operation after which the \n"
+        IND "heap was inconsistent.\n"
+        "\n"
+        "\n"
+        PND "--soft-dirty\n"
+        IND "Makes --check-heap only read the heap pages the \n"
+        IND "process wrote to since the last walk, using the \n"
+        IND "kernel's soft-dirty bits. Each walk clears them \n"
+        IND "for the whole process and write-protects its \n"
+        IND "pages, which changes its page faults and breaks \n"
+        IND "other users of the bits, e.g. CRIU.\n"
+        "\n"
+        PND "--bins\n"
+        IND "Models glibc's tcache, fastbins and other bins \n"
+        IND "from the heap operations, notes which bin each \n"
+        IND "chunk went to or came from, and warns when malloc \n"
+        IND "returns a different chunk than the model expected.\n"
+        "\n"
+        "\n"
+
+        PND "--no-cache\n"
+        IND "Do not read or write the analysis cache. By \n"
+        IND "default, resolved symbols and the glibc version \n"
+        IND "are cached per ELF build-id in \n"
+        IND "$XDG_CACHE_HOME/heaptrace (or ~/.cache/heaptrace).\n"
+        "\n"
+        "\n"
+
+        PND "--funcid-db=<file>\n"
+        IND "Use the function signature database `file` to \n"
+        IND "identify heap functions in stripped binaries. By \n"
+        IND "default, $XDG_DATA_HOME/heaptrace/funcid.db (or \n"
+        IND "~/.local/share/heaptrace/funcid.db) is used if it \n"
+        IND "exists, then /usr/share/heaptrace/funcid.db, then \n"
+        IND "the built-in signatures.\n"
+        "\n"
+        "\n"
+
+        PND "--funcid-build-db=<file> <libc> [<libc> ...]\n"
+        IND "Writes a function signature database to `file` \n"
+        IND "containing the built-in signatures plus ones \n"
+        IND "extracted from each unstripped `libc` given, then \n"
+        IND "exits.\n"
+        "\n"
+        "\n"
+
         PND "-v, --verbose\n"
         IND "Prints verbose information such as line numbers in\n"
         IND "source code given the required debugging info is\n"
@@ -153,7 +322,7 @@ int parse_args(int argc, char *argv[]) {
     }
 
     extern char **environ;
-    while ((opt = getopt_long(argc, argv, "+hvFDe:s:b:B:G:p:o:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "+hvFMDe:s:b:B:G:p:o:f:C::", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h': {
                 show_help(argv);
@@ -231,18 +400,158 @@ int parse_args(int argc, char *argv[]) {
                 break;
             }
 
+            case 'f': {
+                if (!strcmp(optarg, "text")) {
+                    OPT_FORMAT = OUTPUT_FORMAT_TEXT;
+                } else if (!strcmp(optarg, "jsonl")) {
+                    OPT_FORMAT = OUTPUT_FORMAT_JSONL;
+                } else {
+                    fatal("unknown output format \"%s\".\n", optarg);
+                    log(COLOR_WARN "hint: supported formats are `text` and `jsonl`.\n" COLOR_RESET);
+                    exit(1);
+                }
+                break;
+            }
+
+            case 'C': {
+                OPT_CALLSITES = CALLSITE_DEFAULT_TOP;
+                if (optarg) {
+                    if (!is_uint(optarg) || !atoi(optarg)) {
+                        fatal("invalid number of call sites \"%s\".\n", optarg);
+                        exit(1);
+                    }
+                    OPT_CALLSITES = atoi(optarg);
+                }
+                break;
+            }
+
+            case 'M': {
+                OPT_TRACE_MMAP = 1;
+                break;
+            }
+
+            case LONGOPT_ALLOCATOR: {
+                OPT_ALLOCATOR = strdup(optarg);
+                break;
+            }
+
+            case LONGOPT_ALLOCATOR_FILE: {
+                OPT_ALLOCATOR_FILE = strdup(optarg);
+                break;
+            }
+
+            case LONGOPT_REAL_SIZES: {
+                OPT_REAL_SIZES = 1;
+                break;
+            }
+
+            case LONGOPT_CHECK_UAF: {
+                OPT_CHECK_UAF = UAF_DEFAULT_CAP;
+                if (optarg) {
+                    uint64_t cap = is_uint(optarg) ? strtoul(optarg, 0, 10) : 0;
+                    if (!cap || cap > UAF_MAX_CAP) {
+                        fatal("invalid number of bytes to hash \"%s\", it must be between 1 and %d.\n", optarg, UAF_MAX_CAP);
+                        exit(1);
+                    }
+                    OPT_CHECK_UAF = cap;
+                }
+                break;
+            }
+
+            case LONGOPT_REDZONE: {
+                OPT_REDZONE = REDZONE_DEFAULT_SZ;
+                if (optarg) {
+                    // strtoul saturates instead of wrapping, so huge values are rejected too
+                    uint64_t sz = is_uint(optarg) ? strtoul(optarg, 0, 10) : 0;
+                    if (!sz || sz > REDZONE_MAX_SZ) {
+                        fatal("invalid redzone size \"%s\", it must be between 1 and %d.\n", optarg, REDZONE_MAX_SZ);
+                        exit(1);
+                    }
+                    OPT_REDZONE = sz;
+                }
+                break;
+            }
+
+            case LONGOPT_LEAK_CHECK: {
+                OPT_LEAK_CHECK = 1;
+                break;
+            }
+
+            case LONGOPT_CHECK_HEAP: {
+                OPT_CHECK_HEAP = HEAPCHECK_DEFAULT_OPS;
+                if (optarg && !parse_check_heap(optarg)) {
+                    fatal("invalid heap check interval \"%s\".\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+
+            case LONGOPT_SOFT_DIRTY: {
+                OPT_SOFT_DIRTY = 1;
+                break;
+            }
+
+            case LONGOPT_BINS: {
+                OPT_BINS = 1;
+                break;
+            }
+
+            case LONGOPT_NO_CACHE: {
+                OPT_NO_CACHE = 1;
+                break;
+            }
+
+            case LONGOPT_FUNCID_DB: {
+                OPT_FUNCID_DB = strdup(optarg);
+                break;
+            }
+
+            case LONGOPT_FUNCID_BUILD_DB: {
+                OPT_FUNCID_BUILD_DB = strdup(optarg);
+                break;
+            }
+
             default: {
                 show_help(argv);
             }
         }
     }
 
+    if (OPT_FORMAT == OUTPUT_FORMAT_JSONL) {
+        // keep the record stream clean: records go to --output (or stdout) 
+        // and everything meant for humans goes to stderr
+        event_fd = (output_fd == stderr) ? stdout : output_fd;
+        output_fd = stderr;
+        OPT_NO_COLOR = 1;
+    }
+
+    if (OPT_FUNCID_BUILD_DB && optind == argc) {
+        fatal("you must specify at least one libc to extract signatures from.\n");
+        log(COLOR_WARN "hint: run `%s --help` to see the help menu.\n" COLOR_RESET, argv[0]);
+        exit(1);
+    }
+
     if (!OPT_ATTACH_PID && optind == argc) {
         fatal("you must specify a binary to execute.\n");
         log(COLOR_WARN "hint: run `%s --help` to see the help menu.\n" COLOR_RESET, argv[0]);
         exit(1);
     }
 
+    select_allocator();
+    if (ALLOCATOR->library || ALLOCATOR->outside_heap || ALLOCATOR->entries_sz || ALLOCATOR_CHUNKS != CHUNK_MODEL_GLIBC) {
+        // they all rely on glibc's chunk layout, which pools and other extra 
+        // entry points don't have
+        if (OPT_REAL_SIZES) warn("--real-sizes only works with the glibc allocator, ignoring it.\n");
+        if (OPT_CHECK_UAF) warn("--check-uaf only works with the glibc allocator, ignoring it.\n");
+        if (OPT_CHECK_HEAP || OPT_CHECK_HEAP_MS) warn("--check-heap only works with the glibc allocator, ignoring it.\n");
+        if (OPT_BINS) warn("--bins only works with the glibc allocator, ignoring it.\n");
+        OPT_REAL_SIZES = 0;
+        OPT_CHECK_UAF = 0;
+        OPT_CHECK_HEAP = 0;
+        OPT_CHECK_HEAP_MS = 0;
+        OPT_BINS = 0;
+    }
+
     return optind;
 }
 
@@ -250,8 +559,8 @@ int parse_args(int argc, char *argv[]) {
 void evaluate_symbol_defs(HeaptraceContext *ctx, Breakpoint **bps) {
     if (!strlen(symbol_defs_str)) return;
 
-    ProcMapsEntry *bin_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_BINARY);
-    ProcMapsEntry *libc_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_LIBC);
+    ProcMapsEntry *bin_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_BINARY);
+    ProcMapsEntry *libc_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_LIBC);
     ASSERT(bin_pme, "Target binary is missing from process mappings (!bin_pme in evaluate_symbol_defs). Please report this!");
     uint64_t bin_base = 0;
     uint64_t libc_base = 0;
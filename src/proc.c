@@ -3,21 +3,52 @@
 #include <sys/personality.h>
 #include <linux/auxvec.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 
 #include "proc.h"
 #include "logging.h"
 
 static const int MAX_PATH_SIZE = 4096; // WARNING: If you change this, grep for all uses of 4096! It's hardcoded in a few format strs
+static const size_t PROC_MAPS_INITIAL_BUF = 16384;
+static const size_t PROC_MAPS_MIN_READ = 4096; // grow maps->buf when less than a page is left
 
 
-void free_pme_list(ProcMapsEntry *first_pme) {
-    ProcMapsEntry *pme = first_pme;
-    while(pme) {
+static void _free_pme(ProcMapsEntry *pme) {
+    free(pme->name);
+    free(pme);
+}
+
+
+// the binary and libc entries are referenced by the HeaptraceFiles, so they 
+// have to outlive the maps they came from
+static void _retire_pme(ProcMaps *maps, ProcMapsEntry *pme) {
+    if (pme->pet == PROCELF_TYPE_BINARY || pme->pet == PROCELF_TYPE_LIBC) {
+        pme->_next = maps->retired;
+        maps->retired = pme;
+    } else {
+        _free_pme(pme);
+    }
+}
+
+
+void free_proc_maps(ProcMaps *maps) {
+    if (!maps) return;
+    for (size_t i = 0; i < maps->entries_sz; i++) {
+        _free_pme(maps->entries[i]);
+    }
+    ProcMapsEntry *pme = maps->retired;
+    while (pme) {
         ProcMapsEntry *next_pme = pme->_next;
-        free(pme->name);
-        free(pme);
+        _free_pme(pme);
         pme = next_pme;
     }
+    free(maps->entries);
+    free(maps->writable);
+    free(maps->buf);
+    free(maps->exe_path);
+    free(maps);
 }
 
 
@@ -41,94 +72,247 @@ char *get_path_by_pid(int pid) {
 }
 
 
-ProcMapsEntry *build_pme_list(int pid) {
-    char *fname = get_path_by_pid(pid);
+// reads all of /proc/pid/maps into maps->buf and returns its length, or -1
+static ssize_t _read_maps(ProcMaps *maps) {
+    char mapspath[64];
+    snprintf(mapspath, sizeof(mapspath), "/proc/%d/maps", maps->pid);
+    int fd = open(mapspath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    size_t len = 0;
+    while (1) {
+        if (maps->buf_cap - len < PROC_MAPS_MIN_READ) {
+            maps->buf_cap = maps->buf_cap ? maps->buf_cap * 2 : PROC_MAPS_INITIAL_BUF;
+            maps->buf = realloc(maps->buf, maps->buf_cap);
+            ASSERT(maps->buf, "_read_maps: realloc out of memory");
+        }
+
+        ssize_t nbytes = read(fd, maps->buf + len, maps->buf_cap - len - 1);
+        if (nbytes == -1 && errno == EINTR) continue;
+        if (nbytes == -1) {
+            close(fd);
+            return -1;
+        }
+        if (!nbytes) break;
+        len += nbytes;
+    }
+
+    close(fd);
+    maps->buf[len] = '\x00';
+    return len;
+}
+
+
+static inline char *_skip_field(char *p, char *end) {
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n') p++;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+
+static inline uint64_t _parse_hex(char **pp, char *end) {
+    uint64_t val = 0;
+    char *p = *pp;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c >= '0' && c <= '9') val = (val << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f') val = (val << 4) | (c - 'a' + 10);
+        else break;
+    }
+    *pp = p;
+    return val;
+}
+
+
+static ProcELFType _classify_pme(ProcMaps *maps, const char *name) {
+    if (maps->exe_path && !strcmp(maps->exe_path, name)) {
+        return PROCELF_TYPE_BINARY;
+    } else if (strstr(name, "libc-") || strstr(name, "libc.so")) { // XXX: quite a hack
+        return PROCELF_TYPE_LIBC;
+    } else if (!strcmp("[heap]", name)) {
+        return PROCELF_TYPE_HEAP;
+    } else if (!strcmp("[stack]", name)) {
+        return PROCELF_TYPE_STACK;
+    }
+    return PROCELF_TYPE_UNKNOWN;
+}
+
+
+static void _push_pme(ProcMapsEntry ***arr, size_t *sz, size_t *cap, ProcMapsEntry *pme) {
+    if (*sz == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *arr = realloc(*arr, *cap * sizeof(ProcMapsEntry *));
+        ASSERT(*arr, "_push_pme: realloc out of memory");
+    }
+    (*arr)[(*sz)++] = pme;
+}
 
-    // get the path to the /proc/pid/maps file
-    char *mapspath = malloc(MAX_PATH_SIZE + 1);
-    snprintf(mapspath, MAX_PATH_SIZE, "/proc/%d/maps", pid);
-    FILE *f = fopen(mapspath, "r");
-    if (!f) {
-        warn("failed to open process maps (%s)\n", mapspath);
+
+// re-parses /proc/pid/maps. Both the old entries and the maps file are sorted 
+// by address, so unchanged entries are found in a single merge pass and kept 
+// (pointers to them stay valid).
+int refresh_proc_maps(ProcMaps *maps) {
+    maps->maybe_stale = 0;
+    maps->changed = 0;
+    ssize_t len = _read_maps(maps);
+    if (len == -1) {
+        debug("debug warning: failed to read process maps of pid %d\n", maps->pid);
         return 0;
     }
 
-    
-    ProcMapsEntry *pme_head = 0;
-    ProcMapsEntry *pme = 0;
+    ProcMapsEntry **old = maps->entries;
+    size_t old_sz = maps->entries_sz;
+    size_t old_i = 0;
+    ProcMapsEntry **arr = 0;
+    size_t arr_sz = 0;
+    size_t arr_cap = old_sz;
+    if (arr_cap) arr = malloc(arr_cap * sizeof(ProcMapsEntry *));
 
-    char *cur_fname = malloc(MAX_PATH_SIZE + 2);
-    uint64_t cur_section_base = 0;
-    uint64_t cur_section_end = 0;
-    uint64_t _tmp[9]; // sorry I'm a terible programmer
-    while (1) {
-        #define WH "%*[ \t]c" // whitespace
-        if (fscanf(f, "%lx-%lx" WH, &cur_section_base, &cur_section_end) == EOF) { // 7f738fb9f000-7f738fba0000
-            break;
-        }
+    maps->writable_sz = 0;
+    char *p = maps->buf;
+    char *end = maps->buf + len;
+    while (p < end) {
+        char *eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
 
-        fscanf(f, "%*s" WH);
-        fscanf(f, "%*s" WH);
-        fscanf(f, "%*x:%*x" WH); // 103:08
-        fscanf(f, "%*s" WH);
-
-        memset(cur_fname, 0, MAX_PATH_SIZE + 1);
-        fscanf(f, "%4096[^\n]s\n", cur_fname); // 18615725
-        if (!pme || strcmp(pme->name, cur_fname)) { // if the name changed or first run
-            pme = calloc(1, sizeof(ProcMapsEntry));
-            pme->pet = PROCELF_TYPE_UNKNOWN;
-            pme->name = strdup(cur_fname);
-
-            // insert into list
-            pme->_next = pme_head;
-            pme_head = pme;
-        }
+        // 7f738fb9f000-7f738fba0000 r--p 00000000 103:08 18615725    /usr/lib/libc.so.6
+        uint64_t base = _parse_hex(&p, eol);
+        if (p < eol && *p == '-') p++;
+        uint64_t section_end = _parse_hex(&p, eol);
+        p = _skip_field(p, eol); // whitespace
+        int writable = p + 1 < eol && p[1] == 'w';
+        p = _skip_field(p, eol); // permissions
+        p = _skip_field(p, eol); // offset
+        p = _skip_field(p, eol); // device
+        p = _skip_field(p, eol); // inode
+        char *name = p;
+        *eol = '\x00';
 
-        if (!strcmp(fname, cur_fname)) {
-            pme->pet = PROCELF_TYPE_BINARY;
-        } else if (strstr(cur_fname, "libc-") || strstr(cur_fname, "libc.so")) { // XXX: quite a hack
-            pme->pet = PROCELF_TYPE_LIBC;
-        } else if (!strcmp("[heap]", cur_fname)) {
-            pme->pet = PROCELF_TYPE_HEAP;
-        } else if (!strcmp("[stack]", cur_fname)) {
-            pme->pet = PROCELF_TYPE_STACK;
+        ProcMapsEntry *pme = arr_sz ? arr[arr_sz - 1] : 0;
+        if (pme && !strcmp(pme->name, name)) {
+            // same mapping as the previous line (a different segment of it)
+            if (section_end > pme->end) pme->end = section_end;
+        } else {
+            // reuse the old entry if this mapping is unchanged
+            while (old_i < old_sz && old[old_i]->base < base) {
+                _retire_pme(maps, old[old_i++]);
+            }
+            if (old_i < old_sz && old[old_i]->base == base && !strcmp(old[old_i]->name, name)) {
+                pme = old[old_i++];
+            } else {
+                pme = calloc(1, sizeof(ProcMapsEntry));
+                pme->name = strdup(name);
+            }
+            pme->pet = _classify_pme(maps, name);
+            pme->base = base;
+            pme->end = section_end;
+            _push_pme(&arr, &arr_sz, &arr_cap, pme);
         }
 
-        if (!pme->base || (pme->base && cur_section_base < pme->base)) {
-            pme->base = cur_section_base;
-        }
-        if (!pme->end || (pme->end && cur_section_end > pme->end)) {
-            pme->end = cur_section_end;
+        if (writable) {
+            if (maps->writable_sz == maps->writable_cap) {
+                maps->writable_cap = maps->writable_cap ? maps->writable_cap * 2 : 64;
+                maps->writable = realloc(maps->writable, maps->writable_cap * sizeof(ProcMapsRange));
+                ASSERT(maps->writable, "refresh_proc_maps: realloc out of memory");
+            }
+            ProcMapsRange *range = &maps->writable[maps->writable_sz++];
+            range->pet = pme->pet;
+            range->base = base;
+            range->end = section_end;
         }
 
+        p = eol + 1;
+    }
+
+    while (old_i < old_sz) _retire_pme(maps, old[old_i++]);
+    free(old);
+    maps->entries = arr;
+    maps->entries_sz = arr_sz;
+    maps->entries_cap = arr_cap;
+    maps->last_hit = 0;
+    return 1;
+}
+
+
+ProcMaps *build_proc_maps(int pid) {
+    ProcMaps *maps = calloc(1, sizeof(ProcMaps));
+    maps->pid = pid;
+    maps->exe_path = get_path_by_pid(pid);
+    if (!refresh_proc_maps(maps)) {
+        warn("failed to open process maps (/proc/%d/maps)\n", pid);
+        free_proc_maps(maps);
+        return 0;
+    }
+
+    for (size_t i = 0; i < maps->entries_sz; i++) {
+        ProcMapsEntry *pme = maps->entries[i];
         debug("PME: \"%s\" (%d) = " U64T " - " U64T "\n", pme->name, pme->pet, pme->base, pme->end);
     }
+    return maps;
+}
 
-    fclose(f);
-    free(cur_fname);
-    free(mapspath);
-    free(fname);
 
-    return pme_head;
+// the tracee ran, so new mappings may exist. The next lookup that misses will 
+// re-read the maps.
+void pme_invalidate(ProcMaps *maps) {
+    if (maps) maps->maybe_stale = 1;
 }
 
 
-ProcMapsEntry *pme_walk(ProcMapsEntry *pme_head, ProcELFType pet) {
-    ProcMapsEntry *pme = pme_head;
-    while (pme) {
-        if (pme->pet == pet) break;
-        pme = pme->_next;
+// the tracee is about to map, unmap or move memory. The next lookup will 
+// re-read the maps even if it would have hit.
+void pme_mark_changed(ProcMaps *maps) {
+    if (maps) maps->changed = 1;
+}
+
+
+// finds the first (lowest) entry of a type
+ProcMapsEntry *pme_walk(ProcMaps *maps, ProcELFType pet) {
+    if (!maps) return 0;
+    for (size_t i = 0; i < maps->entries_sz; i++) {
+        if (maps->entries[i]->pet == pet) return maps->entries[i];
     }
-    return pme;
+    return 0;
 }
 
 
-ProcMapsEntry *pme_find_addr(ProcMapsEntry *pme_head, uint64_t addr) {
-    ProcMapsEntry *pme = pme_head;
-    while(pme) {
-        if (addr >= pme->base && addr < pme->end) break;
-        pme = pme->_next;
+// finds the first (lowest) entry whose path contains `needle`
+ProcMapsEntry *pme_find_name(ProcMaps *maps, const char *needle) {
+    if (!maps) return 0;
+    for (size_t i = 0; i < maps->entries_sz; i++) {
+        if (maps->entries[i]->name && strstr(maps->entries[i]->name, needle)) return maps->entries[i];
+    }
+    return 0;
+}
+
+
+static ProcMapsEntry *_pme_search(ProcMaps *maps, uint64_t addr) {
+    // find the last entry with base <= addr
+    size_t lo = 0;
+    size_t hi = maps->entries_sz;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (maps->entries[mid]->base <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (!lo) return 0;
+    ProcMapsEntry *pme = maps->entries[lo - 1];
+    return addr < pme->end ? pme : 0;
+}
+
+
+ProcMapsEntry *pme_find_addr(ProcMaps *maps, uint64_t addr) {
+    if (!maps) return 0;
+    if (maps->changed) refresh_proc_maps(maps);
+    ProcMapsEntry *pme = maps->last_hit;
+    if (pme && addr >= pme->base && addr < pme->end) return pme;
+
+    pme = _pme_search(maps, addr);
+    if (!pme && maps->maybe_stale && refresh_proc_maps(maps)) {
+        pme = _pme_search(maps, addr);
+        debug("re-read process maps for " U64T ", now %zu entries\n", addr, maps->entries_sz);
     }
+    if (pme) maps->last_hit = pme;
     return pme;
 }
 
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <sys/uio.h>
+
+#include "redzone.h"
+#include "context.h"
+#include "heap.h"
+#include "logging.h"
+#include "jsonl.h"
+
+uint64_t OPT_REDZONE = 0;
+
+/*
+ * --redzone asks malloc, calloc, realloc and operator new for OPT_REDZONE 
+ * more bytes than the tracee did by rewriting the size argument in the 
+ * pre handler (see ctx->h_set_args), then fills the extra bytes with a 
+ * canary once the call returns. The canary is checked before the chunk is 
+ * freed or reallocated, and for every live chunk at exit. The trace and the 
+ * chunk metadata keep showing the size the tracee asked for.
+ */
+
+
+static inline uint8_t _canary_byte(uint64_t ptr, uint64_t i) {
+    return (uint8_t)(0xa5 ^ (i * 0x1f) ^ (ptr >> 4));
+}
+
+
+// makes the current pre handler pass size + OPT_REDZONE as argument 
+// `size_arg` instead
+void redzone_grow(HeaptraceContext *ctx, int size_arg, uint64_t size) {
+    ctx->h_redzone = 0;
+    if (!OPT_REDZONE || size + OPT_REDZONE < size) return;
+    ctx->h_redzone = OPT_REDZONE;
+    ctx->h_new_args[size_arg] = size + OPT_REDZONE;
+    ctx->h_set_args |= 1 << size_arg;
+}
+
+
+// writes the canary after a chunk that was allocated with redzone_grow
+void redzone_arm(HeaptraceContext *ctx, Chunk *chunk) {
+    chunk->redzone = 0;
+    chunk->overflow = 0;
+    if (!ctx->h_redzone || !chunk->ptr) return;
+
+    uint8_t canary[REDZONE_MAX_SZ];
+    for (uint64_t i = 0; i < ctx->h_redzone; i++) canary[i] = _canary_byte(chunk->ptr, i);
+    struct iovec local = {canary, ctx->h_redzone};
+    struct iovec remote = {(void *)(chunk->ptr + chunk->size), ctx->h_redzone};
+    if (process_vm_writev(ctx->pid, &local, 1, &remote, 1, 0) == (ssize_t)ctx->h_redzone) {
+        chunk->redzone = ctx->h_redzone;
+    } else {
+        debug("redzone_arm: failed to write the canary of chunk " U64T "\n", chunk->ptr);
+    }
+}
+
+
+// returns how many bytes past the end of the chunk were overwritten
+static uint64_t _overflow(Chunk *chunk, const uint8_t *data) {
+    for (uint64_t i = chunk->redzone; i > 0; i--) {
+        if (data[i - 1] != _canary_byte(chunk->ptr, i - 1)) return i;
+    }
+    return 0;
+}
+
+
+// checks the canary of a live chunk that is about to be released
+void redzone_check(HeaptraceContext *ctx, Chunk *chunk) {
+    if (!chunk || !chunk->redzone) return;
+
+    uint8_t data[REDZONE_MAX_SZ];
+    struct iovec local = {data, chunk->redzone};
+    struct iovec remote = {(void *)(chunk->ptr + chunk->size), chunk->redzone};
+    ssize_t nread = process_vm_readv(ctx->pid, &local, 1, &remote, 1, 0);
+    uint64_t overflow = nread == (ssize_t)chunk->redzone ? _overflow(chunk, data) : 0;
+    chunk->redzone = 0;
+    if (!overflow) return;
+
+    ctx->overflow_count++;
+    warn_heap("chunk " SYM " overflowed by " SZ_ERR " bytes", chunk->ops[STATE_MALLOC], SZ_ARG(overflow));
+    warn_heap2("this indicates a heap buffer overflow past its size of " SZ, SZ_ARG(chunk->size));
+}
+
+
+static void _collect_armed(Chunk *root, Chunk ***arr, size_t *sz, size_t *cap) {
+    if (!root) return;
+    if (root->state == STATE_MALLOC && root->redzone) {
+        if (*sz == *cap) {
+            *cap = *cap ? *cap * 2 : REDZONE_BATCH_SZ;
+            *arr = (Chunk **)realloc(*arr, *cap * sizeof(Chunk *));
+            ASSERT(*arr, "_collect_armed: realloc out of memory");
+        }
+        (*arr)[(*sz)++] = root;
+    }
+    _collect_armed(root->left, arr, sz, cap);
+    _collect_armed(root->right, arr, sz, cap);
+}
+
+
+// checks the canaries of all live chunks in batches. Only works while the 
+// tracee is still around, i.e. at its exit event.
+void redzone_check_all(HeaptraceContext *ctx) {
+    if (!OPT_REDZONE) return;
+
+    Chunk **chunks = 0;
+    size_t n = 0;
+    size_t cap = 0;
+    _collect_armed(ctx->chunk_root, &chunks, &n, &cap);
+
+    struct iovec local[REDZONE_BATCH_SZ];
+    struct iovec remote[REDZONE_BATCH_SZ];
+    uint8_t *buf = (uint8_t *)malloc(REDZONE_BATCH_SZ * OPT_REDZONE);
+    ASSERT(buf, "redzone_check_all: malloc out of memory");
+
+    for (size_t off = 0; off < n; off += REDZONE_BATCH_SZ) {
+        size_t batch = n - off < REDZONE_BATCH_SZ ? n - off : REDZONE_BATCH_SZ;
+        for (size_t i = 0; i < batch; i++) {
+            Chunk *chunk = chunks[off + i];
+            local[i].iov_base = buf + i * OPT_REDZONE;
+            local[i].iov_len = chunk->redzone;
+            remote[i].iov_base = (void *)(chunk->ptr + chunk->size);
+            remote[i].iov_len = chunk->redzone;
+        }
+
+        // a read stops at the first unmapped canary; those chunks are skipped
+        size_t start = 0;
+        while (start < batch) {
+            ssize_t nread = process_vm_readv(ctx->pid, local + start, batch - start, remote + start, batch - start, 0);
+            if (nread < 0) nread = 0;
+            size_t i = start;
+            for (; i < batch && (size_t)nread >= local[i].iov_len; i++) {
+                Chunk *chunk = chunks[off + i];
+                nread -= local[i].iov_len;
+                chunk->overflow = _overflow(chunk, local[i].iov_base);
+                if (chunk->overflow) ctx->overflow_count++;
+                chunk->redzone = 0;
+            }
+            start = i + 1;
+        }
+    }
+    free(buf);
+    free(chunks);
+}
+
+
+static void _show_overflows(HeaptraceContext *ctx, Chunk *root) {
+    if (!root) return;
+    _show_overflows(ctx, root->left);
+    if (root->overflow) {
+        log("... chunk " SYM COLOR_ERROR " (" PTR_ERR ") overflowed by " SZ_ERR " bytes\n", root->ops[STATE_MALLOC], PTR_ARG(root->ptr), SZ_ARG(root->overflow));
+    }
+    _show_overflows(ctx, root->right);
+}
+
+
+void show_redzone_stats(HeaptraceContext *ctx) {
+    if (!OPT_REDZONE || !ctx->overflow_count) return;
+    color_log(COLOR_ERROR);
+    log("... overflowed chunks: " COLOR_ERROR_BOLD "%lu" COLOR_ERROR "\n", ctx->overflow_count);
+    _show_overflows(ctx, ctx->chunk_root);
+    color_log(COLOR_RESET);
+}
+
+
+// adds the counter to the stats record that is being built
+void show_redzone_stats_jsonl(HeaptraceContext *ctx) {
+    if (!OPT_REDZONE) return;
+    jsonl_key("overflowed_chunks");
+    jsonl_u64(ctx->overflow_count);
+}
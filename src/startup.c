@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+
+#include "startup.h"
+#include "symbol.h"
+#include "cache.h"
+#include "funcid-db.h"
+#include "debugger.h"
+#include "logging.h"
+#include "util.h"
+
+static StartupWorker target_worker;
+static StartupWorker libc_worker;
+
+#define LD_SO_CACHE "/etc/ld.so.cache"
+#define LD_SO_CACHE_MAGIC "glibc-ld.so.cache1.1"
+#define LD_SO_CACHE_OLD_MAGIC "ld.so-1.7.0"
+#define LD_SO_CACHE_FLAGS_X8664 0x0303 // FLAG_ELF_LIBC6 | FLAG_X8664_LIB64
+
+typedef struct LdSoCacheHeader {
+    char magic[sizeof(LD_SO_CACHE_MAGIC) - 1];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t _pad[3];
+    uint32_t extension_offset;
+    uint32_t _unused[3];
+} LdSoCacheHeader;
+
+typedef struct LdSoCacheEntry {
+    int32_t flags;
+    uint32_t key; // offsets from the start of LdSoCacheHeader
+    uint32_t value;
+    uint32_t osversion;
+    uint64_t hwcap;
+} LdSoCacheEntry;
+
+
+// the canonical path execvp would run for `path`, searching $PATH if it 
+// has no slash. Returns a malloc'd path or 0.
+char *resolve_target_path(const char *path) {
+    if (!path) return 0;
+    if (strchr(path, '/')) return realpath(path, 0);
+
+    const char *search = getenv("PATH");
+    if (!search) search = "/bin:/usr/bin";
+    char candidate[PATH_MAX];
+    while (*search) {
+        size_t len = strcspn(search, ":");
+        int n = snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, len ? search : ".", path);
+        if (n > 0 && (size_t)n < sizeof(candidate) && !access(candidate, X_OK)) return realpath(candidate, 0);
+        search += len;
+        if (*search == ':') search++;
+    }
+    return 0;
+}
+
+
+// looks `soname` up in the dynamic linker's cache the way ld.so does for 
+// x86-64 libraries
+static char *_ld_so_cache_lookup(const char *soname) {
+    ElfImage *img = elf_image_open(LD_SO_CACHE); // not an ELF, just mapped
+    if (!img) return 0;
+
+    // a cache in the old format may come first, followed by the new one
+    size_t hdr_off = 0;
+    if (img->size >= sizeof(LD_SO_CACHE_OLD_MAGIC) + 3 && !memcmp(img->bytes, LD_SO_CACHE_OLD_MAGIC, sizeof(LD_SO_CACHE_OLD_MAGIC) - 1)) {
+        uint32_t old_nlibs;
+        memcpy(&old_nlibs, img->bytes + sizeof(LD_SO_CACHE_OLD_MAGIC) - 1, sizeof(old_nlibs));
+        hdr_off = (sizeof(LD_SO_CACHE_OLD_MAGIC) - 1 + sizeof(uint32_t) + (size_t)old_nlibs * 12 + 7) & ~(size_t)7;
+    }
+
+    char *result = 0;
+    LdSoCacheHeader *hdr = (LdSoCacheHeader *)(img->bytes + hdr_off);
+    if (!elf_image_range_ok(img, hdr_off, sizeof(LdSoCacheHeader)) || memcmp(hdr->magic, LD_SO_CACHE_MAGIC, sizeof(hdr->magic))) goto done;
+    if (!elf_image_range_ok(img, hdr_off + sizeof(LdSoCacheHeader), (uint64_t)hdr->nlibs * sizeof(LdSoCacheEntry))) goto done;
+
+    const char *strings = (const char *)hdr;
+    size_t strings_sz = img->size - hdr_off;
+    LdSoCacheEntry *entries = (LdSoCacheEntry *)(hdr + 1);
+    for (uint32_t i = 0; i < hdr->nlibs; i++) {
+        if ((entries[i].flags & 0xffff) != LD_SO_CACHE_FLAGS_X8664) continue;
+        if (entries[i].key >= strings_sz || entries[i].value >= strings_sz) continue;
+        if (strncmp(strings + entries[i].key, soname, strings_sz - entries[i].key)) continue;
+        if (strnlen(strings + entries[i].value, strings_sz - entries[i].value) == strings_sz - entries[i].value) continue;
+        result = realpath(strings + entries[i].value, 0);
+        if (result) break;
+    }
+
+done:
+    elf_image_close(img);
+    return result;
+}
+
+
+// whether the ELF at `path` asks for a program interpreter, i.e. will load 
+// a libc. Only reads the headers.
+static int _has_interp(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    Elf64_Ehdr ehdr;
+    int has_interp = 0;
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) == sizeof(ehdr) && !memcmp(ehdr.e_ident, ELFMAG, SELFMAG)
+            && ehdr.e_ident[EI_CLASS] == ELFCLASS64 && ehdr.e_phentsize == sizeof(Elf64_Phdr) && ehdr.e_phnum < 256) {
+        Elf64_Phdr phdrs[256];
+        size_t sz = ehdr.e_phnum * sizeof(Elf64_Phdr);
+        if (pread(fd, phdrs, sz, ehdr.e_phoff) == (ssize_t)sz) {
+            for (int i = 0; i < ehdr.e_phnum; i++) has_interp |= phdrs[i].p_type == PT_INTERP;
+        }
+    }
+    close(fd);
+    return has_interp;
+}
+
+
+// the libc a dynamic target will most likely load: libc.so.6 from 
+// $LD_LIBRARY_PATH, then the ld.so cache, then the default directories. 
+// Returns a malloc'd canonical path, or 0 for static targets.
+char *resolve_libc_path(const char *target_path) {
+    if (!target_path || !_has_interp(target_path)) return 0;
+
+    char candidate[PATH_MAX];
+    const char *search = getenv("LD_LIBRARY_PATH");
+    while (search && *search) {
+        size_t len = strcspn(search, ":;");
+        int n = snprintf(candidate, sizeof(candidate), "%.*s/libc.so.6", (int)len, len ? search : ".");
+        if (n > 0 && (size_t)n < sizeof(candidate) && !access(candidate, R_OK)) return realpath(candidate, 0);
+        search += len;
+        if (*search) search++;
+    }
+
+    char *path = _ld_so_cache_lookup("libc.so.6");
+    if (path) return path;
+
+    const char *dirs[] = {"/lib64", "/usr/lib64", "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib", "/usr/lib"};
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(candidate, sizeof(candidate), "%s/libc.so.6", dirs[i]);
+        if (!access(candidate, R_OK)) return realpath(candidate, 0);
+    }
+    return 0;
+}
+
+
+static void *_run_worker(void *arg) {
+    StartupWorker *w = (StartupWorker *)arg;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // everything this thread prints is kept in w->log, and a failed ASSERT 
+    // lands at the setjmp below instead of aborting
+    output_fd = open_memstream(&w->log, &w->log_sz);
+    if (!output_fd) {
+        w->failed = 1;
+        return 0;
+    }
+
+    jmp_buf env;
+    if (setjmp(env)) {
+        w->failed = 1;
+    } else {
+        assert_jmp = &env;
+        if (w->is_libc) {
+            if (!cache_load(w->hf, w->names, &w->version)) lookup_libc_symbols(w->hf, w->names);
+            if (!w->version) w->version = get_libc_version(get_file_image(w->hf));
+        } else {
+            if (!cache_load(w->hf, w->names, 0)) lookup_symbols(w->hf, w->names);
+        }
+    }
+    assert_jmp = 0;
+    fclose(output_fd);
+    output_fd = 0;
+
+    w->ms = ms_since(&start);
+    return 0;
+}
+
+
+static void _start_worker(HeaptraceContext *ctx, StartupWorker *w, const char *path, int is_libc) {
+    memset(w, 0, sizeof(StartupWorker));
+    w->is_libc = is_libc;
+    w->names = ctx->se_names;
+    w->hf = alloc_file(ctx);
+    w->hf->path = strdup(path);
+    if (pthread_create(&w->thread, 0, _run_worker, w)) {
+        debug("failed to start the %s analysis worker\n", is_libc ? "libc" : "target");
+        free(w->hf->path);
+        free(w->hf);
+        w->hf = 0;
+        return;
+    }
+    w->running = 1;
+}
+
+
+static void _free_worker_file(HeaptraceFile *hf) {
+    free_se_list(hf->se_head);
+    free_static_symbols(hf);
+    elf_image_close(hf->elf);
+    free(hf->path);
+    free(hf);
+}
+
+
+// waits for w. Returns its file if it analyzed `path`, otherwise discards it
+static HeaptraceFile *_join_worker(StartupWorker *w, const char *path) {
+    if (!w->running) return 0;
+    pthread_join(w->thread, 0);
+    w->running = 0;
+
+    HeaptraceFile *hf = w->hf;
+    char *log = w->log;
+    w->hf = 0;
+    w->log = 0;
+    if (w->failed) {
+        // hf was left half-analyzed, so it is dropped rather than freed
+        debug("the %s analysis worker failed on %s\n", w->is_libc ? "libc" : "target", hf->path);
+        free(log);
+        free(w->version);
+        w->version = 0;
+        return 0;
+    }
+    if (!path || strcmp(hf->path, path)) {
+        debug("discarding %s analysis of %s, the tracee mapped %s instead\n", w->is_libc ? "libc" : "target", hf->path, path ? path : "nothing");
+        _free_worker_file(hf);
+        free(log);
+        free(w->version);
+        w->version = 0;
+        return 0;
+    }
+
+    if (log) fputs(log, output_fd);
+    free(log);
+    debug("adopted %s analysis of %s from its worker (%.2f ms)\n", w->is_libc ? "libc" : "target", hf->path, w->ms);
+    return hf;
+}
+
+
+// starts analyzing target_path and libc_path (either may be 0) in the 
+// background. ctx->se_names must already be set up.
+void start_startup_workers(HeaptraceContext *ctx, const char *target_path, const char *libc_path) {
+    // with a single CPU the workers could only slow the tracee down
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        debug("not starting analysis workers on a single CPU\n");
+        return;
+    }
+    funcid_db_stamp(); // part of the cache key, computed once before the workers race for it
+    if (target_path) _start_worker(ctx, &target_worker, target_path, 0);
+    if (libc_path) _start_worker(ctx, &libc_worker, libc_path, 1);
+}
+
+
+// adopts the target analysis if it was of ctx->target->path. Returns 1 if 
+// ctx->target is now analyzed.
+int join_target_worker(HeaptraceContext *ctx) {
+    HeaptraceFile *hf = _join_worker(&target_worker, ctx->target->path);
+    if (!hf) return 0;
+
+    free(hf->path);
+    hf->path = ctx->target->path;
+    hf->pme = ctx->target->pme;
+    free(ctx->target);
+    ctx->target = hf;
+    return 1;
+}
+
+
+// adopts the libc analysis (and version) if it was of libc_path. Returns 1 
+// if ctx->libc is now analyzed.
+int join_libc_worker(HeaptraceContext *ctx, const char *libc_path) {
+    HeaptraceFile *hf = _join_worker(&libc_worker, libc_path);
+    if (!hf) return 0;
+
+    free(hf->path);
+    hf->path = ctx->libc->path;
+    hf->pme = ctx->libc->pme;
+    free(ctx->libc);
+    ctx->libc = hf;
+
+    if (!ctx->libc_version) ctx->libc_version = libc_worker.version;
+    else free(libc_worker.version);
+    libc_worker.version = 0;
+    return 1;
+}
+
+
+// waits for and discards anything that was never joined
+void cancel_startup_workers() {
+    HeaptraceFile *hf;
+    if ((hf = _join_worker(&target_worker, 0))) _free_worker_file(hf);
+    if ((hf = _join_worker(&libc_worker, 0))) _free_worker_file(hf);
+}
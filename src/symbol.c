@@ -5,6 +5,242 @@
 
 #define _CHECK_BOUNDS(ptr, msg) { ASSERT((void *)(ptr) >= (void *)tbytes && (void *)(ptr) < (void *)tbytes + tfile_size, "invalid ELF; bounds check failed for " msg); }
 
+
+/*
+ * Open-addressing hash set of the names passed to lookup_symbols, so every 
+ * ELF symbol costs one hash + (usually) zero strcmp's instead of one strcmp 
+ * per requested name.
+ */
+typedef struct NameSlot {
+    const char *name; // 0 if the slot is empty
+    uint32_t hash;
+
+    // indices of the .dynsym entries with this name, in .dynsym order
+    size_t *dynsym_matches;
+    size_t dynsym_matches_sz;
+    size_t dynsym_matches_cap;
+} NameSlot;
+
+typedef struct NameSet {
+    NameSlot *slots;
+    size_t cap; // power of 2
+} NameSet;
+
+
+static inline uint32_t _hash_name(const char *name) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*(name++);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+static NameSlot *_name_set_find(NameSet *set, const char *name, uint32_t hash) {
+    size_t i = hash & (set->cap - 1);
+    while (set->slots[i].name) {
+        if (set->slots[i].hash == hash && !strcmp(set->slots[i].name, name)) return &set->slots[i];
+        i = (i + 1) & (set->cap - 1);
+    }
+    return 0;
+}
+
+
+static void _name_set_init(NameSet *set, SymbolEntry *se_head) {
+    size_t n = 0;
+    for (SymbolEntry *cse = se_head; cse; cse = cse->_next) n++;
+
+    set->cap = 16;
+    while (set->cap < n * 2) set->cap *= 2;
+    set->slots = (NameSlot *)calloc(set->cap, sizeof(NameSlot));
+
+    for (SymbolEntry *cse = se_head; cse; cse = cse->_next) {
+        uint32_t hash = _hash_name(cse->name);
+        if (_name_set_find(set, cse->name, hash)) continue; // duplicate name
+
+        size_t i = hash & (set->cap - 1);
+        while (set->slots[i].name) i = (i + 1) & (set->cap - 1);
+        set->slots[i].name = cse->name;
+        set->slots[i].hash = hash;
+    }
+}
+
+
+static void _name_set_free(NameSet *set) {
+    for (size_t i = 0; i < set->cap; i++) {
+        free(set->slots[i].dynsym_matches);
+    }
+    free(set->slots);
+}
+
+
+static void _name_slot_add_match(NameSlot *slot, size_t j) {
+    if (slot->dynsym_matches_sz == slot->dynsym_matches_cap) {
+        slot->dynsym_matches_cap = slot->dynsym_matches_cap ? slot->dynsym_matches_cap * 2 : 4;
+        slot->dynsym_matches = (size_t *)realloc(slot->dynsym_matches, slot->dynsym_matches_cap * sizeof(size_t));
+    }
+    slot->dynsym_matches[slot->dynsym_matches_sz++] = j;
+}
+
+
+/*
+ * Symbol lookups through the PT_DYNAMIC segment. This only needs program 
+ * headers, so it works on binaries whose section headers were stripped, and 
+ * the hash tables make each lookup O(1) instead of a walk over .dynsym.
+ */
+typedef struct DynamicSymtab {
+    char *bytes;
+    size_t size;
+    Elf64_Phdr *loads; // PT_LOAD headers, used to translate vaddrs
+    size_t loads_sz;
+
+    Elf64_Sym *symtab;
+    char *strtab;
+    size_t strtab_sz;
+    uint16_t *versym;
+    uint32_t *gnu_hash;
+    uint32_t *sysv_hash;
+} DynamicSymtab;
+
+
+// translates a vaddr to a pointer into the file, or 0 if it's not file-backed
+static void *_dyn_vaddr_ptr(DynamicSymtab *ds, uint64_t vaddr, size_t len) {
+    for (size_t i = 0; i < ds->loads_sz; i++) {
+        Elf64_Phdr *load = &ds->loads[i];
+        if (vaddr >= load->p_vaddr && vaddr - load->p_vaddr < load->p_filesz) {
+            uint64_t off = load->p_offset + (vaddr - load->p_vaddr);
+            if (off > ds->size || len > ds->size - off) return 0;
+            return ds->bytes + off;
+        }
+    }
+    return 0;
+}
+
+
+// returns 1 if the whole range [ptr, ptr+len) is inside the file
+static inline int _dyn_in_bounds(DynamicSymtab *ds, void *ptr, size_t len) {
+    return (char *)ptr >= ds->bytes && (size_t)((char *)ptr - ds->bytes) <= ds->size && len <= ds->size - (size_t)((char *)ptr - ds->bytes);
+}
+
+
+static int _init_dynamic_symtab(DynamicSymtab *ds, char *bytes, size_t size, Elf64_Ehdr *elf_hdr) {
+    memset(ds, 0, sizeof(DynamicSymtab));
+    ds->bytes = bytes;
+    ds->size = size;
+
+    if (elf_hdr->e_phentsize != sizeof(Elf64_Phdr)) return 0;
+    if (elf_hdr->e_phoff > size || (size_t)elf_hdr->e_phnum * sizeof(Elf64_Phdr) > size - elf_hdr->e_phoff) return 0;
+    Elf64_Phdr *phdrs = (Elf64_Phdr *)(bytes + elf_hdr->e_phoff);
+
+    Elf64_Phdr *dynamic = 0;
+    ds->loads = (Elf64_Phdr *)malloc(elf_hdr->e_phnum * sizeof(Elf64_Phdr));
+    for (uint16_t i = 0; i < elf_hdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD) ds->loads[ds->loads_sz++] = phdrs[i];
+        else if (phdrs[i].p_type == PT_DYNAMIC) dynamic = &phdrs[i];
+    }
+    if (!dynamic || dynamic->p_offset > size || dynamic->p_filesz > size - dynamic->p_offset) return 0;
+
+    Elf64_Dyn *dyn = (Elf64_Dyn *)(bytes + dynamic->p_offset);
+    size_t dyn_count = dynamic->p_filesz / sizeof(Elf64_Dyn);
+    for (size_t i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; i++) {
+        uint64_t ptr = dyn[i].d_un.d_ptr;
+        switch (dyn[i].d_tag) {
+            case DT_SYMTAB: ds->symtab = (Elf64_Sym *)_dyn_vaddr_ptr(ds, ptr, sizeof(Elf64_Sym)); break;
+            case DT_STRTAB: ds->strtab = (char *)_dyn_vaddr_ptr(ds, ptr, 1); break;
+            case DT_STRSZ: ds->strtab_sz = (size_t)dyn[i].d_un.d_val; break;
+            case DT_VERSYM: ds->versym = (uint16_t *)_dyn_vaddr_ptr(ds, ptr, sizeof(uint16_t)); break;
+            case DT_GNU_HASH: ds->gnu_hash = (uint32_t *)_dyn_vaddr_ptr(ds, ptr, 4 * sizeof(uint32_t)); break;
+            case DT_HASH: ds->sysv_hash = (uint32_t *)_dyn_vaddr_ptr(ds, ptr, 2 * sizeof(uint32_t)); break;
+        }
+    }
+
+    if (ds->strtab && !_dyn_in_bounds(ds, ds->strtab, ds->strtab_sz)) ds->strtab_sz = ds->size - (size_t)(ds->strtab - ds->bytes);
+
+    // a GNU hash header that can't be used (no buckets or bloom words, or a 
+    // bloom shift the 32-bit hash can't take) leaves DT_HASH or the .symtab scan
+    uint32_t *gh = ds->gnu_hash;
+    if (gh && (!gh[0] || !gh[2] || gh[3] >= 32)) ds->gnu_hash = 0;
+    return ds->symtab && ds->strtab && (ds->gnu_hash || ds->sysv_hash);
+}
+
+
+static void _free_dynamic_symtab(DynamicSymtab *ds) {
+    free(ds->loads);
+    ds->loads = 0;
+}
+
+
+// checks that symbol i is a defined, default-version symbol called `name`
+static int _dyn_sym_matches(DynamicSymtab *ds, uint32_t i, const char *name) {
+    Elf64_Sym *sym = &ds->symtab[i];
+    if (!_dyn_in_bounds(ds, sym, sizeof(Elf64_Sym))) return 0;
+    if (sym->st_shndx == SHN_UNDEF || !sym->st_value) return 0;
+    if (ds->versym && _dyn_in_bounds(ds, &ds->versym[i], sizeof(uint16_t)) && (ds->versym[i] & 0x8000)) return 0; // hidden (non-default) version
+    if (sym->st_name >= ds->strtab_sz) return 0;
+    return !strncmp(ds->strtab + sym->st_name, name, ds->strtab_sz - sym->st_name) && strlen(name) < ds->strtab_sz - sym->st_name;
+}
+
+
+static Elf64_Sym *_gnu_hash_lookup(DynamicSymtab *ds, const char *name) {
+    uint32_t *hdr = ds->gnu_hash;
+    uint32_t nbuckets = hdr[0], symoffset = hdr[1], bloom_size = hdr[2], bloom_shift = hdr[3]; // checked by _init_dynamic_symtab
+
+    uint64_t *bloom = (uint64_t *)(hdr + 4);
+    uint32_t *buckets = (uint32_t *)(bloom + bloom_size);
+    uint32_t *chain = buckets + nbuckets;
+    if (!_dyn_in_bounds(ds, bloom, bloom_size * sizeof(uint64_t) + nbuckets * sizeof(uint32_t))) return 0;
+
+    uint32_t h = 5381;
+    for (const unsigned char *c = (const unsigned char *)name; *c; c++) h = (h << 5) + h + *c;
+
+    // the bloom filter rejects most missing names without touching the chains
+    uint64_t word = bloom[(h / 64) % bloom_size];
+    uint64_t mask = ((uint64_t)1 << (h % 64)) | ((uint64_t)1 << ((h >> bloom_shift) % 64));
+    if ((word & mask) != mask) return 0;
+
+    uint32_t i = buckets[h % nbuckets];
+    if (i < symoffset) return 0;
+    while (1) {
+        uint32_t *chain_h = &chain[i - symoffset];
+        if (!_dyn_in_bounds(ds, chain_h, sizeof(uint32_t))) return 0;
+        if ((*chain_h | 1) == (h | 1) && _dyn_sym_matches(ds, i, name)) return &ds->symtab[i];
+        if (*chain_h & 1) return 0; // end of chain
+        i++;
+    }
+}
+
+
+static Elf64_Sym *_sysv_hash_lookup(DynamicSymtab *ds, const char *name) {
+    uint32_t nbucket = ds->sysv_hash[0], nchain = ds->sysv_hash[1];
+    uint32_t *bucket = ds->sysv_hash + 2;
+    uint32_t *chain = bucket + nbucket;
+    if (!nbucket || !_dyn_in_bounds(ds, bucket, ((size_t)nbucket + nchain) * sizeof(uint32_t))) return 0;
+
+    uint32_t h = 0;
+    for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+        h = (h << 4) + *c;
+        uint32_t g = h & 0xf0000000;
+        if (g) h ^= g >> 24;
+        h &= ~g;
+    }
+
+    // bounded by nchain so a corrupted chain can't loop forever
+    uint32_t i = bucket[h % nbucket];
+    for (uint32_t n = 0; i != STN_UNDEF && i < nchain && n < nchain; n++, i = chain[i]) {
+        if (_dyn_sym_matches(ds, i, name)) return &ds->symtab[i];
+    }
+    return 0;
+}
+
+
+static Elf64_Sym *_dynamic_symtab_lookup(DynamicSymtab *ds, const char *name) {
+    if (ds->gnu_hash) return _gnu_hash_lookup(ds, name);
+    return _sysv_hash_lookup(ds, name);
+}
+
+
 void lookup_symbols(HeaptraceFile *hf, char *names[]) {
     // init list of symbolentries
     SymbolEntry *se_head = 0;
@@ -22,64 +258,43 @@ void lookup_symbols(HeaptraceFile *hf, char *names[]) {
         cur_se = se;
         names_i++;
     }
-    if (!se_head) {
-        free(hf->se_head);
-        hf->se_head = 0;
-        return;
-    }
-
-    FILE *tfile = fopen(hf->path, "r");
-    if (tfile == 0) {
+    ElfImage *img = get_file_image(hf);
+    if (!img) {
         fatal("failed to open target.\n");
-        free(hf->se_head);
-        hf->se_head = 0;
-        return;
-    }
-    if (fseek(tfile, 0, SEEK_END)) {
-        fclose(tfile);
-        fatal("failed to seek target.\n");
-        free(hf->se_head);
-        hf->se_head = 0;
+        free_se_list(se_head);
         return;
     }
-    long tfile_size = ftell(tfile);
-
-    void *tbytes = mmap(0, (size_t)tfile_size, PROT_READ, MAP_PRIVATE, fileno(tfile), 0);
-
-    if (tbytes == 0) {
-        fclose(tfile);
-        ASSERT(tbytes != 0, "mmap() failed in lookup_symbols");
-        free(hf->se_head);
-        hf->se_head = 0;
+    void *tbytes = img->bytes;
+    size_t tfile_size = img->size;
+    if (tfile_size < sizeof(Elf64_Ehdr)) {
+        fatal("target is not an ELF executable.\n");
+        free_se_list(se_head);
         return;
     }
 
-    fclose(tfile);
-
     const unsigned char expected_magic[] = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3};
     Elf64_Ehdr elf_hdr;
     memmove(&elf_hdr, tbytes, sizeof(elf_hdr));
     if (memcmp(elf_hdr.e_ident, expected_magic, sizeof(expected_magic)) != 0) {
         fatal("target is not an ELF executable.\n");
-        free(hf->se_head);
-        hf->se_head = 0;
+        free_se_list(se_head);
         return;
     }
     if (elf_hdr.e_ident[EI_CLASS] != ELFCLASS64) {
         fatal("target is not an ELF64 executable.\n");
-        free(hf->se_head);
-        hf->se_head = 0;
+        free_se_list(se_head);
         return;
     }
     if (elf_hdr.e_machine != EM_X86_64) {
         fatal("target is not x86-64.\n");
-        free(hf->se_head);
-        hf->se_head = 0;
+        free_se_list(se_head);
         return;
     }
 
-    size_t string_index = elf_hdr.e_shstrndx;
-    uint64_t string_offset;
+    // the static symbol names below point straight into hf->elf, which 
+    // stays mapped until the file is freed
+    free_static_symbols(hf);
+
     uint64_t load_addr = 0;
     char *cbytes = (char *)tbytes;
     uint is_dynamic = 0;
@@ -112,20 +327,18 @@ void lookup_symbols(HeaptraceFile *hf, char *names[]) {
     size_t rela_plt_off = 0;
     size_t rela_plt_sz = 0;
 
-    // find sh_offset of string_index
-    for (uint16_t i = 0; i < elf_hdr.e_shnum; i++) {
-        size_t offset = elf_hdr.e_shoff + i * elf_hdr.e_shentsize;
+    // find .plt, symtab, .strtab offsets in a single pass. The section name 
+    // string table is indexed directly instead of being searched for.
+    uint64_t string_offset = 0;
+    if (elf_hdr.e_shstrndx != SHN_UNDEF && elf_hdr.e_shstrndx < elf_hdr.e_shnum) {
+        size_t offset = elf_hdr.e_shoff + elf_hdr.e_shstrndx * elf_hdr.e_shentsize;
         Elf64_Shdr shdr;
         _CHECK_BOUNDS(tbytes + offset, "string_offset: tbytes + offset");
         memmove(&shdr, tbytes + offset, sizeof(shdr));
-        if (string_index == i) {
-            string_offset = shdr.sh_offset;
-            break;
-        }
+        string_offset = shdr.sh_offset;
     }
 
-    // find .plt, symtab, .strtab offsets
-    for (uint16_t i = 0; i < elf_hdr.e_shnum; i++) {
+    for (uint16_t i = 0; string_offset && i < elf_hdr.e_shnum; i++) {
         size_t offset = elf_hdr.e_shoff + i * elf_hdr.e_shentsize;
         Elf64_Shdr shdr;
         _CHECK_BOUNDS(tbytes + offset, "shdr: tbytes + offset");
@@ -153,177 +366,328 @@ void lookup_symbols(HeaptraceFile *hf, char *names[]) {
         }
     }
 
-    // resolve dynamic (libc) symbols
-    if (rela_dyn_off && dynstr_off && dynsym_off) {
-        int rela_offsets_sz = (dynsym_sz / sizeof(Elf64_Sym)) + 1;
-        size_t rela_offsets[rela_offsets_sz];
-        for (int k = 0; k < rela_offsets_sz; k++) rela_offsets[k] = 0;
+    NameSet names_set;
+    _name_set_init(&names_set, se_head);
 
-        for (size_t j = 0; j * sizeof(Elf64_Rela) < rela_dyn_sz; j++) {
+    // resolve dynamic (libc and plt) symbols
+    if ((rela_dyn_off || rela_plt_off) && dynstr_off && dynsym_off) {
+        size_t dynsym_count = dynsym_sz / sizeof(Elf64_Sym);
+        size_t rela_offsets_sz = dynsym_count + 1;
+        uint64_t *rela_dyn_offsets = (uint64_t *)calloc(rela_offsets_sz, sizeof(uint64_t));
+        uint64_t *rela_plt_offsets = (uint64_t *)calloc(rela_offsets_sz, sizeof(uint64_t));
+
+        for (size_t j = 0; rela_dyn_off && j * sizeof(Elf64_Rela) < rela_dyn_sz; j++) {
             Elf64_Rela rela;
             size_t absoffset = rela_dyn_off + j * sizeof(Elf64_Rela);
             _CHECK_BOUNDS(cbytes + absoffset, "rela: cbytes + absoffset");
             memmove(&rela, cbytes + absoffset, sizeof(rela));
-            //printf("rela libc: 0x%x (%d)\n", rela.r_offset, ELF64_R_SYM(rela.r_info));
             if (ELF64_R_TYPE(rela.r_info) == R_X86_64_GLOB_DAT) {
-                unsigned int sym_i = ELF64_R_SYM(rela.r_info);
+                size_t sym_i = ELF64_R_SYM(rela.r_info);
                 ASSERT(sym_i < rela_offsets_sz, "rela");
-                rela_offsets[sym_i] = rela.r_offset;
+                rela_dyn_offsets[sym_i] = rela.r_offset;
             }
         }
 
-        int ji = 0;
-        for (size_t j = 0; j * sizeof(Elf64_Sym) < dynsym_sz; j++) {
-            Elf64_Sym sym;
-            size_t absoffset = dynsym_off + j * sizeof(Elf64_Sym);
-            _CHECK_BOUNDS(cbytes + absoffset, "rela 2: cbytes + absoffset");
-            memmove(&sym, cbytes + absoffset, sizeof(sym));
-            
-            if (sym.st_name != 0) {
-                char *name = cbytes + dynstr_off + sym.st_name;
-                _CHECK_BOUNDS(name, "rela: name"); // XXX: technically doesn't check if null-terminated. could read into memory if name wasn't null terminated
-                size_t n = strlen(name);
-                char *pos = strstr(name, "@GLIBC_"); // XXX: slightly hacky
-                if (pos) {
-                    n = pos - name;
-                }
-
-                SymbolEntry *cse = se_head;
-                while (1) {
-                    if (!cse) break;
-                    if (((!cse->offset && rela_offsets[ji]) || cse->type == SE_TYPE_UNRESOLVED) && strcmp(cse->name, name) == 0) {
-                        debug("rela dyn plt: st_name: %s @ " U64T " (%d) rela idx %d\n", name, (uint64_t)rela_offsets[ji], sym.st_shndx, ji);
-                        cse->type = SE_TYPE_DYNAMIC;
-                        cse->offset = (uint64_t)rela_offsets[ji];
-                        cse->section = sym.st_shndx;
-                        if (cse->offset) is_stripped = 0;
-                    }
-                    cse = cse->_next;
-                }
-            }
-            ji++;
-        }
-    }
-
-    // resolve dynamic (plt) symbols
-    // XXX/TODO: refactor to merge with the code block above
-    if (rela_plt_off && dynstr_off && dynsym_off) {
-        int rela_offsets_sz = (dynsym_sz / sizeof(Elf64_Sym)) + 1;
-        size_t rela_offsets[rela_offsets_sz];
-        for (int k = 0; k < rela_offsets_sz; k++) rela_offsets[k] = 0;
-
-        for (size_t j = 0; j * sizeof(Elf64_Rela) < rela_plt_sz; j++) {
+        for (size_t j = 0; rela_plt_off && j * sizeof(Elf64_Rela) < rela_plt_sz; j++) {
             Elf64_Rela rela;
             size_t absoffset = rela_plt_off + j * sizeof(Elf64_Rela);
             _CHECK_BOUNDS(cbytes + absoffset, ".plt: cbytes + absoffset");
             memmove(&rela, cbytes + absoffset, sizeof(rela));
-            //printf("rela plt: 0x%x (sym=%d, type=%d)\n", rela.r_offset, ELF64_R_SYM(rela.r_info), ELF64_R_TYPE(rela.r_info));
             if (ELF64_R_TYPE(rela.r_info) == R_X86_64_JUMP_SLOT) {
-                int sym_i = ELF64_R_SYM(rela.r_info);
+                size_t sym_i = ELF64_R_SYM(rela.r_info);
                 ASSERT(sym_i < rela_offsets_sz, ".plt");
-                rela_offsets[sym_i] = rela.r_offset;
+                rela_plt_offsets[sym_i] = rela.r_offset;
             }
         }
 
+        // one walk over .dynsym to find the requested names
+        Elf64_Sym *dynsyms = (Elf64_Sym *)(cbytes + dynsym_off);
+        if (dynsym_count) _CHECK_BOUNDS((char *)(dynsyms + dynsym_count) - 1, "dynsym: end");
+        for (size_t j = 0; j < dynsym_count; j++) {
+            if (!dynsyms[j].st_name) continue;
+            char *name = cbytes + dynstr_off + dynsyms[j].st_name;
+            _CHECK_BOUNDS(name, "rela: name"); // XXX: technically doesn't check if null-terminated. could read into memory if name wasn't null terminated
+            NameSlot *slot = _name_set_find(&names_set, name, _hash_name(name));
+            if (slot) _name_slot_add_match(slot, j);
+        }
 
-        int ji = 0;
-        for (size_t j = 0; j * sizeof(Elf64_Sym) < dynsym_sz; j++) {
-            Elf64_Sym sym;
-            size_t absoffset = dynsym_off + j * sizeof(Elf64_Sym);
-            _CHECK_BOUNDS(cbytes + absoffset, ".plt 2: cbytes + absoffset");
-            memmove(&sym, cbytes + absoffset, sizeof(sym));
-            
-            if (sym.st_name != 0) {
-                char *name = cbytes + dynstr_off + sym.st_name;
-                _CHECK_BOUNDS(name, ".plt: name");
-                size_t n = strlen(name);
-                char *pos = strstr(name, "@GLIBC_"); // XXX: slightly hacky
-                if (pos) {
-                    n = pos - name;
-                }
-
-                SymbolEntry *cse = se_head;
-                while (1) {
-                    if (!cse) break;
-                    if (((!cse->offset && rela_offsets[ji]) || cse->type == SE_TYPE_UNRESOLVED) && strcmp(cse->name, name) == 0) {
-                        debug("dyn plt: st_name: %s @ " U64T " (shndx=%d) rela idx %d\n", name, (uint64_t)rela_offsets[ji], sym.st_shndx, ji);
-                        cse->type = SE_TYPE_DYNAMIC_PLT;
-                        cse->offset = (uint64_t)rela_offsets[ji];
-                        cse->section = sym.st_shndx;
-                        if (cse->offset) is_stripped = 0;
+        // apply the .rela.dyn matches before the .rela.plt ones so PLT 
+        // entries take priority the same way they always have
+        uint64_t *rela_offsets_by_pass[2] = {rela_dyn_offsets, rela_plt_offsets};
+        int type_by_pass[2] = {SE_TYPE_DYNAMIC, SE_TYPE_DYNAMIC_PLT};
+        for (int pass = 0; pass < 2; pass++) {
+            if (!(pass ? rela_plt_off : rela_dyn_off)) continue;
+            uint64_t *rela_offsets = rela_offsets_by_pass[pass];
+
+            for (size_t k = 0; k < names_set.cap; k++) {
+                NameSlot *slot = &names_set.slots[k];
+                for (size_t m = 0; m < slot->dynsym_matches_sz; m++) {
+                    size_t ji = slot->dynsym_matches[m];
+                    for (SymbolEntry *cse = se_head; cse; cse = cse->_next) {
+                        if (((!cse->offset && rela_offsets[ji]) || cse->type == SE_TYPE_UNRESOLVED) && strcmp(cse->name, slot->name) == 0) {
+                            debug("%s: st_name: %s @ " U64T " (shndx=%d) rela idx %lu\n", pass ? "dyn plt" : "rela dyn plt", slot->name, rela_offsets[ji], dynsyms[ji].st_shndx, ji);
+                            cse->type = type_by_pass[pass];
+                            cse->offset = rela_offsets[ji];
+                            cse->section = dynsyms[ji].st_shndx;
+                            if (cse->offset) is_stripped = 0;
+                        }
                     }
-                    cse = cse->_next;
                 }
             }
-            ji++;
+        }
+
+        free(rela_dyn_offsets);
+        free(rela_plt_offsets);
+    }
+
+    // resolve exported symbols through the dynamic hash tables. This is what 
+    // finds the heap functions in a libc without .symtab. A library that 
+    // calls its own exports through the PLT (e.g. libstdc++'s operator new) 
+    // also has a GOT slot for them, but the definition is what gets hooked.
+    DynamicSymtab ds;
+    if (_init_dynamic_symtab(&ds, cbytes, (size_t)tfile_size, &elf_hdr)) {
+        uint64_t base_vaddr = ds.loads_sz ? (ds.loads[0].p_vaddr & ~(uint64_t)0xfff) : 0;
+        for (SymbolEntry *cse = se_head; cse; cse = cse->_next) {
+            if (cse->offset && (cse->type == SE_TYPE_STATIC || cse->section == SHN_UNDEF)) continue;
+            Elf64_Sym *sym = _dynamic_symtab_lookup(&ds, cse->name);
+            if (sym) {
+                debug("hash: st_name: %s @ " U64T "\n", cse->name, (uint64_t)sym->st_value);
+                cse->type = SE_TYPE_STATIC;
+                cse->offset = sym->st_value - base_vaddr;
+                cse->_sub_offset = 0;
+                cse->size = sym->st_size;
+                cse->section = sym->st_shndx;
+                is_stripped = 0;
+            }
         }
     }
+    _free_dynamic_symtab(&ds);
 
-    // resolve static symbols
-    SymbolEntry *all_static_se_head = 0;
+    // resolve static symbols. These are also all kept (in symtab order) for 
+    // address -> name lookups. Names point into the mapping; no copies.
+    SymbolEntry *static_ses = 0;
+    size_t static_ses_sz = 0;
     if (strtab_off && symtab_off) {
-        for (size_t j = 0; j * sizeof(Elf64_Sym) < symtab_sz; j++) {
-            Elf64_Sym sym;
-            size_t absoffset = symtab_off + j * sizeof(Elf64_Sym);
-            _CHECK_BOUNDS(cbytes + absoffset, "static: cbytes + absoffset");
-            memmove(&sym, cbytes + absoffset, sizeof(sym));
-            if (sym.st_name != 0) {
-                char *name = cbytes + strtab_off + sym.st_name;
+        size_t symtab_count = symtab_sz / sizeof(Elf64_Sym);
+        Elf64_Sym *syms = (Elf64_Sym *)(cbytes + symtab_off);
+        if (symtab_count) _CHECK_BOUNDS((char *)(syms + symtab_count) - 1, "static: end");
+        static_ses = (SymbolEntry *)malloc(symtab_count * sizeof(SymbolEntry));
+
+        for (size_t j = 0; j < symtab_count; j++) {
+            Elf64_Sym *sym = &syms[j];
+            if (sym->st_name != 0) {
+                char *name = cbytes + strtab_off + sym->st_name;
                 _CHECK_BOUNDS(name, "static: name");
-                size_t n = strlen(name);
 
-                uint64_t offset = (uint64_t)(sym.st_value);
+                uint64_t offset = (uint64_t)(sym->st_value);
                 // XXX: for some reason libc has a load addr of 0x40 that's throwing stuff off. This is a stopgap solution for that.
                 if (!is_dynamic) offset -= load_addr;
 
-                SymbolEntry *cse = se_head;
-                while (1) {
-                    if (!cse) break;
-                    if (((!cse->offset && sym.st_value) || cse->type == SE_TYPE_UNRESOLVED) && strcmp(cse->name, name) == 0) {
-                        debug("tab: st_name: %s @ " U64T "\n", name, (uint64_t)sym.st_value);
-                        cse->type = SE_TYPE_STATIC;
-                        cse->offset = offset;
-                        cse->_sub_offset = 0;
-                        cse->size = sym.st_size;
-                        cse->section = sym.st_shndx;
-                        if (sym.st_value) is_stripped = 0;
+                NameSlot *slot = _name_set_find(&names_set, name, _hash_name(name));
+                if (slot) {
+                    for (SymbolEntry *cse = se_head; cse; cse = cse->_next) {
+                        if (((!cse->offset && sym->st_value) || cse->type == SE_TYPE_UNRESOLVED) && strcmp(cse->name, name) == 0) {
+                            debug("tab: st_name: %s @ " U64T "\n", name, (uint64_t)sym->st_value);
+                            cse->type = SE_TYPE_STATIC;
+                            cse->offset = offset;
+                            cse->_sub_offset = 0;
+                            cse->size = sym->st_size;
+                            cse->section = sym->st_shndx;
+                            if (sym->st_value) is_stripped = 0;
+                        }
                     }
-                    cse = cse->_next;
                 }
 
-                // now add to all_static_se_head
-                SymbolEntry *_cur_static_se = (SymbolEntry *)calloc(1, sizeof(SymbolEntry));
-                _cur_static_se->_next = all_static_se_head;
-                all_static_se_head = _cur_static_se;
-
-                _cur_static_se->name = strdup(name);
+                SymbolEntry *_cur_static_se = &static_ses[static_ses_sz++];
+                _cur_static_se->name = name;
                 _cur_static_se->offset = offset;
-                _cur_static_se->size = sym.st_size;
-                _cur_static_se->_sub_offset = 0;
+                _cur_static_se->size = sym->st_size;
+                _cur_static_se->section = sym->st_shndx;
                 _cur_static_se->type = SE_TYPE_STATIC;
-                _cur_static_se->section = sym.st_shndx;
-
-                //printf("%s\toffset=%p, size=%p\n", _cur_static_se->name, _cur_static_se->offset, _cur_static_se->size);
+                _cur_static_se->_sub_offset = 0;
+                _cur_static_se->_next = 0;
             }
         }
     }
 
-    hf->all_static_se_head = all_static_se_head;
+    _name_set_free(&names_set);
+
+    free_se_list(hf->se_head);
+    hf->static_ses = static_ses;
+    hf->static_ses_sz = static_ses_sz;
     hf->se_head = se_head;
     hf->is_stripped = is_stripped;
     hf->is_dynamic = is_dynamic;
+    hf->analyzed = 1;
+
+    build_symbol_index(hf);
+}
+
+
+// looks up `names` in libc, where the heap functions are exported under 
+// both `name` and `__libc_name`. The `__libc_` form is preferred; the plain 
+// name is used for functions that don't have one (e.g. mmap). The resulting 
+// entries use the plain names.
+void lookup_libc_symbols(HeaptraceFile *hf, char *names[]) {
+    int names_c = 0;
+    while (names[names_c]) names_c++;
+
+    // the first half of arr is prefixed with "__libc_", the second is not
+    char **arr = malloc(sizeof(char *) * (names_c * 2 + 1));
+    for (int i = 0; i < names_c; i++) {
+        size_t str1_len = 7; // strlen("__libc_");
+        size_t str2_len = strlen(names[i]);
+        char *se_name = malloc(str1_len + str2_len + 1);
+        memcpy(se_name, "__libc_", str1_len);
+        memcpy(se_name + str1_len, names[i], str2_len + 1);
+        arr[i] = se_name;
+        arr[names_c + i] = names[i];
+    }
+    arr[names_c * 2] = NULL;
+    lookup_symbols(hf, arr);
+    
+    // free temp sym array
+    for (int i = 0; i < names_c; i++) free(arr[i]);
+    free(arr);
+
+    // lookup_symbols keeps the order of the names, so pair up both halves
+    SymbolEntry **ses = malloc(sizeof(SymbolEntry *) * (names_c * 2 + 1));
+    int ses_c = 0;
+    for (SymbolEntry *se = hf->se_head; se && ses_c < names_c * 2; se = se->_next) ses[ses_c++] = se;
+    if (ses_c != names_c * 2) {
+        // lookup_symbols failed and already complained
+        free(ses);
+        return;
+    }
+
+    for (int i = 0; i < names_c; i++) {
+        SymbolEntry *se = ses[i];
+        SymbolEntry *unused = ses[names_c + i];
+        if (!se->offset && unused->offset) {
+            se = unused;
+            unused = ses[i];
+        } else {
+            // remove "__libc_" prefix
+            char *old_name = se->name;
+            se->name = strdup(se->name + 7); // 7 == strlen("__libc_")
+            free(old_name);
+        }
+        free(unused->name);
+        free(unused);
+
+        if (!se->offset) {
+            se->type = SE_TYPE_UNRESOLVED;
+        }
+        se->_next = 0;
+        if (i) ses[i - 1]->_next = se;
+        ses[i] = se;
+    }
+    hf->se_head = names_c ? ses[0] : 0;
+    free(ses);
+}
+
+
+// frees the static symbol array. The names it points to belong to hf->elf.
+void free_static_symbols(HeaptraceFile *hf) {
+    free_symbol_index(hf);
+    free(hf->static_ses);
+    hf->static_ses = 0;
+    hf->static_ses_sz = 0;
+}
+
+
+static int _cmp_symbol_range(const void *a, const void *b) {
+    const SymbolRange *x = (const SymbolRange *)a;
+    const SymbolRange *y = (const SymbolRange *)b;
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    // aliases: keep symtab order so the later symbol is found first when 
+    // find_symbol_by_address walks backwards
+    return x->se < y->se ? -1 : (x->se > y->se);
+}
+
+
+// builds hf->sym_index from hf->static_ses so find_symbol_by_address can 
+// binary search instead of walking every symbol
+void build_symbol_index(HeaptraceFile *hf) {
+    free_symbol_index(hf);
+
+    size_t n = 0;
+    for (size_t i = 0; i < hf->static_ses_sz; i++) {
+        if (hf->static_ses[i].size) n++; // zero-sized symbols can never contain an address
+    }
+    if (!n) return;
+
+    SymbolRange *index = (SymbolRange *)malloc(n * sizeof(SymbolRange));
+    ASSERT(index, "build_symbol_index: malloc out of memory");
+
+    n = 0;
+    for (size_t i = 0; i < hf->static_ses_sz; i++) {
+        SymbolEntry *se = &hf->static_ses[i];
+        if (!se->size) continue;
+        SymbolRange *range = &index[n++];
+        range->start = se->offset;
+        range->end = se->offset + se->size;
+        range->se = se;
+    }
+
+    qsort(index, n, sizeof(SymbolRange), _cmp_symbol_range);
+
+    uint64_t max_end = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (index[i].end > max_end) max_end = index[i].end;
+        index[i].max_end = max_end;
+    }
+
+    hf->sym_index = index;
+    hf->sym_index_sz = n;
+}
+
+
+void free_symbol_index(HeaptraceFile *hf) {
+    free(hf->sym_index);
+    hf->sym_index = 0;
+    hf->sym_index_sz = 0;
+}
+
+
+// a HeaptraceFile loaded from the cache only has the requested symbols. The 
+// rest are parsed the first time an address has to be described.
+static void _load_static_symbols(HeaptraceFile *hf) {
+    SymbolEntry *se_head = hf->se_head;
+    uint is_dynamic = hf->is_dynamic;
+    uint is_stripped = hf->is_stripped;
+    char *no_names[] = {NULL};
+
+    hf->se_head = 0;
+    lookup_symbols(hf, no_names);
+    hf->se_head = se_head;
+    hf->is_dynamic = is_dynamic;
+    hf->is_stripped = is_stripped;
+    hf->from_cache = 0; // only try once
 }
 
 
 SymbolEntry *find_symbol_by_address(HeaptraceFile *hf, uint64_t addr) {
     if (!(hf->pme) || addr < hf->pme->base || addr >= hf->pme->end) return 0; // not in bounds
+    if (hf->from_cache && !hf->static_ses) _load_static_symbols(hf);
     addr -= hf->pme->base;
-    
-    SymbolEntry *cur_se = hf->all_static_se_head;
-    while(cur_se) {
-        //printf("... %s\taddr=%p, offset=%p, offset+size=%p\n", cur_se->name, addr, cur_se->offset, cur_se->offset + cur_se->size);
-        if (addr >= cur_se->offset && addr < cur_se->offset + cur_se->size) return cur_se;
-        cur_se = cur_se->_next;
+    if (!hf->sym_index_sz) return 0;
+
+    // find the last range that starts at or before addr
+    size_t lo = 0;
+    size_t hi = hf->sym_index_sz;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hf->sym_index[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // walk back in case it's inside a bigger symbol that starts earlier; 
+    // max_end tells us when no earlier range can contain addr anymore
+    while (lo > 0) {
+        SymbolRange *range = &hf->sym_index[--lo];
+        if (range->max_end <= addr) break;
+        if (addr < range->end) return range->se;
     }
 
     return 0;
@@ -401,23 +765,21 @@ void free_se_list(SymbolEntry *se_head) {
 }
 
 
-char *get_source_function(HeaptraceContext *ctx) {
+static char *_describe_address(HeaptraceContext *ctx, uint64_t addr, ProcELFType pet) {
     char *section = "<unknown>";
-    if (OPT_VERBOSE) {
-        switch (ctx->h_ret_ptr_section_type) {
-            case PROCELF_TYPE_LIBC:
-                section = "libc";
-                break;
-            case PROCELF_TYPE_UNKNOWN:
-                section = "<library>";
-                break;
-            case PROCELF_TYPE_BINARY:
-                section = 0;
-                break;
-        }
+    switch (pet) {
+        case PROCELF_TYPE_LIBC:
+            section = "libc";
+            break;
+        case PROCELF_TYPE_UNKNOWN:
+            section = "<library>";
+            break;
+        case PROCELF_TYPE_BINARY:
+            section = 0;
+            break;
     }
 
-    char *symbol_name = find_symbol_name_by_address(ctx, ctx->h_ret_ptr);
+    char *symbol_name = find_symbol_name_by_address(ctx, addr);
     size_t buf_size = 2;
     if (symbol_name) buf_size += strlen(symbol_name);
     if (section) buf_size += 1 + strlen(section);
@@ -434,3 +796,45 @@ char *get_source_function(HeaptraceContext *ctx) {
 
     return buf;
 }
+
+
+// the same few return addresses show up over and over, so descriptions are 
+// kept in a small direct-mapped cache. The returned string is owned by the 
+// cache and is only valid until the next lookup.
+static const char *_cached_describe_address(HeaptraceContext *ctx, uint64_t addr, ProcELFType pet) {
+    if (!ctx->source_cache) {
+        ctx->source_cache = (SourceCacheEntry *)calloc(SOURCE_CACHE_SZ, sizeof(SourceCacheEntry));
+        ASSERT(ctx->source_cache, "_cached_describe_address: calloc out of memory");
+    }
+
+    SourceCacheEntry *entry = &ctx->source_cache[(size_t)((addr * 0x9E3779B97F4A7C15LLU) >> 32) & (SOURCE_CACHE_SZ - 1)];
+    if (entry->desc && entry->addr == addr && entry->pet == (int)pet) return entry->desc;
+
+    free(entry->desc);
+    entry->addr = addr;
+    entry->pet = (int)pet;
+    entry->desc = _describe_address(ctx, addr, pet);
+    return entry->desc;
+}
+
+
+const char *get_source_function(HeaptraceContext *ctx) {
+    return _cached_describe_address(ctx, ctx->h_ret_ptr, OPT_VERBOSE ? ctx->h_ret_ptr_section_type : (ProcELFType)-1);
+}
+
+
+// like get_source_function, but for any address in the process
+const char *describe_address(HeaptraceContext *ctx, uint64_t addr) {
+    ProcMapsEntry *pme = pme_find_addr(ctx->proc_maps, addr);
+    return _cached_describe_address(ctx, addr, pme ? pme->pet : PROCELF_TYPE_UNKNOWN);
+}
+
+
+void free_source_cache(HeaptraceContext *ctx) {
+    if (!ctx->source_cache) return;
+    for (int i = 0; i < SOURCE_CACHE_SZ; i++) {
+        free(ctx->source_cache[i].desc);
+    }
+    free(ctx->source_cache);
+    ctx->source_cache = 0;
+}
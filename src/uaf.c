@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+
+#include "uaf.h"
+#include "context.h"
+#include "heap.h"
+#include "logging.h"
+#include "jsonl.h"
+
+uint64_t OPT_CHECK_UAF = 0;
+
+/*
+ * --check-uaf hashes the user bytes of each freed chunk and hashes them 
+ * again when malloc hands the same chunk out, or when the tracee exits. 
+ * glibc itself only writes to a free chunk's freelist pointers (fd and bk, 
+ * plus fd_nextsize and bk_nextsize in the large bins) and to the prev_size 
+ * field the next chunk keeps in its last 8 bytes, so the bytes in between 
+ * must stay the same. A small chunk can still end up at the start of a 
+ * large free chunk when free or malloc_consolidate merges it, so its 2 
+ * words where fd_nextsize and bk_nextsize would be are compared instead of 
+ * hashed, and may change into NULL or pointers to heap chunks.
+ *
+ * A chunk is hashed as soon as free returns, since the tracee may write to 
+ * it right after. The chunks left at exit are read in batches of 
+ * UAF_BATCH_SZ per process_vm_readv. A chunk that an allocation overlaps 
+ * without returning it (a split or a merge into another chunk) is forgotten 
+ * instead of checked.
+ */
+
+#define UAF_SKIP 0x10 // fd and bk
+#define UAF_SKIP_LARGE 0x20 // fd, bk, fd_nextsize and bk_nextsize
+#define UAF_MIN_LARGE 0x400 // smallest chunk in a large bin
+
+
+// FNV-1a
+static uint64_t _hash(const uint8_t *data, size_t sz) {
+    uint64_t h = 0xcbf29ce484222325LLU;
+    for (size_t i = 0; i < sz; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3LLU;
+    }
+    return h;
+}
+
+
+// the freelist pointers at the start of a freed chunk, which are not read
+static uint64_t _skip(Chunk *chunk) {
+    return chunk_bytes(chunk) >= UAF_MIN_LARGE ? UAF_SKIP_LARGE : UAF_SKIP;
+}
+
+
+// the range that is read, relative to the chunk's pointer: [_skip, end)
+static uint64_t _hashed_end(Chunk *chunk) {
+    uint64_t end = chunk_bytes(chunk) - 0x10; // the next chunk's prev_size starts here
+    if (chunk->size < end) end = chunk->size;
+    if (end > _skip(chunk) + OPT_CHECK_UAF) end = _skip(chunk) + OPT_CHECK_UAF;
+    return end;
+}
+
+
+// the bytes where a large chunk keeps fd_nextsize and bk_nextsize, which a 
+// small chunk compares as words instead of hashing
+static size_t _word_bytes(Chunk *chunk) {
+    if (_skip(chunk) != UAF_SKIP) return 0;
+    return chunk->uaf_len < 0x10 ? chunk->uaf_len : 0x10;
+}
+
+
+// splits the bytes read from a chunk into those words and a hash of the rest
+static void _digest(Chunk *chunk, const uint8_t *data, uint64_t *hash, uint64_t *words) {
+    size_t nbytes = _word_bytes(chunk);
+    words[0] = words[1] = 0;
+    memcpy(words, data, nbytes);
+    *hash = _hash(data + nbytes, chunk->uaf_len - nbytes);
+}
+
+
+// what glibc writes to fd_nextsize and bk_nextsize: NULL, or a chunk address, 
+// which is 16 byte aligned and in the same heap. A word cut short by the end 
+// of the chunk only has its low bytes, so the rest are taken from the chunk.
+static int _is_chunk_pointer(Chunk *chunk, uint64_t word, size_t nbytes) {
+    if (!word) return 1;
+    if (nbytes < 8) word |= chunk->ptr & ~((1LU << (nbytes * 8)) - 1);
+    return !(word & 0xf) && word - chunk->ptr + (1LU << 32) < (1LU << 33);
+}
+
+
+static int _modified(Chunk *chunk, uint64_t hash, const uint64_t *words) {
+    if (hash != chunk->uaf_hash) return 1;
+    size_t nbytes = _word_bytes(chunk);
+    for (size_t i = 0; i * 8 < nbytes; i++) {
+        size_t n = nbytes - i * 8 < 8 ? nbytes - i * 8 : 8;
+        if (words[i] != chunk->uaf_words[i] && !_is_chunk_pointer(chunk, words[i], n)) return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * reads the checked bytes of n chunks with as few process_vm_readv calls as 
+ * possible. A call stops at the first chunk that is no longer mapped, so 
+ * that chunk is skipped (its readable flag stays 0) and the rest retried.
+ */
+static void _read_chunks(HeaptraceContext *ctx, Chunk **chunks, size_t n, uint64_t *hashes, uint64_t (*words)[2], int *readable) {
+    struct iovec local[UAF_BATCH_SZ];
+    struct iovec remote[UAF_BATCH_SZ];
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) total += chunks[i]->uaf_len;
+    uint8_t *buf = (uint8_t *)malloc(total ? total : 1);
+    ASSERT(buf, "_read_chunks: malloc out of memory");
+
+    for (size_t i = 0, off = 0; i < n; off += chunks[i]->uaf_len, i++) {
+        local[i].iov_base = buf + off;
+        local[i].iov_len = chunks[i]->uaf_len;
+        remote[i].iov_base = (void *)(chunks[i]->ptr + _skip(chunks[i]));
+        remote[i].iov_len = chunks[i]->uaf_len;
+        readable[i] = 0;
+    }
+
+    size_t start = 0;
+    while (start < n) {
+        ssize_t nread = process_vm_readv(ctx->pid, local + start, n - start, remote + start, n - start, 0);
+        if (nread < 0) nread = 0;
+        size_t i = start;
+        for (; i < n && (size_t)nread >= local[i].iov_len; i++) {
+            nread -= local[i].iov_len;
+            _digest(chunks[i], local[i].iov_base, &hashes[i], words[i]);
+            readable[i] = 1;
+        }
+        start = i + 1;
+    }
+    free(buf);
+}
+
+
+// hashes a chunk that free just released. Chunks that free unmapped (the 
+// mmapped ones) can't be read and are skipped.
+void uaf_freed(HeaptraceContext *ctx, Chunk *chunk) {
+    if (!OPT_CHECK_UAF || !chunk || !chunk->ptr) return;
+    chunk->uaf_state = UAF_NONE;
+
+    uint64_t end = _hashed_end(chunk);
+    if (end <= _skip(chunk)) return; // too small to hold anything but freelist pointers
+    chunk->uaf_len = end - _skip(chunk);
+
+    int readable;
+    _read_chunks(ctx, &chunk, 1, &chunk->uaf_hash, &chunk->uaf_words, &readable);
+    if (readable) chunk->uaf_state = UAF_HASHED;
+}
+
+
+// counts the hashed freed chunks that overlap [lo, hi), except `keep`, and 
+// forgets their hashes if `forget` is set
+static size_t _overlapping(Chunk *root, uint64_t lo, uint64_t hi, Chunk *keep, int forget) {
+    if (!root) return 0;
+    size_t n = 0;
+    // chunks to the left start lower, but their hashed bytes may still reach lo
+    if (root->ptr + UAF_SKIP_LARGE + OPT_CHECK_UAF > lo) n += _overlapping(root->left, lo, hi, keep, forget);
+    if (root != keep && root->uaf_state == UAF_HASHED && root->ptr + _skip(root) + root->uaf_len > lo && root->ptr + _skip(root) < hi) {
+        if (forget) root->uaf_state = UAF_NONE;
+        n++;
+    }
+    if (root->ptr < hi) n += _overlapping(root->right, lo, hi, keep, forget);
+    return n;
+}
+
+
+/*
+ * called by allocators before they update the chunk they return. If glibc 
+ * handed out a hashed chunk again and `verify` is set (it didn't write to 
+ * the chunk, unlike calloc and realloc), the chunk is checked.
+ */
+void uaf_allocated(HeaptraceContext *ctx, Chunk *chunk, uint64_t ptr, uint64_t size, int verify) {
+    if (!OPT_CHECK_UAF || !ptr) return;
+
+    // a split leaves the remainder's header and freelist pointers right 
+    // after the new chunk. A freed chunk that is handed out again whole 
+    // (from the tcache, a fastbin or an exact fit) leaves its neighbours be, 
+    // unless the heap was laid out differently since it was freed, in which 
+    // case other freed chunks overlap it or the header after it. glibc hands 
+    // out a remainder too small to split off with the chunk, so the size is 
+    // read from its header.
+    uint64_t nb = CHUNK_SIZE(size + OPT_REDZONE);
+    uint64_t field = (uint64_t)ptrace(PTRACE_PEEKDATA, ctx->pid, ptr - sizeof(uint64_t), NULL);
+    if (!(field & 0x2) && (field & ~(uint64_t)0x7) - nb < 0x20) nb = field & ~(uint64_t)0x7;
+    uint64_t old_nb = chunk && chunk->real_size ? chunk->real_size : (chunk ? CHUNK_SIZE(chunk->size + OPT_REDZONE) : 0);
+    int exact = chunk && chunk->ptr == ptr && chunk->state == STATE_FREE && old_nb == nb
+        && !_overlapping(ctx->chunk_root, ptr - 0x10, ptr + nb + 0x10, chunk, 0);
+    if (!exact) _overlapping(ctx->chunk_root, ptr - 0x10, ptr + nb + 0x30, chunk, 1);
+
+    if (!chunk || chunk->ptr != ptr || chunk->uaf_state != UAF_HASHED) return;
+    chunk->uaf_state = UAF_NONE;
+    if (!verify || _skip(chunk) + chunk->uaf_len > CHUNK_SIZE(size) - 0x10) return;
+
+    uint64_t hash;
+    uint64_t words[1][2];
+    int readable;
+    _read_chunks(ctx, &chunk, 1, &hash, words, &readable);
+    if (readable && _modified(chunk, hash, words[0])) {
+        ctx->uaf_modified_count++;
+        warn_heap("chunk " SYM " was modified after it was freed in operation " SYM, chunk->ops[STATE_MALLOC], chunk->ops[STATE_FREE]);
+        warn_heap2("this indicates a use-after-free write");
+    }
+}
+
+
+static void _collect_hashed(Chunk *root, Chunk ***arr, size_t *sz, size_t *cap) {
+    if (!root) return;
+    if (root->uaf_state == UAF_HASHED) {
+        if (*sz == *cap) {
+            *cap = *cap ? *cap * 2 : UAF_BATCH_SZ;
+            *arr = (Chunk **)realloc(*arr, *cap * sizeof(Chunk *));
+            ASSERT(*arr, "_collect_hashed: realloc out of memory");
+        }
+        (*arr)[(*sz)++] = root;
+    }
+    _collect_hashed(root->left, arr, sz, cap);
+    _collect_hashed(root->right, arr, sz, cap);
+}
+
+
+// checks every chunk that is still hashed. Only works while the tracee is 
+// still around, i.e. at its exit event.
+void uaf_check_all(HeaptraceContext *ctx) {
+    if (!OPT_CHECK_UAF) return;
+
+    Chunk **chunks = 0;
+    size_t n = 0;
+    size_t cap = 0;
+    _collect_hashed(ctx->chunk_root, &chunks, &n, &cap);
+
+    uint64_t hashes[UAF_BATCH_SZ];
+    uint64_t words[UAF_BATCH_SZ][2];
+    int readable[UAF_BATCH_SZ];
+    for (size_t off = 0; off < n; off += UAF_BATCH_SZ) {
+        size_t batch = n - off < UAF_BATCH_SZ ? n - off : UAF_BATCH_SZ;
+        _read_chunks(ctx, chunks + off, batch, hashes, words, readable);
+        for (size_t i = 0; i < batch; i++) {
+            Chunk *chunk = chunks[off + i];
+            chunk->uaf_state = UAF_NONE;
+            if (readable[i] && _modified(chunk, hashes[i], words[i])) {
+                chunk->uaf_state = UAF_MODIFIED;
+                ctx->uaf_modified_count++;
+            }
+        }
+    }
+    free(chunks);
+}
+
+
+static void _show_modified(HeaptraceContext *ctx, Chunk *root) {
+    if (!root) return;
+    _show_modified(ctx, root->left);
+    if (root->uaf_state == UAF_MODIFIED) {
+        log("... chunk " SYM COLOR_ERROR " (" PTR_ERR ") was modified after it was freed in operation " SYM COLOR_ERROR "\n", root->ops[STATE_MALLOC], PTR_ARG(root->ptr), root->ops[STATE_FREE]);
+    }
+    _show_modified(ctx, root->right);
+}
+
+
+void show_uaf_stats(HeaptraceContext *ctx) {
+    if (!OPT_CHECK_UAF || !ctx->uaf_modified_count) return;
+    color_log(COLOR_ERROR);
+    log("... chunks modified after free: " COLOR_ERROR_BOLD "%lu" COLOR_ERROR "\n", ctx->uaf_modified_count);
+    _show_modified(ctx, ctx->chunk_root);
+    color_log(COLOR_RESET);
+}
+
+
+// adds the counter to the stats record that is being built
+void show_uaf_stats_jsonl(HeaptraceContext *ctx) {
+    if (!OPT_CHECK_UAF) return;
+    jsonl_key("modified_after_free");
+    jsonl_u64(ctx->uaf_modified_count);
+}
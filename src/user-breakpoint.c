@@ -423,8 +423,8 @@ static void _fill_symbol_references(HeaptraceContext *ctx, ProcMapsEntry *bin_pm
 
 
 void fill_symbol_references(HeaptraceContext *ctx) {
-    ProcMapsEntry *bin_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_BINARY);
-    ProcMapsEntry *libc_pme = pme_walk(ctx->pme_head, PROCELF_TYPE_LIBC);
+    ProcMapsEntry *bin_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_BINARY);
+    ProcMapsEntry *libc_pme = pme_walk(ctx->proc_maps, PROCELF_TYPE_LIBC);
     ASSERT(bin_pme, "cannot find binary base address");
 
     UserBreakpoint *cur_ubp = USER_BREAKPOINT_HEAD;
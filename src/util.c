@@ -1,5 +1,7 @@
 #include "util.h"
 
+__thread jmp_buf *assert_jmp = 0;
+
 uint is_uint(char *str) {
     if (!str) return 0;
     while (*str) {
@@ -33,3 +35,11 @@ uint64_t str_to_uint64(char *buf) {
     char *_ptr;
     return strtoull(buf, &_ptr, base);
 }
+
+
+// milliseconds elapsed on CLOCK_MONOTONIC since `start`
+double ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
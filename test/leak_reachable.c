@@ -0,0 +1,20 @@
+#include <malloc.h>
+#include <stdlib.h>
+
+void *global; // .bss
+__thread void *tls; // TLS, in an anonymous mapping
+void *big; // mmapped, which can merge with the TLS mapping
+
+int main() {
+    // nothing points to it anymore; definitely lost
+    void *ptr = malloc(0x40);
+    ptr = 0;
+
+    // reachable from .bss, TLS and the stack; not leaks
+    global = malloc(0x50);
+    big = malloc(0x100000);
+    tls = malloc(0x60);
+    void *volatile local = malloc(0x70);
+
+    exit(0);
+}
@@ -0,0 +1,24 @@
+#include <cstdlib>
+#include <new>
+
+int main() {
+    // released the right way; nothing to warn about
+    int *ok = new int;
+    delete ok;
+    char *ok_array = new char[0x20];
+    delete[] ok_array;
+
+    // operator new[] throws std::bad_alloc, and the ops after it still have 
+    // to be traced
+    try {
+        char *huge = new char[(size_t)1 << 62];
+        delete[] huge;
+    } catch (const std::bad_alloc &) {
+    }
+
+    // mismatched: delete on new[], free on new
+    char *array = new char[0x20];
+    delete array;
+    int *single = new int;
+    free(single);
+}
@@ -0,0 +1,19 @@
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main() {
+    // every byte written is inside of the chunk; nothing to warn about
+    char *ok = malloc(0x18);
+    memset(ok, 'A', 0x18);
+    free(ok);
+
+    // writes 8 bytes past the end; --redzone warns when it is freed
+    char *ptr = malloc(0x18);
+    memset(ptr, 'B', 0x20);
+    free(ptr);
+
+    // overflowed and never freed; reported at exit
+    char *leaked = malloc(0x30);
+    leaked[0x30] = 'C';
+}
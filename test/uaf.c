@@ -0,0 +1,23 @@
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main() {
+    // freed and handed out again untouched; nothing to warn about
+    char *ok = malloc(0x40);
+    free(ok);
+    ok = malloc(0x40);
+    memset(ok, 'A', 0x40);
+    free(ok);
+
+    // written to after free; --check-uaf warns when malloc returns it again
+    char *ptr = malloc(0x40);
+    free(ptr);
+    ptr[0x20] = 'B';
+    malloc(0x40);
+
+    // written to after free and never reused; reported at exit
+    char *late = malloc(0x80);
+    free(late);
+    late[0x30] = 'C';
+}